@@ -28,6 +28,121 @@ struct user_core_mem {
     struct user_mem_seg mem_segs[];
 };
 
+// periodic sampler, "/dev/swd_sampler"
+#define SWD_SAMPLER_MAX_VARS    32
+
+struct swd_sampler_var {
+    uint32_t addr;
+    uint32_t width;     // 1, 2 or 4 bytes, must not cross a word
+};
+
+struct swd_sampler_cfg {
+    uint32_t period_us;
+    uint32_t nr_records;    // records kept in the ring buffer
+    uint32_t nr_vars;
+    struct swd_sampler_var vars[SWD_SAMPLER_MAX_VARS];
+};
+
+// head of the mmap()ed ring buffer, records start at rec_offset
+struct swd_sampler_ring {
+    uint32_t head;      // written by the driver
+    uint32_t tail;      // written by the reader
+    uint32_t rec_size;
+    uint32_t nr_records;
+    uint32_t rec_offset;
+    uint32_t dropped;   // records lost because the ring was full
+    uint32_t missed;    // periods missed because the bus was busy
+};
+
+// one record, rec_size bytes
+struct swd_sampler_record {
+    uint64_t timestamp_ns;
+    uint32_t seq;
+    uint32_t nr_vars;
+    uint32_t values[];
+};
+
+// core registers and fault status of a halted core
+struct swd_core_regs {
+    uint32_t r[16];     // r0-r12, sp, lr, pc
+    uint32_t xpsr;
+    uint32_t msp;
+    uint32_t psp;
+    uint32_t special;   // CONTROL[31:24] FAULTMASK[23:16] BASEPRI[15:8] PRIMASK[7:0]
+    uint32_t dhcsr;
+    uint32_t dfsr;
+    uint32_t cfsr;
+    uint32_t hfsr;
+};
+
+// DAP_Transfer/DAP_TransferBlock style batch of DP/AP accesses,
+// the request bits are the ones of CMSIS-DAP
+#define SWD_DAP_APNDP       (1 << 0)
+#define SWD_DAP_RNW         (1 << 1)
+#define SWD_DAP_A32         (3 << 2)    // A[3:2] of the register
+#define SWD_DAP_MATCH_VALUE (1 << 4)    // read until (value & mask) == data
+#define SWD_DAP_MATCH_MASK  (1 << 5)    // set the mask of value match to data, no access
+#define SWD_DAP_MAX_XFERS   4096        // entries, and words of rdata/wdata
+
+// ack of the last access, bits 2:0 are the SWD ack
+#define SWD_DAP_ACK_OK          1
+#define SWD_DAP_ACK_WAIT        2
+#define SWD_DAP_ACK_FAULT       4
+#define SWD_DAP_ACK_NOACK       7
+#define SWD_DAP_ACK_MISMATCH    (1 << 4)
+
+struct swd_dap_xfer {
+    uint8_t request;    // SWD_DAP_*
+    uint8_t reserved;
+    uint16_t count;     // accesses of a block, 0 is 1
+    uint32_t data;      // write value (count 1), match value or mask
+};
+
+struct swd_dap_transfer {
+    uint64_t xfers;     // struct swd_dap_xfer[nr_xfers]
+    uint64_t wdata;     // uint32_t[nr_wdata], values of the block writes
+    uint64_t rdata;     // uint32_t[nr_rdata], gets the values read
+    uint32_t nr_xfers;
+    uint32_t nr_wdata;
+    uint32_t nr_rdata;
+    uint32_t match_retry;   // reads of a value match, 0 is 100
+    uint32_t done;      // out: entries completed
+    uint32_t nr_read;   // out: values in rdata
+    uint32_t ack;       // out: SWD_DAP_ACK_* of the last access
+    uint32_t reserved;
+};
+
+// run a position independent thumb blob on the halted core,
+// it is called as uint32_t f(r0, r1, r2, r3) and returns by bx lr
+#define SWD_EXEC_MAX_CODE   4096
+
+struct swd_exec {
+    uint64_t code;      // the blob, loaded at the exec_sram_off param of the sram
+    uint32_t code_len;
+    uint32_t entry;     // offset of the function in the blob
+    uint32_t args[4];   // r0-r3
+    uint32_t timeout_ms;    // 0 is 1000
+    uint32_t ret;       // out: r0
+    uint32_t cycles;    // out: DWT_CYCCNT of the call
+    uint32_t cached;    // out: 1 if the blob was already loaded
+};
+
+// one swd transaction of the bus capture (debugfs swd/capture/data),
+// decoded from the bits clocked on the gpio
+#define SWD_CAP_PARITY_ERR  (1 << 0)    // read data with a bad parity bit
+#define SWD_CAP_DROPPED     (1 << 1)    // records were lost before this one
+#define SWD_CAP_NO_DATA     (1 << 2)    // no data phase (ack not OK)
+
+struct swd_cap_rec {
+    uint32_t delta_ns;  // header of the previous record to this one, saturated
+    uint32_t duration_ns;   // header to the last bit
+    uint8_t request;    // APnDP | RnW << 1 | A[3:2] << 2, as SWD_DAP_*
+    uint8_t ack;        // the 3 ack bits, 7 when the line floated
+    uint8_t retry;      // WAIT acks of the same request just before it
+    uint8_t flags;      // SWD_CAP_*
+    uint32_t data;
+};
+
 #define SWDDEV_IOC_MAGIC    '6'
 #define SWDDEV_IOC_RSTLN    _IO(SWDDEV_IOC_MAGIC, 0)            //  0. reset line
 #define SWDDEV_IOC_HLTCORE  _IO(SWDDEV_IOC_MAGIC, 1)            //  1. halt core
@@ -38,5 +153,12 @@ struct user_core_mem {
 #define SWDDEV_IOC_ERSFLSH      _IO(SWDDEV_IOC_MAGIC, 6)        //  6. erase flash
 #define SWDDEV_IOC_ERSFLSH_PG    _IOW(SWDDEV_IOC_MAGIC, 7, struct swd_parameters)  //  7. erase flash by page
 #define SWDDEV_IOC_MEMINFO_GET  _IOR(SWDDEV_IOC_MAGIC, 8, struct swd_parameters)  //  8. verify
+#define SWDDEV_IOC_SAMPLER_CFG  _IOW(SWDDEV_IOC_MAGIC, 9, struct swd_sampler_cfg)  //  9. configure sampler
+#define SWDDEV_IOC_SAMPLER_START    _IO(SWDDEV_IOC_MAGIC, 10)  // 10. start sampler
+#define SWDDEV_IOC_SAMPLER_STOP     _IO(SWDDEV_IOC_MAGIC, 11)  // 11. stop sampler
+#define SWDDEV_IOC_DWNLDFLSH_Z  _IOWR(SWDDEV_IOC_MAGIC, 12, struct swd_parameters)  // 12. compressed download to flash
+#define SWDDEV_IOC_REGS_GET     _IOR(SWDDEV_IOC_MAGIC, 13, struct swd_core_regs)  // 13. core register snapshot
+#define SWDDEV_IOC_DAP_XFER     _IOWR(SWDDEV_IOC_MAGIC, 14, struct swd_dap_transfer)  // 14. batch of DP/AP accesses
+#define SWDDEV_IOC_EXEC         _IOWR(SWDDEV_IOC_MAGIC, 15, struct swd_exec)  // 15. run a function on the core
 
 #endif
\ No newline at end of file
@@ -7,8 +7,15 @@
 
 #include "rproc_core.h"
 #include "swd_gpio/swd_gpio.h"
+#include "swd_bitstream.h"
+#include "swd_link.h"
 
 #define RETRY       600
+#define FLASH_PAGE_SIZE 1024
+#define FLASH_UNITS     64
+#define FLASH_SKIP_MIN  4       // erased words worth sending TAR again
+#define FLASH_PG_IDLE   255     // idle bits after each posted flash word
+#define FLASH_REPAIR_PASSES 3   // read back and write again the halfwords lost
 
 enum SWD_AHB_REGS {
     // debug register (AHB address)
@@ -59,6 +66,9 @@ enum SWD_AHB_REGS {
 
 #define FLASH_SR_BSY_OFF    0
 #define FLASH_SR_BSY_MSK    BIT(FLASH_SR_BSY_OFF)
+#define FLASH_SR_PGERR_OFF  2
+#define FLASH_SR_WRPRTERR_OFF   4
+#define FLASH_SR_ERR_MSK    (BIT(FLASH_SR_PGERR_OFF) | BIT(FLASH_SR_WRPRTERR_OFF))
 
 #define FLASH_CR_PG_OFF     0
 #define FLASH_CR_PER_OFF    1
@@ -109,100 +119,150 @@ struct cm_info stm32f103c8t6_ci = {
 
 static struct swd_gpio *stm32f10xx_sg;
 
-void stm32f10xx_reset(void)
+// fixed sequences, compiled once when the gpio is bound
+static struct swd_bs_op stm32f10xx_reset_ops[4];
+static struct swd_bs_op stm32f10xx_jtag_to_swd_ops[8];
+static struct swd_bs_op stm32f10xx_halt_ops[64];
+static struct swd_bs_op stm32f10xx_unhalt_ops[32];
+static struct swd_bs_op stm32f10xx_unlock_ops[24];
+static struct swd_bs stm32f10xx_reset_bs;
+static struct swd_bs stm32f10xx_jtag_to_swd_bs;
+static struct swd_bs stm32f10xx_halt_bs;
+static struct swd_bs stm32f10xx_unhalt_bs;
+static struct swd_bs stm32f10xx_unlock_bs;
+
+// memory and registers of the target, by bitstreams
+ssize_t stm32f10xx_read(void *to, u32 base, const u32 len);
+
+ssize_t stm32f10xx_write(void *from, u32 base, const u32 len);
+
+// erase unit holding offset, a page
+static int stm32f10xx_flash_unit(u32 offset, u32 *start, u32 *size)
 {
-    _swd_reset(stm32f10xx_sg);
+    int idx = offset / FLASH_PAGE_SIZE;
+
+    if (idx >= FLASH_UNITS)
+        return -1;
+
+    *start = idx * FLASH_PAGE_SIZE;
+    *size = FLASH_PAGE_SIZE;
+
+    return idx;
 }
 
-void stm32f10xx_setup_swd(void)
+// Bytes at the start of each erase unit which may hold data, the rest is
+// known erased. Anything which may write flash behind our back (the core
+// running, a routine on the core, a re-attach, raw DAP or /dev/swd writes)
+// makes all of it unknown again, see rproc_core.erased_forget.
+static u32 stm32f10xx_dirty[FLASH_UNITS];
+
+static void stm32f10xx_erased_forget(void)
 {
-    _swd_jtag_to_swd(stm32f10xx_sg);
+    int idx;
+    u32 start;
+    u32 size;
+    u32 offset = 0;
+
+    while ((idx = stm32f10xx_flash_unit(offset, &start, &size)) >= 0) {
+        stm32f10xx_dirty[idx] = size;
+        offset = start + size;
+    }
 }
 
-static int stm32f10xx_halt_core(void)
+static void stm32f10xx_erased_set(u32 offset, u32 len)
 {
-    u8 ack = 0;
-
-    // set the CTRL.core_reset_ap = 1
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
-
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG & 0xC, 0x8, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    int idx;
+    u32 start;
+    u32 size;
+
+    while (len && ((idx = stm32f10xx_flash_unit(offset, &start, &size)) >= 0)) {
+        stm32f10xx_dirty[idx] = 0;
+        len -= min(len, start + size - offset);
+        offset = start + size;
+    }
+}
 
-    // enable the auto increment
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+// [offset, offset + len) was programmed
+static void stm32f10xx_erased_clear(u32 offset, u32 len)
+{
+    int idx;
+    u32 start;
+    u32 size;
+    u32 end = offset + len;
+
+    while ((offset < end) && ((idx = stm32f10xx_flash_unit(offset, &start, &size)) >= 0)) {
+        stm32f10xx_dirty[idx] = max(stm32f10xx_dirty[idx], min(end, start + size) - start);
+        offset = start + size;
+    }
+}
 
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG, 0x23000012, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+static bool stm32f10xx_erased(u32 offset, u32 len)
+{
+    int idx;
+    u32 start;
+    u32 size;
 
-    // DHCSR.C_DEBUGEN = 1
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    idx = stm32f10xx_flash_unit(offset, &start, &size);
+    if ((idx < 0) || (offset + len > start + size))
+        return false;
 
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_DHCSR_REG, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    return offset - start >= stm32f10xx_dirty[idx];
+}
 
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+// Next run of words to program at or after pos, returns its first word and
+// its length in n. On erased flash the erased words are skipped, a run goes
+// on over fewer than FLASH_SKIP_MIN of them.
+static u32 stm32f10xx_next_run(const u32 *buf, u32 pos, u32 nr, bool erased, u32 *n)
+{
+    u32 i;
+    u32 gap = 0;
 
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0xA05F0003, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    if (!erased) {
+        *n = nr - pos;
+        return pos;
+    }
 
-      // DEMCR.VC_CORERESET = 1
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    while ((pos < nr) && (buf[pos] == 0xFFFFFFFF))
+        pos++;
 
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_DEMCR_REG, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    for (i = pos ; (i < nr) && (gap < FLASH_SKIP_MIN) ; i++)
+        gap = (buf[i] == 0xFFFFFFFF) ? gap + 1 : 0;
 
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    *n = i - pos - gap;
 
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0x1, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    return pos;
+}
 
-    // reset the core
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+void stm32f10xx_reset(void)
+{
+    swd_bs_run(stm32f10xx_sg, &stm32f10xx_reset_bs, NULL);
+}
 
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_AIRCR_REG, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+void stm32f10xx_setup_swd(void)
+{
+    swd_bs_run(stm32f10xx_sg, &stm32f10xx_jtag_to_swd_bs, NULL);
+}
 
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    if (ack != SWD_OK)
+static int stm32f10xx_halt_core(void)
+{
+    // core_reset_ap, auto increment, C_DEBUGEN, VC_CORERESET and core reset,
+    // see stm32f10xx_compile()
+    if (swd_bs_run(stm32f10xx_sg, &stm32f10xx_halt_bs, NULL))
         return -ENODEV;
 
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0x05FA0004, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    return 0;
+}
 
-    // CTRL1.core_reset_ap = 0
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_IDR_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+// 32-bit access with auto increment, the core keeps running
+static int stm32f10xx_setup_memap(void)
+{
+    u8 ack;
 
-    ack = _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_IDR_REG & 0xC, 0x0, true);
+    ack = swd_link_ack(_swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
-    // Select MEM BANK 0
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_MEMAP_BANK_0 & 0xF0, true);
+    ack = swd_link_ack(_swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG & 0xC, SWD_MEMAP_CSW, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
@@ -211,17 +271,10 @@ static int stm32f10xx_halt_core(void)
 
 static void stm32f10xx_unhalt_core(void)
 {
-    // DHCSR.C_DEBUGEN = 1
-    _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_DHCSR_REG, true);
-    _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0xA05F0000, true);
+    stm32f10xx_erased_forget();
 
-    // reset the core
-    _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_AIRCR_REG, true);
-    _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0x05FA0007, true);
+    // clear C_HALT and reset the core, see stm32f10xx_compile()
+    swd_bs_run(stm32f10xx_sg, &stm32f10xx_unhalt_bs, NULL);
 }
 
 u32 stm32f10xx_test_alive(void)
@@ -233,9 +286,79 @@ u32 stm32f10xx_test_alive(void)
     return data;
 }
 
+static void stm32f10xx_compile(void)
+{
+    struct swd_bs *bs;
+
+    bs = &stm32f10xx_reset_bs;
+    swd_bs_init(bs, stm32f10xx_reset_ops, ARRAY_SIZE(stm32f10xx_reset_ops));
+    swd_bs_line_reset(bs);
+
+    bs = &stm32f10xx_jtag_to_swd_bs;
+    swd_bs_init(bs, stm32f10xx_jtag_to_swd_ops, ARRAY_SIZE(stm32f10xx_jtag_to_swd_ops));
+    swd_bs_jtag_to_swd(bs);
+
+    bs = &stm32f10xx_halt_bs;
+    swd_bs_init(bs, stm32f10xx_halt_ops, ARRAY_SIZE(stm32f10xx_halt_ops));
+    // set the CTRL.core_reset_ap = 1
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_CSW_REG & 0xC, 0x8);
+    // enable the auto increment
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_CSW_REG, SWD_MEMAP_CSW);
+    // DHCSR.C_DEBUGEN = 1
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_DHCSR_REG);
+    swd_bs_write(bs, SWD_AP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0xA05F0003);
+    // DEMCR.VC_CORERESET = 1
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_DEMCR_REG);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0x1);
+    // reset the core
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_AIRCR_REG);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0x05FA0004);
+    // CTRL1.core_reset_ap = 0
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_IDR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_IDR_REG & 0xC, 0x0);
+    // Select MEM BANK 0
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_MEMAP_BANK_0 & 0xF0);
+    swd_bs_idle(bs);
+
+    bs = &stm32f10xx_unhalt_bs;
+    swd_bs_init(bs, stm32f10xx_unhalt_ops, ARRAY_SIZE(stm32f10xx_unhalt_ops));
+    // DHCSR.C_DEBUGEN = 1
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_DHCSR_REG);
+    swd_bs_write(bs, SWD_AP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0xA05F0000);
+    // reset the core
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_AIRCR_REG);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0x05FA0007);
+    swd_bs_idle(bs);
+
+    // FLASH_KEYR = MAGIC1, MAGIC2, RDBUFF read waits for the posted write
+    bs = &stm32f10xx_unlock_bs;
+    swd_bs_init(bs, stm32f10xx_unlock_ops, ARRAY_SIZE(stm32f10xx_unlock_ops));
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_MEMAP_BANK_0 & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, FLASH_KEYR);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, FLASH_UNLOCK_MAGIC1);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, FLASH_KEYR);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, FLASH_UNLOCK_MAGIC2);
+    swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+    swd_bs_idle(bs);
+}
+
 static void stm32f10xx_gpio_bind(struct swd_gpio *sg)
 {
     stm32f10xx_sg = sg;
+    stm32f10xx_compile();
+    stm32f10xx_erased_forget();
 }
 
 static int stm32f10xx_core_init(void)
@@ -244,9 +367,10 @@ static int stm32f10xx_core_init(void)
     u32 data;
     int retry = RETRY;
 
-    _swd_jtag_to_swd(stm32f10xx_sg);
+    swd_bs_run(stm32f10xx_sg, &stm32f10xx_jtag_to_swd_bs, NULL);
 
-    // Read IDCODE to wakeup the device
+    // Read IDCODE to wakeup the device, no answer here is no target
+    // rather than a bad link, it is not counted
     ack = _swd_read(stm32f10xx_sg, SWD_DP, SWD_READ, SWD_DP_IDCODE_REG, &data, true);
     if (ack != SWD_OK)
         return -ENODEV;
@@ -254,7 +378,7 @@ static int stm32f10xx_core_init(void)
     pr_info("%s: [%s] %d idcode:%08x\n", __FILE__, __func__, __LINE__, data);
 
     // Set CSYSPWRUPREQ and CDBGPWRUPREQ
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_CTRLSTAT_REG, SWD_CSYSPWRUPREQ_MSK | SWD_CDBGPWRUPREQ_MSK, true);
+    ack = swd_link_ack(_swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_CTRLSTAT_REG, SWD_CSYSPWRUPREQ_MSK | SWD_CDBGPWRUPREQ_MSK, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
@@ -262,7 +386,7 @@ static int stm32f10xx_core_init(void)
 
     // wait until the CSYSPWRUPREQ and CDBGPWRUPREQ are set
     do {
-        ack = _swd_read(stm32f10xx_sg, SWD_DP, SWD_READ, SWD_DP_CTRLSTAT_REG, &data, true);
+        ack = swd_link_ack(_swd_read(stm32f10xx_sg, SWD_DP, SWD_READ, SWD_DP_CTRLSTAT_REG, &data, true));
         if (ack != SWD_OK)
             return -ENODEV;
 
@@ -272,29 +396,29 @@ static int stm32f10xx_core_init(void)
     pr_info("%s: [%s] %d ctrlstat:%08x\n", __FILE__, __func__, __LINE__, data);
 
     // select the first AP bank
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, 0x0, true);
+    ack = swd_link_ack(_swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, 0x0, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
     // Select last AP bank
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_IDR_REG & 0xF0, true);
+    ack = swd_link_ack(_swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_IDR_REG & 0xF0, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
-    ack = _swd_read(stm32f10xx_sg, SWD_AP, SWD_READ, SWD_AP_IDR_REG & 0xC, &data, true);
+    ack = swd_link_ack(_swd_read(stm32f10xx_sg, SWD_AP, SWD_READ, SWD_AP_IDR_REG & 0xC, &data, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
     pr_info("%s: [%s] %d IDR:%08x\n", __FILE__, __func__, __LINE__, data);
 
-    ack = _swd_read(stm32f10xx_sg, SWD_DP, SWD_READ, SWD_DP_RDBUFF_REG, &data, true);
+    ack = swd_link_ack(_swd_read(stm32f10xx_sg, SWD_DP, SWD_READ, SWD_DP_RDBUFF_REG, &data, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
     pr_info("%s: [%s] %d IDR:%08x\n", __FILE__, __func__, __LINE__, data);
 
     // select the first AP bank
-    ack = _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, 0x0, true);
+    ack = swd_link_ack(_swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, 0x0, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
@@ -306,20 +430,18 @@ static int stm32f10xx_unlock_flash(void)
     u32 data;
     int retry = RETRY;
 
-    _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
     if (!(data & FLASH_CR_LOCK_MSK))
         return 0;
 
     pr_info("%s: [%s] %d unlocking flash cur_vla:%08x\n", __FILE__, __func__, __LINE__, data);
 
-    data = FLASH_UNLOCK_MAGIC1;
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_KEYR, sizeof(u32));
-    data = FLASH_UNLOCK_MAGIC2;
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_KEYR, sizeof(u32));
+    // both key writes in one stream
+    swd_bs_run(stm32f10xx_sg, &stm32f10xx_unlock_bs, &data);
 
     do {
         stm32f10xx_sg->_delay();
-        _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+        stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
 
         if (!(data & FLASH_CR_LOCK_MSK))
             return 0;
@@ -333,13 +455,14 @@ static void stm32f10xx_lock_flash(void)
 {
     u32 data = 0;
 
-    _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
     data |= FLASH_CR_LOCK_MSK;
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
 }
 
 static void stm32f10xx_erase_flash_all(void)
 {
+    u32 sr;
     u32 data;
     int retry;
 
@@ -348,27 +471,37 @@ static void stm32f10xx_erase_flash_all(void)
         return;
     }
 
+    // errors of earlier operations are cleared by writing 1
+    data = FLASH_SR_ERR_MSK;
+    stm32f10xx_write(&data, FLASH_SR, sizeof(u32));
+
     // set MER = 1
-    _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
     data |= FLASH_CR_MER_MSK;
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
 
     // Set STRT = 1
-    _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
     data |= FLASH_CR_STRT_MSK;
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
 
     retry = RETRY;
     do {
         stm32f10xx_sg->_delay();
-        _swd_ap_read(stm32f10xx_sg, &data, FLASH_SR, sizeof(u32));
+        stm32f10xx_read(&sr, FLASH_SR, sizeof(u32));
     }
-    while((retry--) && (data & FLASH_SR_BSY_MSK));
+    while((retry--) && (sr & FLASH_SR_BSY_MSK));
 
     // Clear MER
-    _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
     data &= (~FLASH_CR_MER_MSK);
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
+
+    // known erased only when the erase is seen finished without errors
+    if (sr & (FLASH_SR_BSY_MSK | FLASH_SR_ERR_MSK))
+        pr_err("%s [%s] mass erase failed sr:%08x\n", __FILE__, __func__, sr);
+    else
+        stm32f10xx_erased_set(0, U32_MAX);
 
     stm32f10xx_lock_flash();
 }
@@ -387,10 +520,14 @@ static void stm32f10xx_erase_flash_page(struct core_mem *cm, u32 offset, u32 len
         return;
     }
 
+    // errors of earlier operations are cleared by writing 1
+    data = FLASH_SR_ERR_MSK;
+    stm32f10xx_write(&data, FLASH_SR, sizeof(u32));
+
     // 1. write FLASH_CR_PER to 1
-    _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
     data |= FLASH_CR_PER_MSK;
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
 
     // 2. write address to FAR
     if (len % cm->flash.program_size)
@@ -398,41 +535,183 @@ static void stm32f10xx_erase_flash_page(struct core_mem *cm, u32 offset, u32 len
     else
         page_len = len / cm->flash.program_size;
     for (i = 0 ; i < page_len ; i++) {
-        _swd_ap_write(stm32f10xx_sg, &base, FLASH_AR, sizeof(u32));
+        stm32f10xx_write(&base, FLASH_AR, sizeof(u32));
 
         // 3, write FLASH_CR_STRT to 1
-        _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+        stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
         data |= FLASH_CR_STRT_MSK;
-        _swd_ap_write(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+        stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
 
         // 4. wait until FLASH_SR_BSY to 0
         retry = RETRY;
         do {
             stm32f10xx_sg->_delay();
-            _swd_ap_read(stm32f10xx_sg, &data, FLASH_SR, sizeof(u32));
+            stm32f10xx_read(&data, FLASH_SR, sizeof(u32));
         }while((retry--) && (data & FLASH_SR_BSY_MSK));
 
+        // the page is known erased only when it finished without errors,
+        // errors stay set and keep the pages after it unknown too
+        if (data & (FLASH_SR_BSY_MSK | FLASH_SR_ERR_MSK))
+            pr_err("%s [%s] page erase at %08x failed sr:%08x\n", __FILE__, __func__, base, data);
+        else
+            stm32f10xx_erased_set(base - cm->flash.base, 1);
+
         base += cm->flash.program_size;
     }
 
     // Restore the original value of FLASH_CR
-    _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
     data &= (~FLASH_CR_PER_MSK);
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
 
     stm32f10xx_lock_flash();
 }
 
-static ssize_t stm32f10xx_program_flash(struct core_mem *cm, void *from, u32 offset, u32 len)
+// Flash programming by halfword stores of the core itself (i.e. a routine
+// running from sram), on: unlocked with PG set, off: PG cleared and locked.
+static int stm32f10xx_flash_program_mode(bool on)
 {
-    int i;
     int retry;
+    u32 data;
+
+    if (on) {
+        if(stm32f10xx_unlock_flash()) {
+            pr_err("[%s] Unable to unlock flash\n",  __func__);
+            return -1;
+        }
+
+        // the routine may write anywhere
+        stm32f10xx_erased_forget();
+
+        // errors of earlier operations are cleared by writing 1
+        data = FLASH_SR_ERR_MSK;
+        stm32f10xx_write(&data, FLASH_SR, sizeof(u32));
+
+        stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
+        data |= FLASH_CR_PG_MSK;
+        stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
+
+        return 0;
+    }
+
+    retry = RETRY;
+    do{
+        stm32f10xx_sg->_delay();
+        stm32f10xx_read(&data, FLASH_SR, sizeof(u32));
+    }while(retry-- && (data & FLASH_SR_BSY_MSK));
+
+    if (data & FLASH_SR_ERR_MSK)
+        pr_err("[%s] flash errors sr:%08x\n",  __func__, data);
+    retry = (data & (FLASH_SR_BSY_MSK | FLASH_SR_ERR_MSK)) ? -1 : 0;
+
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
+    data &= ~FLASH_CR_PG_MSK;
+    stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
+
+    stm32f10xx_lock_flash();
+
+    return retry;
+}
+
+// Compare len bytes at base with from, returns the bytes differing.
+static int stm32f10xx_verify(const u8 *from, u32 base, u32 len)
+{
+    int i;
+    int err = 0;
+    ssize_t read_len;
+    u8 data[64];
+
+    while (len) {
+        read_len = stm32f10xx_read(data, base, min_t(u32, len, sizeof(data)));
+        if (read_len <= 0)
+            return err + len;
+
+        for (i = 0 ; i < read_len ; i++) {
+            if (data[i] != from[i])
+                err++;
+        }
+
+        from += read_len;
+        base += read_len;
+        len -= read_len;
+    }
+
+    if (err)
+        swd_link_error(SWD_LINK_VERIFY);
+
+    return err;
+}
+
+// wait for the flash to finish, returns FLASH_SR
+static u32 stm32f10xx_flash_wait(void)
+{
+    int retry = RETRY;
+    u32 data;
+
+    do{
+        stm32f10xx_sg->_delay();
+        stm32f10xx_read(&data, FLASH_SR, sizeof(u32));
+    }while(retry-- && (data & FLASH_SR_BSY_MSK));
+
+    return data;
+}
+
+// Read back the words of the run at base and write again the halfwords
+// which did not land, they still read erased. A programmed halfword
+// holding other data is a flash failure, only an erase can fix it.
+// Returns the halfwords written again, or -EIO. PG must be set.
+static int stm32f10xx_repair(const u32 *buf, u32 base, u32 n, u32 csw)
+{
+    int i, j;
+    int fixed = 0;
+    u32 nr;
+    u16 want;
+    u16 got;
+    u32 data[16];
+
+    for (; n ; n -= nr, buf += nr, base += nr * sizeof(u32)) {
+        nr = min_t(u32, n, ARRAY_SIZE(data));
+        if (stm32f10xx_read(data, base, nr * sizeof(u32)) != nr * sizeof(u32))
+            return -EIO;
+
+        for (i = 0 ; i < nr ; i++) {
+            for (j = 0 ; j < 2 ; j++) {
+                want = buf[i] >> (j * 16);
+                got = data[i] >> (j * 16);
+                if (want == got)
+                    continue;
+
+                if (got != 0xFFFF) {
+                    pr_err("%s [%s] %08x reads %04x, not %04x\n", __FILE__, __func__,
+                           base + i * sizeof(u32) + j * 2, got, want);
+                    return -EIO;
+                }
+
+                // the whole word goes out, the halfword lanes are taken
+                if (swd_bs_write_block(stm32f10xx_sg, base + i * sizeof(u32) + j * 2,
+                                       &buf[i], sizeof(u16), csw, FLASH_PG_IDLE))
+                    return -EIO;
+                fixed++;
+            }
+        }
+    }
+
+    return fixed;
+}
+
+static ssize_t stm32f10xx_program_flash(struct core_mem *cm, void *from, u32 offset, u32 len)
+{
+    int pass;
     int err;
+    int fixed;
     u32 data;
-    u32 cur_base;
+    u32 csw;
     u32 old_csw;
+    u32 pos;
+    u32 n;
+    u32 nr = len / sizeof(u32);
     u32 *buf = (u32*)from;
-    u32 len_to_read = len / sizeof(u32);
+    bool erased = stm32f10xx_erased(offset, len);
 
     // Unlock flash
     if(stm32f10xx_unlock_flash()) {
@@ -440,93 +719,138 @@ static ssize_t stm32f10xx_program_flash(struct core_mem *cm, void *from, u32 off
         return -1;
     }
 
+    // errors of earlier operations are cleared by writing 1
+    data = FLASH_SR_ERR_MSK;
+    stm32f10xx_write(&data, FLASH_SR, sizeof(u32));
+
     // Set the programming bit
-    _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
     data |= FLASH_CR_PG_MSK;
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
-
-    _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true);
-    _swd_read(stm32f10xx_sg, SWD_AP, SWD_READ, SWD_AP_CSW_REG & 0xC, &old_csw, true);
-    _swd_read(stm32f10xx_sg, SWD_DP, SWD_READ, SWD_DP_RDBUFF_REG, &old_csw, true);
+    stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
+
+    swd_link_ack(_swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true));
+    swd_link_ack(_swd_read(stm32f10xx_sg, SWD_AP, SWD_READ, SWD_AP_CSW_REG & 0xC, &old_csw, true));
+    swd_link_ack(_swd_read(stm32f10xx_sg, SWD_DP, SWD_READ, SWD_DP_RDBUFF_REG, &old_csw, true));
+
+    csw = old_csw & (~0x37); // clear addrinc and size filed
+    csw |= 0x21; // set the  addrinc to be 0b10, and size to be 0b0001
+
+    // write data to flash with the new AP_CSW, the idle bits cover the
+    // halfword programming time so the posted writes rarely overrun
+    // words still erased are not sent, TAR is set again after them.
+    // a stream which fails is resumed at TAR by swd_bs_write_block()
+    for (pos = 0 ; (pos = stm32f10xx_next_run(buf, pos, nr, erased, &n)) < nr ; pos += n) {
+        if (swd_bs_write_block(stm32f10xx_sg, cm->flash.base + offset + pos * sizeof(u32),
+                               buf + pos, n * sizeof(u32), csw, FLASH_PG_IDLE))
+            pr_err("%s [%s] block write failed\n", __FILE__, __func__);
+    }
+    stm32f10xx_erased_clear(offset, len);
 
-    data = old_csw & (~0x37); // clear addrinc and size filed
-    data |= 0x21; // set the  addrinc to be 0b10, and size to be 0b0001
+    // restore the value in AP_CSW
+    swd_link_ack(_swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true));
+    swd_link_ack(_swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG & 0xC, old_csw, true));
 
-    // set new AP_CSW
-    _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true);
-    _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG & 0xC, data, true);
+    data = stm32f10xx_flash_wait();
 
-    // write data to flash
-    _swd_ap_write(stm32f10xx_sg, buf, cm->flash.base + offset, len);
+    // verify what was written, halfwords lost on the way are written
+    // again one by one (size halfword, no increment). All of the buffer,
+    // the words skipped as erased must read erased too.
+    csw = (csw & ~0x37) | 0x01;
+    err = (data & FLASH_SR_ERR_MSK) ? -EIO : 0;
+    for (pass = 0 ; !err && (pass < FLASH_REPAIR_PASSES) ; pass++) {
+        fixed = stm32f10xx_repair(buf, cm->flash.base + offset, nr, csw);
+        if (fixed < 0)
+            err = fixed;
 
-    // restore the value in AP_CSW
-    _swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true);
-    _swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG & 0xC, old_csw, true);
+        swd_link_ack(_swd_send(stm32f10xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true));
+        swd_link_ack(_swd_send(stm32f10xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG & 0xC, old_csw, true));
 
-    retry = RETRY;
-    do{
-        stm32f10xx_sg->_delay();
-        _swd_ap_read(stm32f10xx_sg, &data, FLASH_SR, sizeof(u32));
-    }while(retry-- && (data & FLASH_SR_BSY_MSK));
-
-    _swd_ap_read(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
-    data &= (~FLASH_CR_PG_MSK);
-    _swd_ap_write(stm32f10xx_sg, &data, FLASH_CR, sizeof(u32));
+        if (err || !fixed)
+            break;
 
-    // verify
-    err = 0;
-    cur_base = cm->flash.base + offset;
-    for (i = 0 ; i < len_to_read ; i++) {
-        _swd_ap_read(stm32f10xx_sg, &data, cur_base, sizeof(u32));
-        if (data != buf[i])
-            err += 4;
+        pr_info("%s: [%s] pass:%d %d halfwords written again\n", __FILE__, __func__, pass, fixed);
+        swd_link_error(SWD_LINK_VERIFY);
 
-        cur_base += sizeof(u32);
+        data = stm32f10xx_flash_wait();
+        if (data & FLASH_SR_ERR_MSK)
+            err = -EIO;
     }
+    if (!err && (pass == FLASH_REPAIR_PASSES))
+        err = -EIO;
 
-    pr_info("%s: [%s] errors:%d\n", __FILE__, __func__, err);
+    if (data & FLASH_SR_ERR_MSK)
+        pr_err("%s [%s] flash errors sr:%08x\n", __FILE__, __func__, data);
 
-    if (err) {
-        stm32f10xx_erase_flash_page(cm, offset, len);
-        stm32f10xx_lock_flash();
-        return err;
-    }
+    stm32f10xx_read(&data, FLASH_CR, sizeof(u32));
+    data &= (~FLASH_CR_PG_MSK);
+    stm32f10xx_write(&data, FLASH_CR, sizeof(u32));
 
     stm32f10xx_lock_flash();
 
-    return 0;
+    // a real flash failure, the caller erases and programs again
+    return err;
 }
 
 static ssize_t stm32f10xx_write_ram(struct core_mem *cm, void* from, u32 offset, u32 len)
 {
-    int i;
-    int err;
-    u32 data;
-    u32 cur_base;
-    u32 *buf = (u32*)from;
-    u32 len_to_read = len / sizeof(u32);
+    int ret;
+    u32 n;
+    u32 pos;
+    u8 *buf = (u8*)from;
+    u32 base = cm->sram.base + offset;
+
+    // write data to ram, byte/halfword edges and posted word writes between
+    for (pos = 0 ; pos < len ; pos += n) {
+        n = swd_bs_sub_len(base + pos, len - pos);
+        if (n) {
+            ret = swd_bs_access_sub(stm32f10xx_sg, buf + pos, base + pos, n, SWD_MEMAP_CSW, true);
+        } else {
+            n = (len - pos) & ~0x3;
+            ret = swd_bs_write_block(stm32f10xx_sg, base + pos, buf + pos, n, SWD_MEMAP_CSW, 0);
+        }
+        if (ret)
+            return -ENODEV;
+    }
 
-    // write data to ram
-    if (_swd_ap_write(stm32f10xx_sg, buf, cm->sram.base + offset, len) < 0)
-        return -ENODEV;
+    return stm32f10xx_verify(buf, base, len);
+}
 
-    // verify
-    err = 0;
-    cur_base = cm->sram.base + offset;
-    for (i = 0 ; i < len_to_read ; i++) {
-        _swd_ap_read(stm32f10xx_sg, &data, cur_base, sizeof(u32));
-        if (data != buf[i])
-            err += 4;
+// The unaligned head and the short tail take byte/halfword accesses of
+// their own call, the aligned words a burst.
+ssize_t stm32f10xx_read(void *to, u32 base, const u32 len)
+{
+    u32 len_to_read = swd_bs_sub_len(base, len);
 
-        cur_base += sizeof(u32);
+    if (len_to_read) {
+        if (swd_bs_access_sub(stm32f10xx_sg, to, base, len_to_read, SWD_MEMAP_CSW, false))
+            return -ENODEV;
+        return len_to_read;
     }
 
-    return err;
+    len_to_read = len > SWD_BANK_SIZE ? SWD_BANK_SIZE : (len & ~0x3);
+
+    if (swd_bs_read_block(stm32f10xx_sg, to, base, len_to_read, SWD_MEMAP_CSW))
+        return -ENODEV;
+
+    return len_to_read;
 }
 
-ssize_t stm32f10xx_read(void *to, u32 base, const u32 len)
+ssize_t stm32f10xx_write(void *from, u32 base, const u32 len)
 {
-   return _swd_ap_read(stm32f10xx_sg, to, base, len > SWD_BANK_SIZE ? SWD_BANK_SIZE : len);
+    u32 len_to_write = swd_bs_sub_len(base, len);
+
+    if (len_to_write) {
+        if (swd_bs_access_sub(stm32f10xx_sg, from, base, len_to_write, SWD_MEMAP_CSW, true))
+            return -ENODEV;
+        return len_to_write;
+    }
+
+    len_to_write = len > SWD_BANK_SIZE ? SWD_BANK_SIZE : (len & ~0x3);
+
+    if (swd_bs_write_block(stm32f10xx_sg, base, from, len_to_write, SWD_MEMAP_CSW, 0))
+        return -ENODEV;
+
+    return len_to_write;
 }
 
 struct rproc_core stm32f103c8t6_rc = {
@@ -538,10 +862,14 @@ struct rproc_core stm32f103c8t6_rc = {
     .core_reset = stm32f10xx_reset,
     .core_unhalt = stm32f10xx_unhalt_core,
     .core_halt = stm32f10xx_halt_core,
+    .setup_memap = stm32f10xx_setup_memap,
     .test_alive = stm32f10xx_test_alive,
     .erase_flash_all = stm32f10xx_erase_flash_all,
     .erase_flash_page = stm32f10xx_erase_flash_page,
     .program_flash = stm32f10xx_program_flash,
+    .flash_program_mode = stm32f10xx_flash_program_mode,
+    .erased_forget = stm32f10xx_erased_forget,
     .write_ram = stm32f10xx_write_ram,
-    .read_ram = stm32f10xx_read
+    .read_ram = stm32f10xx_read,
+    .write_mem = stm32f10xx_write
 };
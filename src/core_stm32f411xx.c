@@ -7,8 +7,14 @@
 
 #include "rproc_core.h"
 #include "swd_gpio/swd_gpio.h"
+#include "swd_bitstream.h"
+#include "swd_link.h"
 
 #define RETRY       60000
+#define FLASH_UNITS     8
+#define FLASH_SKIP_MIN  4       // erased words worth sending TAR again
+#define FLASH_PG_IDLE   32      // idle bits after each posted flash word
+#define FLASH_REPAIR_PASSES 3   // read back and write again the words lost
 
 enum SWD_AHB_REGS {
     // debug register (AHB address)
@@ -58,6 +64,7 @@ enum SWD_AHB_REGS {
 
 #define FLASH_SR_BSY_OFF    16
 #define FLASH_SR_BSY_MSK    BIT(FLASH_SR_BSY_OFF)
+#define FLASH_SR_ERR_MSK    0xF2    // PGSERR | PGPERR | PGAERR | WRPERR | OPERR
 
 #define FLASH_CR_PG_OFF     0
 #define FLASH_CR_SER_OFF    1
@@ -117,100 +124,152 @@ struct cm_info stm32f411ceu6_ci = {
 
 static struct swd_gpio *stm32f411xx_sg;
 
-void stm32f411xx_reset(void)
+// fixed sequences, compiled once when the gpio is bound
+static struct swd_bs_op stm32f411xx_reset_ops[4];
+static struct swd_bs_op stm32f411xx_jtag_to_swd_ops[8];
+static struct swd_bs_op stm32f411xx_halt_ops[64];
+static struct swd_bs_op stm32f411xx_unhalt_ops[32];
+static struct swd_bs_op stm32f411xx_unlock_ops[24];
+static struct swd_bs stm32f411xx_reset_bs;
+static struct swd_bs stm32f411xx_jtag_to_swd_bs;
+static struct swd_bs stm32f411xx_halt_bs;
+static struct swd_bs stm32f411xx_unhalt_bs;
+static struct swd_bs stm32f411xx_unlock_bs;
+
+// memory and registers of the target, by bitstreams
+ssize_t stm32f411xx_read(void *to, u32 base, const u32 len);
+
+ssize_t stm32f411xx_write(void *from, u32 base, const u32 len);
+
+// erase unit holding offset, a sector
+static int stm32f411xx_flash_unit(u32 offset, u32 *start, u32 *size)
 {
-    _swd_reset(stm32f411xx_sg);
+    int idx;
+    struct core_mem *cm = &stm32f411ceu6_cm;
+
+    for (idx = 0 ; idx < FLASH_UNITS ; idx++) {
+        *start = cm->mem_segs[cm->flash.offset + idx].start;
+        *size = cm->mem_segs[cm->flash.offset + idx].size;
+        if ((*start <= offset) && (offset < *start + *size))
+            return idx;
+    }
+
+    return -1;
 }
 
-void stm32f411xx_setup_swd(void)
+// Bytes at the start of each erase unit which may hold data, the rest is
+// known erased. Anything which may write flash behind our back (the core
+// running, a routine on the core, a re-attach, raw DAP or /dev/swd writes)
+// makes all of it unknown again, see rproc_core.erased_forget.
+static u32 stm32f411xx_dirty[FLASH_UNITS];
+
+static void stm32f411xx_erased_forget(void)
 {
-    _swd_jtag_to_swd(stm32f411xx_sg);
+    int idx;
+    u32 start;
+    u32 size;
+    u32 offset = 0;
+
+    while ((idx = stm32f411xx_flash_unit(offset, &start, &size)) >= 0) {
+        stm32f411xx_dirty[idx] = size;
+        offset = start + size;
+    }
 }
 
-static int stm32f411xx_halt_core(void)
+static void stm32f411xx_erased_set(u32 offset, u32 len)
 {
-    u8 ack = 0;
-
-    // set the CTRL.core_reset_ap = 1
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
-
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG & 0xC, 0x8, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    int idx;
+    u32 start;
+    u32 size;
+
+    while (len && ((idx = stm32f411xx_flash_unit(offset, &start, &size)) >= 0)) {
+        stm32f411xx_dirty[idx] = 0;
+        len -= min(len, start + size - offset);
+        offset = start + size;
+    }
+}
 
-    // enable the auto increment
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+// [offset, offset + len) was programmed
+static void stm32f411xx_erased_clear(u32 offset, u32 len)
+{
+    int idx;
+    u32 start;
+    u32 size;
+    u32 end = offset + len;
+
+    while ((offset < end) && ((idx = stm32f411xx_flash_unit(offset, &start, &size)) >= 0)) {
+        stm32f411xx_dirty[idx] = max(stm32f411xx_dirty[idx], min(end, start + size) - start);
+        offset = start + size;
+    }
+}
 
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG, 0x23000012, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+static bool stm32f411xx_erased(u32 offset, u32 len)
+{
+    int idx;
+    u32 start;
+    u32 size;
 
-    // DHCSR.C_DEBUGEN = 1
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    idx = stm32f411xx_flash_unit(offset, &start, &size);
+    if ((idx < 0) || (offset + len > start + size))
+        return false;
 
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_DHCSR_REG, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    return offset - start >= stm32f411xx_dirty[idx];
+}
 
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+// Next run of words to program at or after pos, returns its first word and
+// its length in n. On erased flash the erased words are skipped, a run goes
+// on over fewer than FLASH_SKIP_MIN of them.
+static u32 stm32f411xx_next_run(const u32 *buf, u32 pos, u32 nr, bool erased, u32 *n)
+{
+    u32 i;
+    u32 gap = 0;
 
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0xA05F0003, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    if (!erased) {
+        *n = nr - pos;
+        return pos;
+    }
 
-      // DEMCR.VC_CORERESET = 1
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    while ((pos < nr) && (buf[pos] == 0xFFFFFFFF))
+        pos++;
 
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_DEMCR_REG, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    for (i = pos ; (i < nr) && (gap < FLASH_SKIP_MIN) ; i++)
+        gap = (buf[i] == 0xFFFFFFFF) ? gap + 1 : 0;
 
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    *n = i - pos - gap;
 
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0x1, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    return pos;
+}
 
-    // reset the core
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+void stm32f411xx_reset(void)
+{
+    swd_bs_run(stm32f411xx_sg, &stm32f411xx_reset_bs, NULL);
+}
 
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_AIRCR_REG, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+void stm32f411xx_setup_swd(void)
+{
+    swd_bs_run(stm32f411xx_sg, &stm32f411xx_jtag_to_swd_bs, NULL);
+}
 
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    if (ack != SWD_OK)
+static int stm32f411xx_halt_core(void)
+{
+    // core_reset_ap, auto increment, C_DEBUGEN, VC_CORERESET and core reset,
+    // see stm32f411xx_compile()
+    if (swd_bs_run(stm32f411xx_sg, &stm32f411xx_halt_bs, NULL))
         return -ENODEV;
 
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0x05FA0004, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+    return 0;
+}
 
-    // CTRL1.core_reset_ap = 0
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_IDR_REG & 0xF0, true);
-    if (ack != SWD_OK)
-        return -ENODEV;
+// 32-bit access with auto increment, the core keeps running
+static int stm32f411xx_setup_memap(void)
+{
+    u8 ack;
 
-    ack = _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_IDR_REG & 0xC, 0x0, true);
+    ack = swd_link_ack(_swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
-    // Select MEM BANK 0
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_MEMAP_BANK_0 & 0xF0, true);
+    ack = swd_link_ack(_swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG & 0xC, SWD_MEMAP_CSW, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
@@ -219,17 +278,10 @@ static int stm32f411xx_halt_core(void)
 
 static void stm32f411xx_unhalt_core(void)
 {
-    // DHCSR.C_DEBUGEN = 1
-    _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_DHCSR_REG, true);
-    _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0xA05F0000, true);
+    stm32f411xx_erased_forget();
 
-    // reset the core
-    _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0, true);
-    _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_TAR_REG & 0xC, SWD_AIRCR_REG, true);
-    _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0, true);
-    _swd_send(stm32f411xx_sg, SWD_AP, SWD_WRITE, SWD_AP_DRW_REG & 0xC, 0x05FA0007, true);
+    // clear C_HALT and reset the core, see stm32f411xx_compile()
+    swd_bs_run(stm32f411xx_sg, &stm32f411xx_unhalt_bs, NULL);
 }
 
 u32 stm32f411xx_test_alive(void)
@@ -241,9 +293,79 @@ u32 stm32f411xx_test_alive(void)
     return data;
 }
 
+static void stm32f411xx_compile(void)
+{
+    struct swd_bs *bs;
+
+    bs = &stm32f411xx_reset_bs;
+    swd_bs_init(bs, stm32f411xx_reset_ops, ARRAY_SIZE(stm32f411xx_reset_ops));
+    swd_bs_line_reset(bs);
+
+    bs = &stm32f411xx_jtag_to_swd_bs;
+    swd_bs_init(bs, stm32f411xx_jtag_to_swd_ops, ARRAY_SIZE(stm32f411xx_jtag_to_swd_ops));
+    swd_bs_jtag_to_swd(bs);
+
+    bs = &stm32f411xx_halt_bs;
+    swd_bs_init(bs, stm32f411xx_halt_ops, ARRAY_SIZE(stm32f411xx_halt_ops));
+    // set the CTRL.core_reset_ap = 1
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_CSW_REG & 0xC, 0x8);
+    // enable the auto increment
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_CSW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_CSW_REG, SWD_MEMAP_CSW);
+    // DHCSR.C_DEBUGEN = 1
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_DHCSR_REG);
+    swd_bs_write(bs, SWD_AP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0xA05F0003);
+    // DEMCR.VC_CORERESET = 1
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_DEMCR_REG);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0x1);
+    // reset the core
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_AIRCR_REG);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0x05FA0004);
+    // CTRL1.core_reset_ap = 0
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_IDR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_IDR_REG & 0xC, 0x0);
+    // Select MEM BANK 0
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_MEMAP_BANK_0 & 0xF0);
+    swd_bs_idle(bs);
+
+    bs = &stm32f411xx_unhalt_bs;
+    swd_bs_init(bs, stm32f411xx_unhalt_ops, ARRAY_SIZE(stm32f411xx_unhalt_ops));
+    // DHCSR.C_DEBUGEN = 1
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_DHCSR_REG);
+    swd_bs_write(bs, SWD_AP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0xA05F0000);
+    // reset the core
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_TAR_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, SWD_AIRCR_REG);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_AP_DRW_REG & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, 0x05FA0007);
+    swd_bs_idle(bs);
+
+    // FLASH_KEYR = MAGIC1, MAGIC2, RDBUFF read waits for the posted write
+    bs = &stm32f411xx_unlock_bs;
+    swd_bs_init(bs, stm32f411xx_unlock_ops, ARRAY_SIZE(stm32f411xx_unlock_ops));
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, SWD_MEMAP_BANK_0 & 0xF0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, FLASH_KEYR);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, FLASH_UNLOCK_MAGIC1);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, FLASH_KEYR);
+    swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, FLASH_UNLOCK_MAGIC2);
+    swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+    swd_bs_idle(bs);
+}
+
 static void stm32f411xx_gpio_bind(struct swd_gpio *sg)
 {
     stm32f411xx_sg = sg;
+    stm32f411xx_compile();
+    stm32f411xx_erased_forget();
 }
 
 static int stm32f411xx_core_init(void)
@@ -252,9 +374,10 @@ static int stm32f411xx_core_init(void)
     u32 data;
     int retry = RETRY;
 
-    _swd_jtag_to_swd(stm32f411xx_sg);
+    swd_bs_run(stm32f411xx_sg, &stm32f411xx_jtag_to_swd_bs, NULL);
 
-    // Read IDCODE to wakeup the device
+    // Read IDCODE to wakeup the device, no answer here is no target
+    // rather than a bad link, it is not counted
     ack = _swd_read(stm32f411xx_sg, SWD_DP, SWD_READ, SWD_DP_IDCODE_REG, &data, true);
     if (ack != SWD_OK)
         return -ENODEV;
@@ -262,7 +385,7 @@ static int stm32f411xx_core_init(void)
     pr_info("[%s] %d idcode:%08x\n",  __func__, __LINE__, data);
 
     // Set CSYSPWRUPREQ and CDBGPWRUPREQ
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_CTRLSTAT_REG, SWD_CSYSPWRUPREQ_MSK | SWD_CDBGPWRUPREQ_MSK, true);
+    ack = swd_link_ack(_swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_CTRLSTAT_REG, SWD_CSYSPWRUPREQ_MSK | SWD_CDBGPWRUPREQ_MSK, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
@@ -270,7 +393,7 @@ static int stm32f411xx_core_init(void)
 
     // wait until the CSYSPWRUPREQ and CDBGPWRUPREQ are set
     do {
-        ack = _swd_read(stm32f411xx_sg, SWD_DP, SWD_READ, SWD_DP_CTRLSTAT_REG, &data, true);
+        ack = swd_link_ack(_swd_read(stm32f411xx_sg, SWD_DP, SWD_READ, SWD_DP_CTRLSTAT_REG, &data, true));
         if (ack != SWD_OK)
             return -ENODEV;
 
@@ -280,29 +403,29 @@ static int stm32f411xx_core_init(void)
     pr_info("[%s] %d ctrlstat:%08x\n",  __func__, __LINE__, data);
 
     // select the first AP bank
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, 0x0, true);
+    ack = swd_link_ack(_swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, 0x0, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
     // Select last AP bank
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_IDR_REG & 0xF0, true);
+    ack = swd_link_ack(_swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, SWD_AP_IDR_REG & 0xF0, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
-    ack = _swd_read(stm32f411xx_sg, SWD_AP, SWD_READ, SWD_AP_IDR_REG & 0xC, &data, true);
+    ack = swd_link_ack(_swd_read(stm32f411xx_sg, SWD_AP, SWD_READ, SWD_AP_IDR_REG & 0xC, &data, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
     pr_info("[%s] %d IDR:%08x\n",  __func__, __LINE__, data);
 
-    ack = _swd_read(stm32f411xx_sg, SWD_DP, SWD_READ, SWD_DP_RDBUFF_REG, &data, true);
+    ack = swd_link_ack(_swd_read(stm32f411xx_sg, SWD_DP, SWD_READ, SWD_DP_RDBUFF_REG, &data, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
     pr_info("[%s] %d IDR:%08x\n",  __func__, __LINE__, data);
 
     // select the first AP bank
-    ack = _swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, 0x0, true);
+    ack = swd_link_ack(_swd_send(stm32f411xx_sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, 0x0, true));
     if (ack != SWD_OK)
         return -ENODEV;
 
@@ -314,20 +437,18 @@ static int stm32f411xx_unlock_flash(void)
     u32 data;
     int retry = RETRY;
 
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
     if (!(data & FLASH_CR_LOCK_MSK))
         return 0;
 
     pr_info("[%s] %d unlocking flash cur_val:%08x\n",  __func__, __LINE__, data);
 
-    data = FLASH_UNLOCK_MAGIC1;
-    _swd_ap_write(stm32f411xx_sg, &data, FLASH_KEYR, sizeof(u32));
-    data = FLASH_UNLOCK_MAGIC2;
-    _swd_ap_write(stm32f411xx_sg, &data, FLASH_KEYR, sizeof(u32));
+    // both key writes in one stream
+    swd_bs_run(stm32f411xx_sg, &stm32f411xx_unlock_bs, &data);
 
     do {
         stm32f411xx_sg->_delay();
-        _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+        stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
 
         if (!(data & FLASH_CR_LOCK_MSK))
             return 0;
@@ -341,13 +462,14 @@ static void stm32f411xx_lock_flash(void)
 {
     u32 data = 0;
 
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
     data |= FLASH_CR_LOCK_MSK;
-    _swd_ap_write(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
 }
 
 static void stm32f411xx_erase_flash_all(void)
 {
+    u32 sr;
     u32 data;
     int retry;
 
@@ -357,33 +479,43 @@ static void stm32f411xx_erase_flash_all(void)
     }
 
     // Check if Flash is busy.
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_SR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_SR, sizeof(u32));
     if (data & FLASH_SR_BSY_MSK) {
         pr_err("[%s] Flash busy\n",  __func__);
         return;
     }
 
+    // errors of earlier operations are cleared by writing 1
+    data = FLASH_SR_ERR_MSK;
+    stm32f411xx_write(&data, FLASH_SR, sizeof(u32));
+
     // set MER = 1
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
     data |= FLASH_CR_MER_MSK;
-    _swd_ap_write(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
 
     // Set STRT = 1
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
     data |= FLASH_CR_STRT_MSK;
-    _swd_ap_write(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
 
     retry = RETRY;
     do {
         stm32f411xx_sg->_delay();
-        _swd_ap_read(stm32f411xx_sg, &data, FLASH_SR, sizeof(u32));
+        stm32f411xx_read(&sr, FLASH_SR, sizeof(u32));
     }
-    while((retry--) && (data & FLASH_SR_BSY_MSK));
+    while((retry--) && (sr & FLASH_SR_BSY_MSK));
 
     // Clear MER
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
     data &= (~FLASH_CR_MER_MSK);
-    _swd_ap_write(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
+
+    // known erased only when the erase is seen finished without errors
+    if (sr & (FLASH_SR_BSY_MSK | FLASH_SR_ERR_MSK))
+        pr_err("[%s] mass erase failed sr:%08x\n",  __func__, sr);
+    else
+        stm32f411xx_erased_set(0, U32_MAX);
 
     stm32f411xx_lock_flash();
 }
@@ -402,12 +534,16 @@ static void stm32f411xx_erase_flash_sector(struct core_mem *cm, u32 offset, u32
     }
 
     // check if the flash is busy
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_SR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_SR, sizeof(u32));
     if(data & FLASH_SR_BSY_MSK){
         pr_err("[%s] Flash busy\n",  __func__);
         return;
     }
 
+    // errors of earlier operations are cleared by writing 1
+    data = FLASH_SR_ERR_MSK;
+    stm32f411xx_write(&data, FLASH_SR, sizeof(u32));
+
     // do sector erase
     erase_offset = offset;
     for (memseg_idx = cm->flash.offset;
@@ -417,23 +553,31 @@ static void stm32f411xx_erase_flash_sector(struct core_mem *cm, u32 offset, u32
             erase_offset < (cm->mem_segs[memseg_idx].start + cm->mem_segs[memseg_idx].size)) {
             sctr_nmb = memseg_idx - cm->flash.offset;
 
-            // set the sector erase and sector number
-            _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+            // set the sector erase and sector number, the one before cleared
+            stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
+            data &= ~(0xf << FLASH_CR_SNB_OFF);
             data |= (FLASH_CR_SER_MSK | (sctr_nmb << FLASH_CR_SNB_OFF));
-            _swd_ap_write(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+            stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
 
             // start the sector erase
-            _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+            stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
             data |= FLASH_CR_STRT_MSK;
-            _swd_ap_write(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+            stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
 
             // wait until the erase finished
             retry = RETRY;
             do {
                 stm32f411xx_sg->_delay();
-                _swd_ap_read(stm32f411xx_sg, &data, FLASH_SR, sizeof(u32));
+                stm32f411xx_read(&data, FLASH_SR, sizeof(u32));
             }while((retry--) && (data & FLASH_SR_BSY_MSK));
 
+            // a 128KB sector may outlast the retries, the sector is known
+            // erased only when it finished without errors
+            if (data & (FLASH_SR_BSY_MSK | FLASH_SR_ERR_MSK))
+                pr_err("[%s] sector %u erase failed sr:%08x\n",  __func__, sctr_nmb, data);
+            else
+                stm32f411xx_erased_set(cm->mem_segs[memseg_idx].start, 1);
+
             // sector erase completed, go to the next sector
             erase_offset = cm->mem_segs[memseg_idx].start + \
                             cm->mem_segs[memseg_idx].size;
@@ -445,22 +589,149 @@ static void stm32f411xx_erase_flash_sector(struct core_mem *cm, u32 offset, u32
     }
 
     // Restore the original value of FLASH_CR
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
     data &= ~(FLASH_CR_SER_MSK | (0xf << FLASH_CR_SNB_OFF));
-    _swd_ap_write(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
 
     stm32f411xx_lock_flash();
 }
 
-static ssize_t stm32f411xx_program_flash(struct core_mem *cm, void *from, u32 offset, u32 len)
+// Flash programming by halfword stores of the core itself (i.e. a routine
+// running from sram), on: unlocked with PG set, off: PG cleared and locked.
+static int stm32f411xx_flash_program_mode(bool on)
 {
-    int i;
     int retry;
+    u32 data;
+
+    if (on) {
+        if(stm32f411xx_unlock_flash()) {
+            pr_err("[%s] Unable to unlock flash\n",  __func__);
+            return -1;
+        }
+
+        // the routine may write anywhere
+        stm32f411xx_erased_forget();
+
+        // errors of earlier operations are cleared by writing 1
+        data = FLASH_SR_ERR_MSK;
+        stm32f411xx_write(&data, FLASH_SR, sizeof(u32));
+
+        stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
+        data |= (FLASH_CR_PG_MSK | (0x1 << FLASH_CR_PSIZE_OFF));
+        stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
+
+        return 0;
+    }
+
+    retry = RETRY;
+    do{
+        stm32f411xx_sg->_delay();
+        stm32f411xx_read(&data, FLASH_SR, sizeof(u32));
+    }while(retry-- && (data & FLASH_SR_BSY_MSK));
+
+    if (data & FLASH_SR_ERR_MSK)
+        pr_err("[%s] flash errors sr:%08x\n",  __func__, data);
+    retry = (data & (FLASH_SR_BSY_MSK | FLASH_SR_ERR_MSK)) ? -1 : 0;
+
+    stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
+    data &= ~(FLASH_CR_PG_MSK | (0x3 << FLASH_CR_PSIZE_OFF));
+    stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
+
+    stm32f411xx_lock_flash();
+
+    return retry;
+}
+
+// Compare len bytes at base with from, returns the bytes differing.
+static int stm32f411xx_verify(const u8 *from, u32 base, u32 len)
+{
+    int i;
+    int err = 0;
+    ssize_t read_len;
+    u8 data[64];
+
+    while (len) {
+        read_len = stm32f411xx_read(data, base, min_t(u32, len, sizeof(data)));
+        if (read_len <= 0)
+            return err + len;
+
+        for (i = 0 ; i < read_len ; i++) {
+            if (data[i] != from[i])
+                err++;
+        }
+
+        from += read_len;
+        base += read_len;
+        len -= read_len;
+    }
+
+    if (err)
+        swd_link_error(SWD_LINK_VERIFY);
+
+    return err;
+}
+
+// wait for the flash to finish, returns FLASH_SR
+static u32 stm32f411xx_flash_wait(void)
+{
+    int retry = RETRY;
+    u32 data;
+
+    do{
+        stm32f411xx_sg->_delay();
+        stm32f411xx_read(&data, FLASH_SR, sizeof(u32));
+    }while(retry-- && (data & FLASH_SR_BSY_MSK));
+
+    return data;
+}
+
+// Read back the words of the run at base and write again the ones which
+// did not land, they still read erased. A programmed word holding other
+// data is a flash failure, only an erase can fix it.
+// Returns the words written again, or -EIO. PG must be set.
+static int stm32f411xx_repair(const u32 *buf, u32 base, u32 n)
+{
+    int i;
+    int fixed = 0;
+    u32 nr;
+    u32 data[16];
+
+    for (; n ; n -= nr, buf += nr, base += nr * sizeof(u32)) {
+        nr = min_t(u32, n, ARRAY_SIZE(data));
+        if (stm32f411xx_read(data, base, nr * sizeof(u32)) != nr * sizeof(u32))
+            return -EIO;
+
+        for (i = 0 ; i < nr ; i++) {
+            if (data[i] == buf[i])
+                continue;
+
+            if (data[i] != 0xFFFFFFFF) {
+                pr_err("[%s] %08x reads %08x, not %08x\n", __func__,
+                       base + i * sizeof(u32), data[i], buf[i]);
+                return -EIO;
+            }
+
+            if (swd_bs_write_block(stm32f411xx_sg, base + i * sizeof(u32),
+                                   &buf[i], sizeof(u32), SWD_MEMAP_CSW, FLASH_PG_IDLE))
+                return -EIO;
+            fixed++;
+        }
+    }
+
+    return fixed;
+}
+
+static ssize_t stm32f411xx_program_flash(struct core_mem *cm, void *from, u32 offset, u32 len)
+{
+    int pass;
     int err;
+    int fixed;
     u32 data;
-    u32 cur_base;
+    u32 pos;
+    u32 n;
+    u32 nr = len / sizeof(u32);
     u32 *buf = (u32*)from;
-    u32 len_to_read = len / sizeof(u32);
+    bool erased = stm32f411xx_erased(offset, len);
 
     // Unlock flash
     if(stm32f411xx_unlock_flash()) {
@@ -469,83 +740,128 @@ static ssize_t stm32f411xx_program_flash(struct core_mem *cm, void *from, u32 of
     }
 
     // check if the flash is busy
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_SR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_SR, sizeof(u32));
     if(data & FLASH_SR_BSY_MSK){
         stm32f411xx_lock_flash();
         pr_err("[%s] Flash busy\n",  __func__);
         return -1;
     }
 
+    // errors of earlier operations are cleared by writing 1
+    data = FLASH_SR_ERR_MSK;
+    stm32f411xx_write(&data, FLASH_SR, sizeof(u32));
+
     // Set the programming bit and psize to be 32bit
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
     data |= (FLASH_CR_PG_MSK | (0x2 << FLASH_CR_PSIZE_OFF));
-    _swd_ap_write(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+    stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
+
+    // write data to flash, posted writes checked once at the end.
+    // words still erased are not sent, TAR is set again after them.
+    // a stream which fails is resumed at TAR by swd_bs_write_block()
+    for (pos = 0 ; (pos = stm32f411xx_next_run(buf, pos, nr, erased, &n)) < nr ; pos += n) {
+        if (swd_bs_write_block(stm32f411xx_sg, cm->flash.base + offset + pos * sizeof(u32),
+                               buf + pos, n * sizeof(u32), SWD_MEMAP_CSW, FLASH_PG_IDLE))
+            pr_err("[%s] block write failed\n",  __func__);
+    }
+    stm32f411xx_erased_clear(offset, len);
 
-    // write data to flash
-    _swd_ap_write(stm32f411xx_sg, buf, cm->flash.base + offset, len);
+    data = stm32f411xx_flash_wait();
 
-    retry = RETRY;
-    do{
-        stm32f411xx_sg->_delay();
-        _swd_ap_read(stm32f411xx_sg, &data, FLASH_SR, sizeof(u32));
-    }while(retry-- && (data & FLASH_SR_BSY_MSK));
+    // verify what was written, words lost on the way are written again.
+    // All of the buffer, the words skipped as erased must read erased too.
+    err = (data & FLASH_SR_ERR_MSK) ? -EIO : 0;
+    for (pass = 0 ; !err && (pass < FLASH_REPAIR_PASSES) ; pass++) {
+        fixed = stm32f411xx_repair(buf, cm->flash.base + offset, nr);
+        if (fixed < 0)
+            err = fixed;
 
-    _swd_ap_read(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
-    data &= ~(FLASH_CR_PG_MSK | (0x2 << FLASH_CR_PSIZE_OFF));
-    _swd_ap_write(stm32f411xx_sg, &data, FLASH_CR, sizeof(u32));
+        if (err || !fixed)
+            break;
 
-    // verify
-    err = 0;
-    cur_base = cm->flash.base + offset;
-    for (i = 0 ; i < len_to_read ; i++) {
-        _swd_ap_read(stm32f411xx_sg, &data, cur_base, sizeof(u32));
-        if (data != buf[i])
-            err += 4;
+        pr_info("[%s] pass:%d %d words written again\n", __func__, pass, fixed);
+        swd_link_error(SWD_LINK_VERIFY);
 
-        cur_base += sizeof(u32);
+        data = stm32f411xx_flash_wait();
+        if (data & FLASH_SR_ERR_MSK)
+            err = -EIO;
     }
+    if (!err && (pass == FLASH_REPAIR_PASSES))
+        err = -EIO;
 
-    if (err) {
-        stm32f411xx_erase_flash_sector(cm, offset, len);
-        stm32f411xx_lock_flash();
-        return err;
-    }
+    if (data & FLASH_SR_ERR_MSK)
+        pr_err("[%s] flash errors sr:%08x\n",  __func__, data);
+
+    stm32f411xx_read(&data, FLASH_CR, sizeof(u32));
+    data &= ~(FLASH_CR_PG_MSK | (0x2 << FLASH_CR_PSIZE_OFF));
+    stm32f411xx_write(&data, FLASH_CR, sizeof(u32));
 
     stm32f411xx_lock_flash();
 
-    return 0;
+    // a real flash failure, the caller erases and programs again
+    return err;
 }
 
 static ssize_t stm32f411xx_write_ram(struct core_mem *cm, void* from, u32 offset, u32 len)
 {
-    int i;
-    int err;
-    u32 data;
-    u32 cur_base;
-    u32 *buf = (u32*)from;
-    u32 len_to_read = len / sizeof(u32);
+    int ret;
+    u32 n;
+    u32 pos;
+    u8 *buf = (u8*)from;
+    u32 base = cm->sram.base + offset;
+
+    // write data to ram, byte/halfword edges and posted word writes between
+    for (pos = 0 ; pos < len ; pos += n) {
+        n = swd_bs_sub_len(base + pos, len - pos);
+        if (n) {
+            ret = swd_bs_access_sub(stm32f411xx_sg, buf + pos, base + pos, n, SWD_MEMAP_CSW, true);
+        } else {
+            n = (len - pos) & ~0x3;
+            ret = swd_bs_write_block(stm32f411xx_sg, base + pos, buf + pos, n, SWD_MEMAP_CSW, 0);
+        }
+        if (ret)
+            return -ENODEV;
+    }
 
-    // write data to ram
-    if (_swd_ap_write(stm32f411xx_sg, buf, cm->sram.base + offset, len) < 0)
-        return -ENODEV;
+    return stm32f411xx_verify(buf, base, len);
+}
 
-    // verify
-    err = 0;
-    cur_base = cm->sram.base + offset;
-    for (i = 0 ; i < len_to_read ; i++) {
-        _swd_ap_read(stm32f411xx_sg, &data, cur_base, sizeof(u32));
-        if (data != buf[i])
-            err += 4;
+// The unaligned head and the short tail take byte/halfword accesses of
+// their own call, the aligned words a burst.
+ssize_t stm32f411xx_read(void *to, u32 base, const u32 len)
+{
+    u32 len_to_read = swd_bs_sub_len(base, len);
 
-        cur_base += sizeof(u32);
+    if (len_to_read) {
+        if (swd_bs_access_sub(stm32f411xx_sg, to, base, len_to_read, SWD_MEMAP_CSW, false))
+            return -ENODEV;
+        return len_to_read;
     }
 
-    return err;
+    len_to_read = len > SWD_BANK_SIZE ? SWD_BANK_SIZE : (len & ~0x3);
+
+    if (swd_bs_read_block(stm32f411xx_sg, to, base, len_to_read, SWD_MEMAP_CSW))
+        return -ENODEV;
+
+    return len_to_read;
 }
 
-ssize_t stm32f411xx_read(void *to, u32 base, const u32 len)
+ssize_t stm32f411xx_write(void *from, u32 base, const u32 len)
 {
-   return _swd_ap_read(stm32f411xx_sg, to, base, len > SWD_BANK_SIZE ? SWD_BANK_SIZE : len);
+    u32 len_to_write = swd_bs_sub_len(base, len);
+
+    if (len_to_write) {
+        if (swd_bs_access_sub(stm32f411xx_sg, from, base, len_to_write, SWD_MEMAP_CSW, true))
+            return -ENODEV;
+        return len_to_write;
+    }
+
+    len_to_write = len > SWD_BANK_SIZE ? SWD_BANK_SIZE : (len & ~0x3);
+
+    if (swd_bs_write_block(stm32f411xx_sg, base, from, len_to_write, SWD_MEMAP_CSW, 0))
+        return -ENODEV;
+
+    return len_to_write;
 }
 
 struct rproc_core stm32f411ceu6_rc = {
@@ -557,10 +873,14 @@ struct rproc_core stm32f411ceu6_rc = {
     .core_reset = stm32f411xx_reset,
     .core_unhalt = stm32f411xx_unhalt_core,
     .core_halt = stm32f411xx_halt_core,
+    .setup_memap = stm32f411xx_setup_memap,
     .test_alive = stm32f411xx_test_alive,
     .erase_flash_all = stm32f411xx_erase_flash_all,
     .erase_flash_page = stm32f411xx_erase_flash_sector,
     .program_flash = stm32f411xx_program_flash,
+    .flash_program_mode = stm32f411xx_flash_program_mode,
+    .erased_forget = stm32f411xx_erased_forget,
     .write_ram = stm32f411xx_write_ram,
-    .read_ram = stm32f411xx_read
+    .read_ram = stm32f411xx_read,
+    .write_mem = stm32f411xx_write
 };
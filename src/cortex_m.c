@@ -0,0 +1,241 @@
+#include <linux/module.h>
+#include <linux/delay.h>
+#include <linux/jiffies.h>
+
+#include "cortex_m.h"
+#include "swd_bitstream.h"
+
+#define CORTEX_M_NAME "cortex_m"
+#define CORTEX_M_REG_RETRY  100
+
+// word access to the debug registers, the core may not be halted
+static int cortex_m_read(struct rproc_core *rc, u32 addr, u32 *val)
+{
+    return (rc->read_ram(val, addr, sizeof(u32)) == sizeof(u32)) ? 0 : -EIO;
+}
+
+static int cortex_m_write(struct rproc_core *rc, u32 addr, u32 val)
+{
+    return (rc->write_mem(&val, addr, sizeof(u32)) == sizeof(u32)) ? 0 : -EIO;
+}
+
+static int cortex_m_wait_regrdy(struct rproc_core *rc)
+{
+    int retry = CORTEX_M_REG_RETRY;
+    u32 dhcsr;
+
+    do {
+        if (cortex_m_read(rc, CORTEX_M_DHCSR, &dhcsr))
+            return -EIO;
+        if (dhcsr & CORTEX_M_S_REGRDY)
+            return 0;
+    } while (retry--);
+
+    return -ETIMEDOUT;
+}
+
+// DHCSR.S_HALT, rpu_status may be behind a core stopped or resumed by others
+int cortex_m_halted(struct rproc_core *rc)
+{
+    u32 dhcsr;
+
+    if (cortex_m_read(rc, CORTEX_M_DHCSR, &dhcsr))
+        return -EIO;
+
+    return (dhcsr & CORTEX_M_S_HALT) ? 0 : -EBUSY;
+}
+
+// Core register access through DCRSR/DCRDR, the core must be halted.
+int cortex_m_read_reg(struct rproc_core *rc, u32 reg, u32 *val)
+{
+    if (cortex_m_write(rc, CORTEX_M_DCRSR, reg) || cortex_m_wait_regrdy(rc))
+        return -EIO;
+
+    return cortex_m_read(rc, CORTEX_M_DCRDR, val);
+}
+
+int cortex_m_write_reg(struct rproc_core *rc, u32 reg, u32 val)
+{
+    if (cortex_m_write(rc, CORTEX_M_DCRDR, val))
+        return -EIO;
+
+    if (cortex_m_write(rc, CORTEX_M_DCRSR, reg | CORTEX_M_DCRSR_WNR))
+        return -EIO;
+
+    return cortex_m_wait_regrdy(rc);
+}
+
+// Run the thumb routine at pc with args in r0-r3 until it hits a bkpt,
+// interrupts masked. The core must be halted, it is halted again on return.
+int cortex_m_run(struct rproc_core *rc, u32 pc, u32 sp, const u32 *args, int nr_args,
+        unsigned int timeout_ms, u32 *r0)
+{
+    int i;
+    int ret;
+    u32 dhcsr;
+    unsigned long timeout;
+
+    for (i = 0 ; i < nr_args ; i++) {
+        ret = cortex_m_write_reg(rc, CORTEX_M_R0 + i, args[i]);
+        if (ret)
+            return ret;
+    }
+
+    ret = cortex_m_write_reg(rc, CORTEX_M_SP, sp);
+    ret |= cortex_m_write_reg(rc, CORTEX_M_PC, pc & ~0x1);
+    ret |= cortex_m_write_reg(rc, CORTEX_M_XPSR, CORTEX_M_XPSR_T);
+    if (ret)
+        return -EIO;
+
+    // C_MASKINTS may only change while halted
+    ret = cortex_m_write(rc, CORTEX_M_DHCSR, CORTEX_M_DBGKEY | CORTEX_M_C_DEBUGEN | CORTEX_M_C_HALT | CORTEX_M_C_MASKINTS);
+    ret |= cortex_m_write(rc, CORTEX_M_DHCSR, CORTEX_M_DBGKEY | CORTEX_M_C_DEBUGEN | CORTEX_M_C_MASKINTS);
+    if (ret)
+        return -EIO;
+
+    timeout = jiffies + msecs_to_jiffies(timeout_ms);
+    do {
+        ret = cortex_m_read(rc, CORTEX_M_DHCSR, &dhcsr);
+        if (ret || (dhcsr & CORTEX_M_S_HALT))
+            break;
+        usleep_range(50, 100);
+    } while (time_before(jiffies, timeout));
+
+    if (!ret && !(dhcsr & CORTEX_M_S_HALT)) {
+        pr_err("%s: [%s] %d routine at %08x timed out\n", CORTEX_M_NAME, __func__, __LINE__, pc);
+        ret = -ETIMEDOUT;
+    }
+
+    // halted again with interrupts unmasked
+    cortex_m_write(rc, CORTEX_M_DHCSR, CORTEX_M_DBGKEY | CORTEX_M_C_DEBUGEN | CORTEX_M_C_HALT | CORTEX_M_C_MASKINTS);
+    cortex_m_write(rc, CORTEX_M_DHCSR, CORTEX_M_DBGKEY | CORTEX_M_C_DEBUGEN | CORTEX_M_C_HALT);
+    if (ret)
+        return ret;
+
+    return r0 ? cortex_m_read_reg(rc, CORTEX_M_R0, r0) : 0;
+}
+
+// DCRSR selectors in the order of struct swd_core_regs
+static const u8 cortex_m_snapshot_sel[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+    CORTEX_M_SP, CORTEX_M_LR, CORTEX_M_PC,
+    CORTEX_M_XPSR, CORTEX_M_MSP, CORTEX_M_PSP, CORTEX_M_SPECIAL,
+};
+
+#define CORTEX_M_SNAPSHOT_NR    ARRAY_SIZE(cortex_m_snapshot_sel)
+
+// Every transaction is a header, an ack and a data run, the trailing idle
+// goes into the last data run. The stream is 6 transactions to read DHCSR,
+// 4 for each register, 6 for CFSR/HFSR, 5 for DFSR and 1 for SELECT.
+#define CORTEX_M_BS_XFER_OPS    3
+#define CORTEX_M_SNAPSHOT_OPS   ((6 + CORTEX_M_SNAPSHOT_NR * 4 + 6 + 5 + 1) * CORTEX_M_BS_XFER_OPS)
+// 2 reads for DHCSR, 3 for each register, 3 for CFSR/HFSR and 2 for DFSR
+#define CORTEX_M_SNAPSHOT_READS (2 + CORTEX_M_SNAPSHOT_NR * 3 + 3 + 2)
+
+static struct swd_bs_op cortex_m_snapshot_ops[CORTEX_M_SNAPSHOT_OPS];
+static struct swd_bs cortex_m_snapshot_bs;
+static u32 cortex_m_snapshot_rdata[CORTEX_M_SNAPSHOT_READS];   // bus lock held
+
+// slots in rdata of the compiled stream
+static struct {
+    int dhcsr;
+    int reg_dhcsr[CORTEX_M_SNAPSHOT_NR];   // S_REGRDY of each transfer
+    int reg[CORTEX_M_SNAPSHOT_NR];
+    int cfsr;
+    int hfsr;
+    int dfsr;
+    int nr;
+} cortex_m_slot;
+
+// With TAR at 0xE000EDF0 the banked data registers BD0-BD2 are DHCSR,
+// DCRSR and DCRDR, so every register is a DCRSR write, a DHCSR read for
+// S_REGRDY and a DCRDR read, without moving TAR. AP reads are posted,
+// the value comes with the next AP read or RDBUFF.
+static void cortex_m_snapshot_compile(void)
+{
+    int i;
+    struct swd_bs *bs = &cortex_m_snapshot_bs;
+
+    swd_bs_init(bs, cortex_m_snapshot_ops, ARRAY_SIZE(cortex_m_snapshot_ops));
+
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_CSW_REG & 0xC, SWD_MEMAP_CSW);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, CORTEX_M_DHCSR);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x10);
+
+    swd_bs_read(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_DHCSR));
+    cortex_m_slot.dhcsr = swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+
+    for (i = 0 ; i < CORTEX_M_SNAPSHOT_NR ; i++) {
+        swd_bs_write(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_DCRSR), cortex_m_snapshot_sel[i]);
+        swd_bs_read(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_DHCSR));
+        cortex_m_slot.reg_dhcsr[i] = swd_bs_read(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_DCRDR));
+        cortex_m_slot.reg[i] = swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+    }
+
+    // CFSR and HFSR are BD2/BD3 of 0xE000ED20, DFSR is BD0 of 0xE000ED30
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, CORTEX_M_CFSR & ~0xF);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x10);
+    swd_bs_read(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_CFSR));
+    cortex_m_slot.cfsr = swd_bs_read(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_HFSR));
+    cortex_m_slot.hfsr = swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, CORTEX_M_DFSR & ~0xF);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x10);
+    swd_bs_read(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_DFSR));
+    cortex_m_slot.dfsr = swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+    swd_bs_idle(bs);
+
+    cortex_m_slot.nr = bs->nr_reads;
+
+    // the reads land in cortex_m_snapshot_rdata
+    if (bs->nr_reads > CORTEX_M_SNAPSHOT_READS)
+        bs->overflow = true;
+
+    if (bs->overflow)
+        pr_err("%s: [%s] %d snapshot does not fit %d ops\n", CORTEX_M_NAME, __func__, __LINE__, bs->max_ops);
+}
+
+// All core registers and the fault status in one stream. A register whose
+// transfer was not ready by the DCRDR read is read again the slow way.
+// Caller must hold the bus lock.
+int cortex_m_snapshot(struct swd_device *sd, struct swd_core_regs *regs)
+{
+    int i;
+    int ret;
+    u32 *rdata = cortex_m_snapshot_rdata;
+    u32 *val = (u32*)regs;  // r0-r15, xpsr, msp, psp, special lead the struct
+
+    if (!cortex_m_snapshot_bs.ops)
+        cortex_m_snapshot_compile();
+
+    if (cortex_m_snapshot_bs.overflow)
+        return -ENOSPC;
+
+    ret = swd_bs_run(sd->sg, &cortex_m_snapshot_bs, rdata);
+    if (ret)
+        return ret;
+
+    regs->dhcsr = rdata[cortex_m_slot.dhcsr];
+    if (!(regs->dhcsr & CORTEX_M_S_HALT))
+        return -EBUSY;
+
+    for (i = 0 ; i < CORTEX_M_SNAPSHOT_NR ; i++) {
+        val[i] = rdata[cortex_m_slot.reg[i]];
+        if (!(rdata[cortex_m_slot.reg_dhcsr[i]] & CORTEX_M_S_REGRDY)) {
+            ret = cortex_m_read_reg(sd->rc, cortex_m_snapshot_sel[i], &val[i]);
+            if (ret)
+                return ret;
+        }
+    }
+
+    regs->cfsr = rdata[cortex_m_slot.cfsr];
+    regs->hfsr = rdata[cortex_m_slot.hfsr];
+    regs->dfsr = rdata[cortex_m_slot.dfsr];
+
+    return 0;
+}
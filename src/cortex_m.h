@@ -0,0 +1,58 @@
+#ifndef CORTEX_M_H
+#define CORTEX_M_H
+
+#include "rproc_core.h"
+#include "swd_drv.h"
+#include "../include/swd_module.h"
+
+#define CORTEX_M_DHCSR      0xE000EDF0
+#define CORTEX_M_DCRSR      0xE000EDF4
+#define CORTEX_M_DCRDR      0xE000EDF8
+#define CORTEX_M_CFSR       0xE000ED28
+#define CORTEX_M_HFSR       0xE000ED2C
+#define CORTEX_M_DFSR       0xE000ED30
+#define CORTEX_M_DEMCR      0xE000EDFC
+#define CORTEX_M_DWT_CTRL   0xE0001000
+#define CORTEX_M_DWT_CYCCNT 0xE0001004
+#define CORTEX_M_DWT_PCSR   0xE000101C
+
+#define CORTEX_M_DBGKEY     (0xA05F << 16)
+#define CORTEX_M_C_DEBUGEN  BIT(0)
+#define CORTEX_M_C_HALT     BIT(1)
+#define CORTEX_M_C_MASKINTS BIT(3)
+#define CORTEX_M_S_REGRDY   BIT(16)
+#define CORTEX_M_S_HALT     BIT(17)
+#define CORTEX_M_S_LOCKUP   BIT(19)
+#define CORTEX_M_S_RESET_ST BIT(25)     // reset since the last read
+
+#define CORTEX_M_DCRSR_WNR  BIT(16)
+#define CORTEX_M_DEMCR_TRCENA   BIT(24)
+#define CORTEX_M_DWT_CYCCNTENA  BIT(0)
+
+// DCRSR register selectors
+enum CORTEX_M_REG {
+    CORTEX_M_R0 = 0,
+    CORTEX_M_SP = 13,
+    CORTEX_M_LR = 14,
+    CORTEX_M_PC = 15,
+    CORTEX_M_XPSR = 16,
+    CORTEX_M_MSP = 17,
+    CORTEX_M_PSP = 18,
+    CORTEX_M_SPECIAL = 20,  // CONTROL, FAULTMASK, BASEPRI, PRIMASK
+};
+
+#define CORTEX_M_XPSR_T     BIT(24)
+
+// 0 if the core is halted, -EBUSY if it runs
+int cortex_m_halted(struct rproc_core *rc);
+
+int cortex_m_read_reg(struct rproc_core *rc, u32 reg, u32 *val);
+
+int cortex_m_write_reg(struct rproc_core *rc, u32 reg, u32 val);
+
+int cortex_m_run(struct rproc_core *rc, u32 pc, u32 sp, const u32 *args, int nr_args,
+        unsigned int timeout_ms, u32 *r0);
+
+int cortex_m_snapshot(struct swd_device *sd, struct swd_core_regs *regs);
+
+#endif
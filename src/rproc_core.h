@@ -43,16 +43,23 @@ struct rproc_core {
     void (*core_reset)(void);
     void (*core_unhalt)(void);
     int  (*core_halt)(void);
+    int  (*setup_memap)(void);
     u32 (*test_alive)(void);
 
     // functions for flash
     void (*erase_flash_all)(void);
     void (*erase_flash_page)(struct core_mem*, u32, u32);
     ssize_t (*program_flash)(struct core_mem*, void *, u32, u32);
+    int (*flash_program_mode)(bool);
+    // flash may have been written behind the driver, nothing is known erased
+    void (*erased_forget)(void);
 
     // functions for ram
     ssize_t (*write_ram)(struct core_mem*, void*, u32, u32);
     ssize_t (*read_ram)(void*, u32, const u32);
+
+    // functions for any address, core may be running
+    ssize_t (*write_mem)(void*, u32, const u32);
 };
 
 #endif
@@ -0,0 +1,246 @@
+#include <linux/module.h>
+#include <linux/firmware.h>
+#include <linux/completion.h>
+#include <linux/string.h>
+
+#include "swd_drv.h"
+#include "swd_session.h"
+#include "swd_exec.h"
+#include "swd_monitor.h"
+#include "swd_pool.h"
+#include "rpu_sysfs.h"
+#include "rpu_firmware.h"
+
+#define RPUFW_NAME "rpu_firmware"
+#define RPUFW_RETRY     3       // erase and program a sector again when verify fails
+#define RPUFW_NAME_LEN  64
+
+static char *firmware;
+module_param(firmware, charp, 0444);
+MODULE_PARM_DESC(firmware, "image programmed to flash at probe, loaded by request_firmware");
+
+static bool firmware_unhalt = true;
+module_param(firmware_unhalt, bool, 0644);
+MODULE_PARM_DESC(firmware_unhalt, "unhalt the core once the image is programmed");
+
+extern atomic_t open_lock;
+extern int rpu_status;
+
+// result of the last image, read back from the firmware attribute
+static struct {
+    struct swd_device *sd;
+    char name[RPUFW_NAME_LEN];
+    size_t size;
+    int ret;
+    bool pending;               // the probe time request is not done yet
+    struct completion done;
+} rpu_fw;
+
+// Erase and program the sector at start with the image bytes it holds,
+// the rest of the sector is left erased. Caller must hold the bus lock.
+static int rpu_firmware_sector(struct swd_device *sd, const struct firmware *fw,
+        char *buf, u32 start, u32 size)
+{
+    int ret;
+    u32 pos;
+    u32 len;
+    u32 end = min_t(u32, start + size, fw->size);
+    int retry = RPUFW_RETRY;
+    struct rproc_core *rc = sd->rc;
+    struct core_mem *cm = rc->ci->cm;
+
+    do {
+        rc->erase_flash_page(cm, start, size);
+
+        for (pos = start ; pos < end ; pos += len) {
+            ret = swd_bus_yield(sd);
+            if (ret)
+                break;
+
+            len = min(end - pos, cm->flash.program_size);
+
+            // the tail padded to words with the erased value
+            memcpy(buf, fw->data + pos, len);
+            memset(buf + len, 0xff, ALIGN(len, sizeof(u32)) - len);
+
+            ret = rc->program_flash(cm, buf, pos, ALIGN(len, sizeof(u32)));
+            if (ret)
+                break;
+        }
+    } while (ret && retry--);
+
+    return ret ? -EIO : 0;
+}
+
+// Halt the core, erase what the image covers sector by sector, program
+// and verify it, unhalt the core if firmware_unhalt.
+static int rpu_firmware_program(struct swd_device *sd, const struct firmware *fw)
+{
+    int ret;
+    u32 pos;
+    u32 start;
+    u32 size;
+    char *buf;
+    struct rproc_core *rc = sd->rc;
+    struct core_mem *cm = rc->ci->cm;
+
+    if(!atomic_dec_and_test(&open_lock)){
+        atomic_inc(&open_lock);
+        return -EBUSY;
+    }
+    swd_bus_lock(sd);
+
+    ret = swd_session_get(sd);
+    if (ret)
+        goto rpu_firmware_unlock;
+
+    // the sector buffered by the flash attribute would go over the image
+    ret = rpu_flash_sync();
+    if (ret)
+        goto rpu_firmware_put;
+
+    ret = rc->core_halt();
+    if (ret && !swd_session_recover(sd))
+        ret = rc->core_halt();
+    if (ret)
+        goto rpu_firmware_put;
+    rpu_status = RPU_STATUS_HALT;
+
+    buf = swd_pool_get(sd);
+
+    for (pos = 0 ; pos < fw->size ; pos = start + size) {
+        ret = rpu_flash_find_sector(cm, pos, &start, &size);
+        if (ret) {
+            pr_err("%s: [%s] %d image of %zu bytes does not fit the flash\n", RPUFW_NAME, __func__, __LINE__, fw->size);
+            break;
+        }
+
+        ret = rpu_firmware_sector(sd, fw, buf, start, size);
+        if (ret) {
+            pr_err("%s: [%s] %d sector %08x failed\n", RPUFW_NAME, __func__, __LINE__, start);
+            break;
+        }
+    }
+
+    swd_pool_put(sd, buf);
+
+    if (!ret && firmware_unhalt) {
+        swd_exec_forget();
+        rc->core_unhalt();
+        rpu_status = RPU_STATUS_UNHALT;
+        swd_monitor_kick();
+    }
+
+rpu_firmware_put:
+    swd_session_put(sd, false);
+
+rpu_firmware_unlock:
+    swd_bus_unlock(sd);
+    atomic_inc(&open_lock);
+
+    return ret;
+}
+
+static void rpu_firmware_done(const char *name, const struct firmware *fw, int ret)
+{
+    strscpy(rpu_fw.name, name, sizeof(rpu_fw.name));
+    rpu_fw.size = fw ? fw->size : 0;
+    rpu_fw.ret = ret;
+
+    pr_info("%s: [%s] %d %s %zu bytes ret:%d\n", RPUFW_NAME, __func__, __LINE__, rpu_fw.name, rpu_fw.size, ret);
+}
+
+static void rpu_firmware_cont(const struct firmware *fw, void *ctx)
+{
+    struct swd_device *sd = ctx;
+
+    rpu_firmware_done(firmware, fw, fw ? rpu_firmware_program(sd, fw) : -ENOENT);
+    release_firmware(fw);
+
+    complete(&rpu_fw.done);
+}
+
+// "echo blink.bin > firmware" programs /lib/firmware/blink.bin
+static ssize_t rpu_firmware_write(struct file *filp, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    int ret;
+    char name[RPUFW_NAME_LEN];
+    const struct firmware *fw;
+    struct swd_device *sd = rpu_fw.sd;
+
+    if (!sd)
+        return -ENODEV;
+
+    if (off || (count >= sizeof(name)))
+        return -EINVAL;
+
+    memcpy(name, buf, count);
+    name[count] = '\0';
+    strim(name);
+    if (!name[0])
+        return -EINVAL;
+
+    ret = request_firmware(&fw, name, sd->dev);
+    if (ret) {
+        rpu_firmware_done(name, NULL, ret);
+        return ret;
+    }
+
+    ret = rpu_firmware_program(sd, fw);
+    rpu_firmware_done(name, fw, ret);
+    release_firmware(fw);
+
+    return ret ? ret : count;
+}
+
+static ssize_t rpu_firmware_read(struct file *filp, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    if (off)
+        return 0;
+
+    if (!rpu_fw.name[0])
+        return sprintf(buf, "none\n");
+
+    return sprintf(buf, "%s %zu %s\n", rpu_fw.name, rpu_fw.size, rpu_fw.ret ? "failed" : "programmed");
+}
+
+struct bin_attribute rpu_firmware_attr = {
+    .attr.name = "firmware",
+    .attr.mode = 0664,
+    .size = 0,
+    .read = rpu_firmware_read,
+    .write = rpu_firmware_write,
+};
+
+// Program the firmware param in the background, the probe goes on.
+int rpu_firmware_init(struct swd_device *sd)
+{
+    int ret;
+
+    rpu_fw.sd = sd;
+    rpu_fw.pending = false;
+    init_completion(&rpu_fw.done);
+
+    if (!firmware || !firmware[0])
+        return 0;
+
+    ret = request_firmware_nowait(THIS_MODULE, true, firmware, sd->dev, GFP_KERNEL, sd, rpu_firmware_cont);
+    if (ret) {
+        pr_err("%s: [%s] %d Err with request %s\n", RPUFW_NAME, __func__, __LINE__, firmware);
+        return ret;
+    }
+    rpu_fw.pending = true;
+
+    return 0;
+}
+
+void rpu_firmware_exit(struct swd_device *sd)
+{
+    if (rpu_fw.pending)
+        wait_for_completion(&rpu_fw.done);
+
+    rpu_fw.pending = false;
+    rpu_fw.sd = NULL;
+}
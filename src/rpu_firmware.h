@@ -0,0 +1,14 @@
+#ifndef RPU_FIRMWARE_H
+#define RPU_FIRMWARE_H
+
+#include <linux/sysfs.h>
+
+#include "swd_drv.h"
+
+extern struct bin_attribute rpu_firmware_attr;
+
+int rpu_firmware_init(struct swd_device *sd);
+
+void rpu_firmware_exit(struct swd_device *sd);
+
+#endif
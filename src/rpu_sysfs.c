@@ -2,9 +2,17 @@
 #include <linux/device.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "swd_drv.h"
+#include "swd_session.h"
 #include "rpu_sysfs.h"
+#include "rpu_firmware.h"
+#include "cortex_m.h"
+#include "swd_exec.h"
+#include "swd_pool.h"
+#include "swd_link.h"
+#include "swd_monitor.h"
 
 #define RPUDEV_NAME "rpu"
 
@@ -14,127 +22,225 @@ static struct device *rpu_dev;
 
 int rpu_status = RPU_STATUS_UNHALT;
 
+// allow word access to ram/flash while the core is running
+int rpu_live = 0;
+
 struct swd_device *rpu_swd_dev;
 
+#define RPU_FLASH_RETRY     3
+#define RPU_FLASH_FLUSH_MS  200
+
+// write-back buffer of the flash attribute, one sector is kept until it is
+// complete, so it is erased and programmed only once.
+struct rpu_flash_wb {
+    struct file *filp;      // writer of the buffered data
+    char *buf;              // from the device pool while data is buffered
+    u32 sector;             // offset of the buffered sector in flash
+    u32 size;
+    u32 lo;                 // dirty range [lo, hi) in the sector
+    u32 hi;
+    struct delayed_work flush_work;
+};
+
+static struct rpu_flash_wb rpu_wb;
+
+// Read len bytes at base, read_ram returns at most one bank per call
+static int rpu_read_mem(struct rproc_core *rc, char *to, u32 base, u32 len)
+{
+    u32 pos = 0;
+    ssize_t read_len;
+
+    while (pos < len) {
+        read_len = rc->read_ram(to + pos, base + pos, len - pos);
+        if (read_len <= 0)
+            return -EIO;
+        pos += read_len;
+    }
+
+    return 0;
+}
+
 static ssize_t _rpu_xxx_read(char *buf, loff_t off, size_t count)
 {
     struct rproc_core *rc = rpu_swd_dev->rc;
 
-    rc->read_ram(buf, off, count);
+    if (rpu_read_mem(rc, buf, off, count))
+        return -EIO;
 
     return count;
 }
 
-static ssize_t flash_write_uni(struct rproc_core *rc, char* buf, u32 offset, u32 count)
+// find the erase unit (page or sector) holding offset
+int rpu_flash_find_sector(struct core_mem *cm, u32 offset, u32 *start, u32 *size)
 {
-    int err;
-    int pos;
-    int len;
-    int len_to_write;
+    int i;
+
+    if (!cm->flash.attr) {
+        // unified page size, flash.len is the size of the flash
+        if (offset >= cm->flash.len)
+            return -ENOSPC;
+
+        *size = cm->mem_segs[cm->flash.offset].size;
+        *start = offset & ~(*size - 1);
+        return 0;
+    }
+
+    for (i = cm->flash.offset ; i < cm->flash.offset + cm->flash.len ; i++) {
+        if ((offset >= cm->mem_segs[i].start) && \
+            (offset < cm->mem_segs[i].start + cm->mem_segs[i].size)) {
+            *start = cm->mem_segs[i].start;
+            *size = cm->mem_segs[i].size;
+            return 0;
+        }
+    }
+
+    return -ENOSPC;
+}
+
+// Commit the buffered sector: fill the bytes not written from the flash,
+// then erase it once and program it once. Retry a few times if the
+// verify fails. Caller must hold the bus lock.
+static int flash_wb_commit(struct rproc_core *rc)
+{
+    int ret;
+    u32 pos;
+    u32 len;
+    int retry = RPU_FLASH_RETRY;
     struct core_mem *cm = rc->ci->cm;
+    struct rpu_flash_wb *wb = &rpu_wb;
+
+    if (wb->lo == wb->hi)
+        return 0;
+
+    pr_info("%s [%s] sector:%08x size:%u dirty:%u-%u\n",RPUDEV_NAME, __func__,
+            wb->sector, wb->size, wb->lo, wb->hi);
+
+    ret = rpu_read_mem(rc, wb->buf, cm->flash.base + wb->sector, wb->lo);
+    if (!ret)
+        ret = rpu_read_mem(rc, wb->buf + wb->hi, cm->flash.base + wb->sector + wb->hi,
+                            wb->size - wb->hi);
+    if (ret)
+        goto flash_wb_commit_finish;
 
-    pos = 0;
-    len_to_write = count;
     do {
-        len = (len_to_write > cm->flash.program_size) ? cm->flash.program_size : len_to_write;
-        err = rc->program_flash(cm, &(buf[pos]), offset + pos, len);
-        if (err) {
-            /* Program error, erase flash */
-            rc->erase_flash_page(cm, offset + pos, len);
-            continue;
+        rc->erase_flash_page(cm, wb->sector, wb->size);
+
+        for (pos = 0 ; pos < wb->size ; pos += len) {
+            len = min(wb->size - pos, cm->flash.program_size);
+            ret = rc->program_flash(cm, wb->buf + pos, wb->sector + pos, len);
+            if (ret)
+                break;
         }
+    } while (ret && retry--);
 
-        len_to_write -= len;
-        pos += len;
-    } while(len_to_write);
+    if (ret) {
+        pr_err("%s [%s] failed to program sector %08x\n",RPUDEV_NAME, __func__, wb->sector);
+        ret = -EIO;
+    }
 
-    return count;
+flash_wb_commit_finish:
+    wb->lo = wb->hi = 0;
+    wb->filp = NULL;
+    swd_pool_put(rpu_swd_dev, wb->buf);
+    wb->buf = NULL;
+
+    return ret;
 }
 
-static ssize_t flash_write(struct rproc_core *rc, char* buf, u32 offset, u32 count)
+static int flash_wb_flush(void)
 {
-    int i;
-    int err;
-    int pos;
-    int len;
-    int retry = 10;
-    int len_to_write;
-    u32 page_size = 0;
-    u32 page_offset = 0;
-    char *buf_page = NULL;
-    struct core_mem *cm = rc->ci->cm;
+    int ret;
 
-    // 1. find flash page info
-    if (cm->flash.attr) {
-        // non-unified page size, find the corresponding page
-        for (i = cm->flash.offset;
-            (cm->mem_segs[i].start !=0) || (cm->mem_segs[i].size != 0);
-            i++) {
-            if ((offset >= cm->mem_segs[i].start) && \
-                (offset < cm->mem_segs[i].start + cm->mem_segs[i].size)) {
-                    page_offset = cm->mem_segs[i].start;
-                    page_size = cm->mem_segs[i].size;
-                    break;
-            }
-        }
-    } else { // unified page size
-        if (cm->mem_segs[cm->flash.offset].size > count) {
-            // calculate the page base address and size
-            page_offset = offset & ~(cm->mem_segs[cm->flash.offset].size - 1);
-            page_size = cm->mem_segs[cm->flash.offset].size;
-            i = cm->flash.offset;
-        }
+    if (rpu_wb.lo == rpu_wb.hi)
+        return 0;
+
+    ret = swd_session_get(rpu_swd_dev);
+    if (ret)
+        return ret;
+
+    ret = flash_wb_commit(rpu_swd_dev->rc);
+
+    swd_session_put(rpu_swd_dev, false);
+
+    return ret;
+}
+
+int rpu_flash_sync(void)
+{
+    return flash_wb_commit(rpu_swd_dev->rc);
+}
+
+// sysfs gives no release for a bin attribute, so a writer that stayed
+// quiet for a while is taken as closed.
+static void flash_wb_flush_work(struct work_struct *work)
+{
+    if(!atomic_dec_and_test(&open_lock)){
+        atomic_inc(&open_lock);
+        schedule_delayed_work(&rpu_wb.flush_work, msecs_to_jiffies(RPU_FLASH_FLUSH_MS));
+        return;
     }
+    swd_bus_lock(rpu_swd_dev);
 
-    // 2. keep data from flash page in buffer
-    if ((page_offset == 0) && (page_size == 0)) {
-        pos = 0;
-        buf_page = buf;
-    } else {
-        // get buff to keep data in the page
-        buf_page = vmalloc(page_size);
-        if (!buf_page)
-            return -1;
-
-        // read data from flash
-        if (_rpu_xxx_read(buf_page, page_offset,
-                            offset - page_offset) < 0) {
-            count = -1;
-            goto read_flash_err;
-        }
+    flash_wb_flush();
+
+    swd_bus_unlock(rpu_swd_dev);
+    atomic_inc(&open_lock);
+}
 
-        // calculate the pos, copy data to buf_page
-        pos = offset - page_offset;
-        memcpy(&(buf_page[pos]), buf, count);
+// Accumulate the write in the sector buffer. A sector is committed when the
+// write runs past its end, jumps elsewhere, or another writer shows up.
+static ssize_t flash_write(struct rproc_core *rc, struct file *filp, char* buf, u32 offset, u32 count)
+{
+    int ret;
+    u32 pos;
+    u32 len;
+    u32 start;
+    u32 size;
+    struct core_mem *cm = rc->ci->cm;
+    struct rpu_flash_wb *wb = &rpu_wb;
+
+    if (wb->filp && (wb->filp != filp)) {
+        ret = flash_wb_commit(rc);
+        if (ret)
+            return ret;
     }
 
-    // 3. program the flash
-    //    rogram current data first, if there is an error happend,
-    //    reprogram this page.
-    len_to_write = count;
-    do {
-        len = (len_to_write > cm->flash.program_size) ? \
-	      cm->flash.program_size : len_to_write;
+    for (pos = 0 ; pos < count ; pos += len) {
+        ret = rpu_flash_find_sector(cm, offset + pos, &start, &size);
+        if (ret)
+            return pos ? pos : ret;
+
+        // only a write continuing the dirty range can be combined
+        if ((wb->lo != wb->hi) && \
+            ((start != wb->sector) || (offset + pos != wb->sector + wb->hi))) {
+            ret = flash_wb_commit(rc);
+            if (ret)
+                return ret;
+        }
 
-        err = rc->program_flash(cm, &(buf_page[pos]), page_offset + pos, len);
-        if (err) {
-            /* Program error, erase this page, and reprogram */
-            rc->erase_flash_page(cm, page_offset, page_size);
-	    if (!retry--){
-                count = -1;
-                goto read_flash_err;
-            }
-            pos = 0;
-            len_to_write = (offset - page_offset) + count;
-            continue;
+        if (wb->lo == wb->hi) {
+            // the pool buffers hold the largest sector
+            if (!wb->buf)
+                wb->buf = swd_pool_get(rpu_swd_dev);
+            wb->sector = start;
+            wb->size = size;
+            wb->lo = wb->hi = offset + pos - start;
         }
 
-        len_to_write -= len;
-        pos += len;
-    } while(len_to_write);
+        len = min(count - pos, wb->size - wb->hi);
+        memcpy(wb->buf + wb->hi, buf + pos, len);
+        wb->hi += len;
+        wb->filp = filp;
+
+        if (wb->hi == wb->size) {
+            ret = flash_wb_commit(rc);
+            if (ret)
+                return ret;
+        }
+    }
 
-read_flash_err:
-    vfree(buf_page);
+    if (wb->lo != wb->hi)
+        mod_delayed_work(system_wq, &wb->flush_work, msecs_to_jiffies(RPU_FLASH_FLUSH_MS));
 
     return count;
 }
@@ -221,15 +327,10 @@ static struct bin_attribute rpu_meminfo_attr = {
     .size = 0,
     .read = rpu_meminfo_read,
 };
+// only the state kept by the driver, readable while anyone holds the bus
 static ssize_t rpu_status_read(struct file *filp, struct kobject *kobj,
         struct bin_attribute *attr, char *buf, loff_t off, size_t count)
 {
-    // allow one process to open it.
-    if(!atomic_dec_and_test(&open_lock)){
-        atomic_inc(&open_lock);
-        return -EBUSY;
-    }
-
     pr_info("%s [%s] start\n",RPUDEV_NAME, __func__);
 
     if (off) {
@@ -245,8 +346,6 @@ static ssize_t rpu_status_read(struct file *filp, struct kobject *kobj,
     pr_info("%s [%s] finish\n",RPUDEV_NAME, __func__);
 
 rpu_status_finish:
-    atomic_inc(&open_lock);
-
     return count;
 }
 
@@ -257,6 +356,55 @@ static struct bin_attribute rpu_status_attr = {
     .read = rpu_status_read,
 };
 
+// poll() on "status" wakes up when the monitor sees the core state change
+void rpu_status_notify(void)
+{
+    sysfs_notify(&rpu_dev->kobj, NULL, "status");
+}
+
+static bool rpu_monitor = false;
+
+static ssize_t rpu_monitor_read(struct file *filp, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    if (off)
+        return 0;
+
+    return swd_monitor_show(buf, count);
+}
+
+// "1" keeps the monitor running for the pollers of "status", "0" lets it stop
+static ssize_t rpu_monitor_write(struct file *filp, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    int ret, val;
+
+    ret = kstrtoint(buf, 0, &val);
+    if (ret < 0)
+        return ret;
+
+    if (!!val == rpu_monitor)
+        return count;
+
+    ret = swd_monitor_watch(!!val);
+    if (ret)
+        return ret;
+
+    rpu_monitor = !!val;
+
+    pr_info("%s [%s] monitor %s\n",RPUDEV_NAME, __func__, rpu_monitor ? "on" : "off");
+
+    return count;
+}
+
+static struct bin_attribute rpu_monitor_attr = {
+    .attr.name = "monitor",
+    .attr.mode = 0664,
+    .size = 0,
+    .read = rpu_monitor_read,
+    .write = rpu_monitor_write,
+};
+
 static ssize_t rpu_control_write(struct file *filp, struct kobject *kobj,
         struct bin_attribute *attr, char *buf, loff_t off, size_t count)
 {
@@ -268,6 +416,7 @@ static ssize_t rpu_control_write(struct file *filp, struct kobject *kobj,
         atomic_inc(&open_lock);
         return -EBUSY;
     }
+    swd_bus_lock(rpu_swd_dev);
 
     pr_info("%s [%s] start\n",RPUDEV_NAME, __func__);
 
@@ -277,34 +426,48 @@ static ssize_t rpu_control_write(struct file *filp, struct kobject *kobj,
         goto rpu_control_finish;
     }
 
+    retry = 10;
+    do {
+        ret = swd_session_get(rpu_swd_dev);
+    } while(ret && retry--);
+    if (ret) {
+        count = -EBUSY;
+        goto rpu_control_finish;
+    }
+
+    // the buffered sector goes to flash before the core runs from it
+    if (flash_wb_commit(rc)) {
+        count = -EIO;
+        goto rpu_control_put;
+    }
+
     if (val == RPU_STATUS_UNHALT) {
         rpu_status = RPU_STATUS_UNHALT;
+        swd_exec_forget();
         rc->core_unhalt();
+        swd_monitor_kick();
     } else {
         rpu_status = RPU_STATUS_HALT;
 
         retry = 10;
         do {
-            ret = rc->core_init();
+            ret = rc->core_halt();
+            if (ret)
+                swd_session_recover(rpu_swd_dev);
         } while(ret && retry--);
-        if (!retry) {
-                count = -EBUSY;
-                goto rpu_control_finish;
-	}
-
-        retry = 10;
-        do {
-           ret = rc->core_halt();
-        } while(ret && retry--);
-	if (!retry) {
-		count = -EBUSY;
-		goto rpu_control_finish;
-	}
+        if (ret) {
+            count = -EBUSY;
+            goto rpu_control_put;
+        }
     }
 
     pr_info("%s [%s] finish\n",RPUDEV_NAME, __func__);
 
+rpu_control_put:
+    swd_session_put(rpu_swd_dev, false);
+
 rpu_control_finish:
+    swd_bus_unlock(rpu_swd_dev);
     atomic_inc(&open_lock);
 
     return count;
@@ -317,6 +480,98 @@ static struct bin_attribute rpu_control_attr = {
     .write = rpu_control_write,
 };
 
+// struct swd_core_regs of the halted core, in one locked snapshot
+static ssize_t rpu_regs_read(struct file *filp, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    int ret;
+    struct swd_core_regs regs;
+
+    if (off >= sizeof(regs))
+        return 0;
+
+    swd_bus_lock_urgent(rpu_swd_dev);
+
+    if (swd_session_get(rpu_swd_dev)) {
+        count = -ENODEV;
+        goto rpu_regs_finish;
+    }
+
+    ret = cortex_m_snapshot(rpu_swd_dev, &regs);
+    if (ret) {
+        count = ret;
+        goto rpu_regs_put;
+    }
+
+    count = min_t(size_t, count, sizeof(regs) - off);
+    memcpy(buf, (char*)&regs + off, count);
+
+rpu_regs_put:
+    swd_session_put(rpu_swd_dev, false);
+
+rpu_regs_finish:
+    swd_bus_unlock(rpu_swd_dev);
+
+    return count;
+}
+
+static struct bin_attribute rpu_regs_attr = {
+    .attr.name = "regs",
+    .attr.mode = 0444,
+    .size = sizeof(struct swd_core_regs),
+    .read = rpu_regs_read,
+};
+
+static ssize_t rpu_live_read(struct file *filp, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    if (off)
+        return 0;
+
+    return sprintf(buf, "%d\n", rpu_live);
+}
+
+static ssize_t rpu_live_write(struct file *filp, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    int ret, val;
+
+    ret = kstrtoint(buf, 0, &val);
+    if (ret < 0)
+        return ret;
+
+    rpu_live = !!val;
+
+    pr_info("%s [%s] live access %s\n",RPUDEV_NAME, __func__, rpu_live ? "on" : "off");
+
+    return count;
+}
+
+static struct bin_attribute rpu_live_attr = {
+    .attr.name = "live",
+    .attr.mode = 0664,
+    .size = 0,
+    .read = rpu_live_read,
+    .write = rpu_live_write,
+};
+
+// the learned SWCLK rate and the link errors which moved it
+static ssize_t rpu_link_read(struct file *filp, struct kobject *kobj,
+        struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+    if (off)
+        return 0;
+
+    return swd_link_show(buf, count);
+}
+
+static struct bin_attribute rpu_link_attr = {
+    .attr.name = "link",
+    .attr.mode = 0444,
+    .size = 0,
+    .read = rpu_link_read,
+};
+
 static ssize_t rpu_flash_read(struct file *filp, struct kobject *kobj,
         struct bin_attribute *attr, char *buf, loff_t off, size_t count)
 {
@@ -327,20 +582,36 @@ static ssize_t rpu_flash_read(struct file *filp, struct kobject *kobj,
         atomic_inc(&open_lock);
         return -EBUSY;
     }
+    swd_bus_lock(rpu_swd_dev);
 
-    if (rpu_status != RPU_STATUS_HALT)
+    if ((rpu_status != RPU_STATUS_HALT) && !rpu_live)
         goto rpu_status_unhalt;
 
+    if (swd_session_get(rpu_swd_dev)) {
+        count = -ENODEV;
+        goto rpu_status_unhalt;
+    }
+
     pr_info("%s [%s] start\n",RPUDEV_NAME, __func__);
 
+    // read back what was written, not what is still buffered
+    if (flash_wb_commit(rc)) {
+        count = -EIO;
+        goto rpu_session_put;
+    }
+
     if (_rpu_xxx_read(buf, cm->flash.base + off, count) < 0) {
         count = -1;
-        goto rpu_status_unhalt;
+        goto rpu_session_put;
     }
 
     pr_info("%s [%s] finish\n",RPUDEV_NAME, __func__);
 
+rpu_session_put:
+    swd_session_put(rpu_swd_dev, false);
+
 rpu_status_unhalt:
+    swd_bus_unlock(rpu_swd_dev);
     atomic_inc(&open_lock);
 
     return count;
@@ -350,24 +621,29 @@ static ssize_t rpu_flash_write(struct file *filp, struct kobject *kobj,
         struct bin_attribute *attr, char *buf, loff_t off, size_t count)
 {
     struct rproc_core *rc = rpu_swd_dev->rc;
-    struct core_mem *cm = rc->ci->cm;
 
     if(!atomic_dec_and_test(&open_lock)){
         atomic_inc(&open_lock);
         return -EBUSY;
     }
+    swd_bus_lock(rpu_swd_dev);
 
     if (rpu_status != RPU_STATUS_HALT)
         goto rpu_status_unhalt;
 
-    if (!cm->flash.attr)
-        count = flash_write_uni(rc, buf, off, count);
-    else
-        count = flash_write(rc, buf, off, count);
+    if (swd_session_get(rpu_swd_dev)) {
+        count = -ENODEV;
+        goto rpu_status_unhalt;
+    }
+
+    count = flash_write(rc, filp, buf, off, count);
 
     pr_info("%s [%s] finish\n",RPUDEV_NAME, __func__);
 
+    swd_session_put(rpu_swd_dev, false);
+
 rpu_status_unhalt:
+    swd_bus_unlock(rpu_swd_dev);
     atomic_inc(&open_lock);
 
     return count;
@@ -381,31 +657,37 @@ static struct bin_attribute rpu_flash_attr = {
     .write = rpu_flash_write,
 };
 
+// an urgent user of the bus, goes between the chunks of a flash download
 static ssize_t rpu_ram_read(struct file *filp, struct kobject *kobj,
         struct bin_attribute *attr, char *buf, loff_t off, size_t count)
 {
     struct rproc_core *rc = rpu_swd_dev->rc;
     struct core_mem *cm = rc->ci->cm;
 
-    if(!atomic_dec_and_test(&open_lock)){
-        atomic_inc(&open_lock);
-        return -EBUSY;
-    }
+    swd_bus_lock_urgent(rpu_swd_dev);
 
-    if (rpu_status != RPU_STATUS_HALT)
+    if ((rpu_status != RPU_STATUS_HALT) && !rpu_live)
         goto rpu_status_unhalt;
 
+    if (swd_session_get(rpu_swd_dev)) {
+        count = -ENODEV;
+        goto rpu_status_unhalt;
+    }
+
     pr_info("%s [%s] start\n",RPUDEV_NAME, __func__);
 
     if (_rpu_xxx_read(buf, cm->sram.base + off, count) < 0) {
         count = -1;
-        goto rpu_status_unhalt;
+        goto rpu_session_put;
     }
 
     pr_info("%s [%s] finish\n",RPUDEV_NAME, __func__);
 
+rpu_session_put:
+    swd_session_put(rpu_swd_dev, false);
+
 rpu_status_unhalt:
-    atomic_inc(&open_lock);
+    swd_bus_unlock(rpu_swd_dev);
 
     return count;
 }
@@ -424,12 +706,20 @@ static ssize_t rpu_ram_write(struct file *filp, struct kobject *kobj,
         atomic_inc(&open_lock);
         return -EBUSY;
     }
+    swd_bus_lock(rpu_swd_dev);
 
-    if (rpu_status != RPU_STATUS_HALT)
+    if ((rpu_status != RPU_STATUS_HALT) && !rpu_live)
         goto rpu_status_unhalt;
 
+    if (swd_session_get(rpu_swd_dev)) {
+        count = -ENODEV;
+        goto rpu_status_unhalt;
+    }
+
     pr_info("%s [%s] start\n",RPUDEV_NAME, __func__);
 
+    swd_exec_forget();
+
     pos = 0;
     len_to_write = count;
     do {
@@ -437,7 +727,7 @@ static ssize_t rpu_ram_write(struct file *filp, struct kobject *kobj,
         err = rc->write_ram(cm, &(buf[pos]), off + pos, len);
         if (err) {
             count = -1;
-            goto rpu_status_unhalt;
+            goto rpu_session_put;
         }
 
         len_to_write -= len;
@@ -446,7 +736,11 @@ static ssize_t rpu_ram_write(struct file *filp, struct kobject *kobj,
 
     pr_info("%s [%s] finish\n",RPUDEV_NAME, __func__);
 
+rpu_session_put:
+    swd_session_put(rpu_swd_dev, false);
+
 rpu_status_unhalt:
+    swd_bus_unlock(rpu_swd_dev);
     atomic_inc(&open_lock);
 
     return count;
@@ -464,9 +758,14 @@ static struct bin_attribute *rpu_bin_attrs[] = {
     &rpu_corename_attr,
     &rpu_meminfo_attr,
     &rpu_status_attr,
+    &rpu_monitor_attr,
     &rpu_control_attr,
+    &rpu_live_attr,
+    &rpu_link_attr,
+    &rpu_regs_attr,
     &rpu_ram_attr,
     &rpu_flash_attr,
+    &rpu_firmware_attr,
     NULL
 };
 
@@ -507,6 +806,7 @@ int rpu_sysfs_init(struct swd_device *swd_dev)
     rpu_dev->groups = rpu_dev_groups;
     rpu_dev->release = rpu_sysfs_release;
     rpu_swd_dev = swd_dev;
+    INIT_DELAYED_WORK(&rpu_wb.flush_work, flash_wb_flush_work);
 
     ret = dev_set_name(rpu_dev, RPUDEV_NAME);
     if (ret)
@@ -529,6 +829,11 @@ void rpu_sysfs_exit(struct swd_device *swd_dev)
 {
     pr_info("%s: [%s] start\n", RPUDEV_NAME, __func__);
 
+    cancel_delayed_work_sync(&rpu_wb.flush_work);
+    swd_bus_lock(swd_dev);
+    flash_wb_flush();
+    swd_bus_unlock(swd_dev);
+
     // kfree(rpu_dev);
 
     pr_info("%s: [%s] finished\n", RPUDEV_NAME, __func__);
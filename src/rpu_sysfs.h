@@ -12,4 +12,12 @@ int rpu_sysfs_init(struct swd_device *swd_dev);
 
 void rpu_sysfs_exit(struct swd_device *swd_dev);
 
+// commit the sector buffered by the flash attribute, caller holds the bus lock
+int rpu_flash_sync(void);
+
+// the core state seen by the monitor changed
+void rpu_status_notify(void);
+
+int rpu_flash_find_sector(struct core_mem *cm, u32 offset, u32 *start, u32 *size);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,541 @@
+#include <linux/module.h>
+#include <linux/bitops.h>
+
+#include "swd_bitstream.h"
+#include "swd_link.h"
+#include "swd_worker.h"
+
+#define SWD_BS_NAME "swd_bs"
+
+#define JTAG_TO_SWD_SEQ 0xE79E
+
+static struct swd_bs_transport *swd_bs_transport;
+
+// Streams are clocked by t from now on, NULL goes back to the gpio.
+void swd_bs_set_transport(struct swd_bs_transport *t)
+{
+    WRITE_ONCE(swd_bs_transport, t);
+
+    pr_info("%s: [%s] %d transport %s\n", SWD_BS_NAME, __func__, __LINE__, t ? t->name : "gpio");
+}
+
+void swd_bs_init(struct swd_bs *bs, struct swd_bs_op *ops, u16 max_ops)
+{
+    bs->nr_ops = 0;
+    bs->max_ops = max_ops;
+    bs->nr_reads = 0;
+    bs->overflow = false;
+    bs->posted = false;
+    bs->ops = ops;
+}
+
+static struct swd_bs_op *swd_bs_add(struct swd_bs *bs, u8 type)
+{
+    struct swd_bs_op *op;
+
+    if (bs->nr_ops == bs->max_ops) {
+        bs->overflow = true;
+        return NULL;
+    }
+
+    op = &bs->ops[bs->nr_ops++];
+    op->type = type;
+    op->nbits = 0;
+    op->slot = 0;
+    op->bits = 0;
+
+    return op;
+}
+
+// Append bits driven by the host, merged into the last OUT run if it has room.
+void swd_bs_raw(struct swd_bs *bs, u64 bits, u8 nbits)
+{
+    u8 len;
+    struct swd_bs_op *op;
+
+    while (nbits) {
+        op = bs->nr_ops ? &bs->ops[bs->nr_ops - 1] : NULL;
+        if (!op || (op->type != SWD_BS_OUT) || (op->nbits == 64)) {
+            op = swd_bs_add(bs, SWD_BS_OUT);
+            if (!op)
+                return;
+        }
+
+        len = min_t(u8, nbits, 64 - op->nbits);
+        op->bits |= (len == 64 ? bits : bits & (BIT_ULL(len) - 1)) << op->nbits;
+        op->nbits += len;
+
+        bits = (len == 64) ? 0 : bits >> len;
+        nbits -= len;
+    }
+}
+
+void swd_bs_idle(struct swd_bs *bs)
+{
+    swd_bs_raw(bs, 0, SWD_BS_IDLE_BITS);
+}
+
+// more than 50 cycles with swdio high, then idle
+void swd_bs_line_reset(struct swd_bs *bs)
+{
+    swd_bs_raw(bs, U64_MAX, SWD_BS_LINE_RESET_BITS);
+    swd_bs_raw(bs, 0, 2);
+}
+
+void swd_bs_jtag_to_swd(struct swd_bs *bs)
+{
+    swd_bs_raw(bs, U64_MAX, SWD_BS_LINE_RESET_BITS);
+    swd_bs_raw(bs, JTAG_TO_SWD_SEQ, 16);
+    swd_bs_line_reset(bs);
+}
+
+// start, APnDP, RnW, A[2:3], parity, stop, park
+static u8 swd_bs_header(u8 apndp, u8 rnw, u8 reg)
+{
+    u8 req;
+
+    req = ((apndp == SWD_AP) << 1) | ((rnw == SWD_READ) << 2) | (((reg >> 2) & 0x3) << 3);
+    req |= (hweight8(req) & 0x1) << 5;
+
+    return req | BIT(0) | BIT(7);
+}
+
+// The header is a run of its own, so a WAIT can go back and send it again.
+static void swd_bs_request(struct swd_bs *bs, u8 apndp, u8 rnw, u8 reg)
+{
+    struct swd_bs_op *op;
+
+    op = swd_bs_add(bs, SWD_BS_HDR);
+    if (!op)
+        return;
+
+    op->bits = swd_bs_header(apndp, rnw, reg);
+    op->nbits = 8;
+
+    swd_bs_add(bs, bs->posted ? SWD_BS_ACK_POSTED : SWD_BS_ACK);
+}
+
+void swd_bs_write(struct swd_bs *bs, u8 apndp, u8 reg, u32 data)
+{
+    swd_bs_request(bs, apndp, SWD_WRITE, reg);
+    swd_bs_raw(bs, data | ((u64)(hweight32(data) & 0x1) << 32), 33);
+}
+
+// returns the rdata slot of the value read
+int swd_bs_read(struct swd_bs *bs, u8 apndp, u8 reg)
+{
+    struct swd_bs_op *op;
+
+    swd_bs_request(bs, apndp, SWD_READ, reg);
+
+    op = swd_bs_add(bs, SWD_BS_IN);
+    if (!op)
+        return -ENOSPC;
+
+    op->slot = bs->nr_reads++;
+
+    return op->slot;
+}
+
+static inline void swd_bs_clock(struct swd_gpio *sg)
+{
+    sg->SWCLK_SET(0);
+    sg->_delay();
+    sg->SWCLK_SET(1);
+    sg->_delay();
+}
+
+static inline int swd_bs_sample(struct swd_gpio *sg)
+{
+    int v;
+
+    sg->SWCLK_SET(0);
+    sg->_delay();
+    v = sg->SWDIO_GET();
+    sg->SWCLK_SET(1);
+    sg->_delay();
+
+    return v;
+}
+
+// Clock out the stream. Returns 0, -EAGAIN if the target kept answering
+// WAIT, or -EIO on FAULT, no answer or a parity error.
+int swd_bs_run(struct swd_gpio *sg, const struct swd_bs *bs, u32 *rdata)
+{
+    int i, j;
+    int ret = 0;
+    int retry = SWD_BS_RETRY;
+    int link_err = -1;
+    bool out = true;
+    u8 ack;
+    u32 data;
+    u64 bits;
+    const struct swd_bs_op *op;
+    struct swd_bs_transport *t;
+
+    if (bs->overflow)
+        return -ENOSPC;
+
+    // handed to the bus thread if there is one, it comes back here
+    ret = swd_worker_run(sg, bs, rdata);
+    if (ret != -EOPNOTSUPP)
+        return ret;
+    ret = 0;
+
+    t = READ_ONCE(swd_bs_transport);
+    if (t) {
+        ret = t->run(t, bs, rdata);
+        if (ret != -EOPNOTSUPP)
+            return ret;
+        ret = 0;
+    }
+
+    sg->signal_begin();
+    sg->SWDIO_DIR_OUT();
+
+    for (i = 0 ; i < bs->nr_ops ; i++) {
+        op = &bs->ops[i];
+
+        if ((op->type == SWD_BS_OUT) || (op->type == SWD_BS_HDR)) {
+            // let interrupts in between transactions of a long stream
+            if ((op->type == SWD_BS_HDR) && i) {
+                sg->signal_end();
+                sg->signal_begin();
+            }
+
+            // turnaround, then drive
+            if (!out) {
+                swd_bs_clock(sg);
+                sg->SWDIO_DIR_OUT();
+                out = true;
+            }
+
+            bits = op->bits;
+            for (j = 0 ; j < op->nbits ; j++) {
+                sg->SWDIO_SET(bits & 0x1);
+                bits >>= 1;
+                swd_bs_clock(sg);
+            }
+            continue;
+        }
+
+        // release the line, then turnaround
+        if (out) {
+            sg->SWDIO_DIR_IN();
+            swd_bs_clock(sg);
+            out = false;
+        }
+
+        if ((op->type == SWD_BS_ACK) || (op->type == SWD_BS_ACK_POSTED)) {
+            ack = swd_bs_sample(sg);
+            ack |= swd_bs_sample(sg) << 1;
+            ack |= swd_bs_sample(sg) << 2;
+            if ((ack == SWD_OK) || (op->type == SWD_BS_ACK_POSTED))
+                continue;
+
+            // send the header again, it is the previous op
+            if ((ack == SWD_WAIT) && retry--) {
+                i -= 2;
+                continue;
+            }
+
+            if ((ack != SWD_WAIT) && (ack != SWD_FAULT))
+                link_err = SWD_LINK_NOACK;
+
+            ret = (ack == SWD_WAIT) ? -EAGAIN : -EIO;
+            break;
+        }
+
+        data = 0;
+        for (j = 0 ; j < 32 ; j++)
+            data |= (u32)swd_bs_sample(sg) << j;
+
+        // keep clocking, a posted stream must reach its end
+        if ((hweight32(data) & 0x1) != swd_bs_sample(sg)) {
+            link_err = SWD_LINK_PARITY;
+            ret = -EIO;
+        }
+
+        rdata[op->slot] = data;
+    }
+
+    if (!out) {
+        swd_bs_clock(sg);
+        sg->SWDIO_DIR_OUT();
+    }
+
+    sg->signal_end();
+
+    // one report per stream, the clock changes between streams only
+    if (link_err >= 0)
+        swd_link_error(link_err);
+    else if (!ret)
+        swd_link_ok();
+
+    if (ret)
+        pr_err("%s: [%s] %d stream failed at op %d ret:%d\n", SWD_BS_NAME, __func__, __LINE__, i, ret);
+
+    return ret;
+}
+
+#define SWD_BS_BLOCK_UNITS      128     // posted writes per stream
+#define SWD_BS_BLOCK_OPS        (SWD_BS_BLOCK_UNITS * 4 + 32)
+#define SWD_BS_BLOCK_RETRY      8
+
+#define SWD_BS_READ_UNITS       128     // words read per stream
+// SELECT, CSW, TAR, the AP reads with the one starting the pipeline and
+// RDBUFF, 3 ops each, then the idle
+#define SWD_BS_READ_OPS         ((3 + SWD_BS_READ_UNITS + 1) * 3 + 1)
+
+static struct swd_bs_op swd_bs_block_ops[SWD_BS_BLOCK_OPS];
+static struct swd_bs_op swd_bs_read_ops[SWD_BS_READ_OPS];
+static u32 swd_bs_read_rdata[SWD_BS_READ_UNITS + 1];
+static struct swd_bs_op swd_bs_tar_ops[16];
+static struct swd_bs swd_bs_tar_bs;
+
+// Posted writes of units [addr, addr + nr * step), data taken from the
+// word of from holding each unit, from needs not be aligned. The sticky flags are read at the end.
+static void swd_bs_block_compile(struct swd_bs *bs, u32 base, const u8 *from,
+        u32 addr, u32 nr, u32 step, u32 csw, u8 idle)
+{
+    u32 i;
+    u32 data;
+
+    swd_bs_init(bs, swd_bs_block_ops, ARRAY_SIZE(swd_bs_block_ops));
+
+    swd_bs_write(bs, SWD_DP, SWD_DP_ABORT_REG, SWD_ABORT_CLR_ALL);
+    swd_bs_write(bs, SWD_DP, SWD_DP_CTRLSTAT_REG, SWD_CTRLSTAT_PWRUP | SWD_CTRLSTAT_ORUNDETECT);
+
+    swd_bs_set_posted(bs, true);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_CSW_REG & 0xC, csw);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, addr);
+
+    // a halfword/byte lands on the lanes of its address, the whole word
+    // can be sent for each of them
+    for (i = 0 ; i < nr ; i++) {
+        memcpy(&data, from + ALIGN_DOWN(addr - base + i * step, sizeof(u32)), sizeof(u32));
+        swd_bs_write(bs, SWD_AP, SWD_AP_DRW_REG & 0xC, data);
+        if (idle)
+            swd_bs_raw(bs, 0, idle);
+    }
+
+    // RDBUFF waits for the last write, then the sticky flags
+    swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+    swd_bs_read(bs, SWD_DP, SWD_DP_CTRLSTAT_REG);
+    swd_bs_write(bs, SWD_DP, SWD_DP_CTRLSTAT_REG, SWD_CTRLSTAT_PWRUP);
+    swd_bs_idle(bs);
+}
+
+// clear the errors and ORUNDETECT, read back TAR, where the transfer has to go on.
+// A target which kept answering WAIT has its AP transaction aborted first.
+static int swd_bs_block_tar(struct swd_gpio *sg, u32 *tar, bool abort)
+{
+    int ret;
+    u32 rdata[2];
+    struct swd_bs *bs = &swd_bs_tar_bs;
+
+    if (abort) {
+        _swd_send(sg, SWD_DP, SWD_WRITE, SWD_DP_ABORT_REG, SWD_ABORT_DAPABORT, false);
+        pr_info("%s: [%s] %d DAPABORT\n", SWD_BS_NAME, __func__, __LINE__);
+    }
+
+    if (!bs->ops) {
+        swd_bs_init(bs, swd_bs_tar_ops, ARRAY_SIZE(swd_bs_tar_ops));
+        swd_bs_write(bs, SWD_DP, SWD_DP_ABORT_REG, SWD_ABORT_CLR_ALL);
+        swd_bs_write(bs, SWD_DP, SWD_DP_CTRLSTAT_REG, SWD_CTRLSTAT_PWRUP);
+        swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+        swd_bs_read(bs, SWD_AP, SWD_AP_TAR_REG & 0xC);
+        swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+        swd_bs_idle(bs);
+    }
+
+    ret = swd_bs_run(sg, bs, rdata);
+    if (ret)
+        return ret;
+
+    *tar = rdata[1];
+
+    return 0;
+}
+
+// Write len bytes at base by streams of posted writes, csw gives the access
+// size, idle bits follow each write for slow targets (i.e. flash).
+// On an overrun the errors are cleared and the transfer resumes at TAR,
+// it gives up after SWD_BS_BLOCK_RETRY failures without progress.
+// Caller must hold the bus lock.
+int swd_bs_write_block(struct swd_gpio *sg, u32 base, const void *from, u32 len, u32 csw, u8 idle)
+{
+    int ret;
+    int retry = SWD_BS_BLOCK_RETRY;
+    u32 addr = base;
+    u32 end = base + len;
+    // packed increment moves TAR by a word for each DRW access
+    u32 step = ((csw & 0x30) == 0x20) ? sizeof(u32) : 1 << (csw & 0x7);
+    u32 nr;
+    u32 units;
+    u32 tar;
+    u32 rdata[2];
+    struct swd_bs bs;
+
+    if ((base | len) & (step - 1))
+        return -EINVAL;
+
+    // header, ack and data+parity take 3 ops, long idles more
+    units = min_t(u32, SWD_BS_BLOCK_UNITS, (SWD_BS_BLOCK_OPS - 32) / (3 + DIV_ROUND_UP(idle, 64)));
+
+    while (addr < end) {
+        // TAR only auto increments within 1KB
+        nr = min(end - addr, SWD_TAR_WRAP - (addr & (SWD_TAR_WRAP - 1))) / step;
+        nr = min_t(u32, nr, units);
+
+        swd_bs_block_compile(&bs, base, from, addr, nr, step, csw, idle);
+        ret = swd_bs_run(sg, &bs, rdata);
+        if (!ret && !(rdata[1] & SWD_CTRLSTAT_STICKY)) {
+            addr += nr * step;
+            continue;
+        }
+
+        if (!retry--) {
+            pr_err("%s: [%s] %d giving up at %08x\n", SWD_BS_NAME, __func__, __LINE__, addr);
+            return -EIO;
+        }
+
+        ret = swd_bs_block_tar(sg, &tar, ret == -EAGAIN);
+        if (ret)
+            return ret;
+
+        pr_info("%s: [%s] %d ctrlstat:%08x resume at %08x\n", SWD_BS_NAME, __func__, __LINE__, rdata[1], tar);
+
+        // what is before TAR is written, otherwise start the stream again
+        if ((tar > addr) && (tar <= addr + nr * step) && !(tar & (step - 1))) {
+            addr = tar;
+            retry = SWD_BS_BLOCK_RETRY;
+        }
+    }
+
+    return 0;
+}
+
+// len < 4 is at most two units (byte + halfword or halfword + byte). Each
+// write and read is 3 ops: SELECT, then CSW, TAR, DRW, RDBUFF per unit for
+// a read, then CSW back, the idle merged into its data run.
+#define SWD_BS_SUB_UNITS        2
+#define SWD_BS_SUB_OPS          (3 + SWD_BS_SUB_UNITS * 4 * 3 + 3)
+
+static struct swd_bs_op swd_bs_sub_ops[SWD_BS_SUB_OPS];
+
+// Read len bytes at base by streams of pipelined AP reads, base and len
+// word aligned. The first AP read of a stream returns nothing of it, each
+// one after returns the word before and RDBUFF the last. A failed stream
+// is read again once the errors are cleared, it gives up after
+// SWD_BS_BLOCK_RETRY failures without progress.
+// Caller must hold the bus lock.
+int swd_bs_read_block(struct swd_gpio *sg, void *to, u32 base, u32 len, u32 csw)
+{
+    int ret;
+    int retry = SWD_BS_BLOCK_RETRY;
+    u32 i;
+    u32 nr;
+    u32 tar;
+    u32 addr = base;
+    u32 end = base + len;
+    u8 *p = to;
+    struct swd_bs bs;
+
+    if ((base | len) & 0x3)
+        return -EINVAL;
+
+    while (addr < end) {
+        // TAR only auto increments within 1KB
+        nr = min(end - addr, SWD_TAR_WRAP - (addr & (SWD_TAR_WRAP - 1))) / sizeof(u32);
+        nr = min_t(u32, nr, SWD_BS_READ_UNITS);
+
+        swd_bs_init(&bs, swd_bs_read_ops, ARRAY_SIZE(swd_bs_read_ops));
+        swd_bs_write(&bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+        swd_bs_write(&bs, SWD_AP, SWD_AP_CSW_REG & 0xC, csw);
+        swd_bs_write(&bs, SWD_AP, SWD_AP_TAR_REG & 0xC, addr);
+        for (i = 0 ; i < nr ; i++)
+            swd_bs_read(&bs, SWD_AP, SWD_AP_DRW_REG & 0xC);
+        swd_bs_read(&bs, SWD_DP, SWD_DP_RDBUFF_REG);
+        swd_bs_idle(&bs);
+
+        ret = swd_bs_run(sg, &bs, swd_bs_read_rdata);
+        if (!ret) {
+            // slot 0 is whatever was read before the stream
+            memcpy(p + (addr - base), &swd_bs_read_rdata[1], nr * sizeof(u32));
+            addr += nr * sizeof(u32);
+            retry = SWD_BS_BLOCK_RETRY;
+            continue;
+        }
+
+        if (!retry--) {
+            pr_err("%s: [%s] %d giving up at %08x\n", SWD_BS_NAME, __func__, __LINE__, addr);
+            return -EIO;
+        }
+
+        ret = swd_bs_block_tar(sg, &tar, ret == -EAGAIN);
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
+// Byte/halfword accesses of [addr, addr + len), len < 4, so the bytes around
+// are not read and written back. The MEM-AP is left with csw.
+// Caller must hold the bus lock.
+int swd_bs_access_sub(struct swd_gpio *sg, void *buf, u32 addr, u32 len, u32 csw, bool write)
+{
+    int i;
+    int ret;
+    int nr = 0;
+    int slot[SWD_BS_SUB_UNITS];
+    u8 *p = buf;
+    u32 a;
+    u32 n;
+    u32 data;
+    u32 unit[SWD_BS_SUB_UNITS];
+    u32 rdata[SWD_BS_SUB_UNITS * 2];
+    struct swd_bs bs;
+
+    if (!len || (len >= sizeof(u32)))
+        return -EINVAL;
+
+    swd_bs_init(&bs, swd_bs_sub_ops, ARRAY_SIZE(swd_bs_sub_ops));
+    swd_bs_write(&bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+
+    // halfword where aligned, byte otherwise, at most two units
+    for (a = addr ; a < addr + len ; a += n) {
+        n = ((a & 0x1) || (addr + len - a == 1)) ? 1 : 2;
+        unit[nr] = n;
+
+        swd_bs_write(&bs, SWD_AP, SWD_AP_CSW_REG & 0xC, (csw & ~0x37) | (n >> 1));
+        swd_bs_write(&bs, SWD_AP, SWD_AP_TAR_REG & 0xC, a);
+        if (write) {
+            // the unit goes on the byte lanes of its address
+            data = 0;
+            for (i = 0 ; i < n ; i++)
+                data |= (u32)p[a - addr + i] << (((a + i) & 0x3) * 8);
+            swd_bs_write(&bs, SWD_AP, SWD_AP_DRW_REG & 0xC, data);
+        } else {
+            swd_bs_read(&bs, SWD_AP, SWD_AP_DRW_REG & 0xC);
+            slot[nr] = swd_bs_read(&bs, SWD_DP, SWD_DP_RDBUFF_REG);
+        }
+        nr++;
+    }
+
+    swd_bs_write(&bs, SWD_AP, SWD_AP_CSW_REG & 0xC, csw);
+    swd_bs_idle(&bs);
+
+    ret = swd_bs_run(sg, &bs, rdata);
+    if (ret || write)
+        return ret;
+
+    for (a = addr, nr = 0 ; a < addr + len ; a += unit[nr++]) {
+        for (i = 0 ; i < unit[nr] ; i++)
+            p[a - addr + i] = rdata[slot[nr]] >> (((a + i) & 0x3) * 8);
+    }
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#ifndef SWD_BITSTREAM_H
+#define SWD_BITSTREAM_H
+
+#include <linux/types.h>
+
+#include "swd_gpio/swd_gpio.h"
+
+// A bitstream is a fixed sequence of swd transactions encoded once:
+// header, parity, data and idle bits are packed in OUT/HDR runs, the target
+// driven slots are ACK (turnaround + 3 bits, checked while clocking) and
+// IN (32 data bits + parity, saved to rdata[slot]).
+// Posted transactions get ACK_POSTED slots which are not checked.
+enum SWD_BS_OP_TYPE {
+    SWD_BS_OUT = 0,
+    SWD_BS_HDR,     // OUT run holding a request header, a transaction starts
+    SWD_BS_ACK,
+    SWD_BS_ACK_POSTED,  // clocked only, with ORUNDETECT the data phase always follows
+    SWD_BS_IN,
+};
+
+struct swd_bs_op {
+    u8 type;
+    u8 nbits;       // OUT/HDR: bits to drive
+    u16 slot;       // IN: index in rdata
+    u64 bits;       // OUT/HDR: driven LSB first
+};
+
+struct swd_bs {
+    u16 nr_ops;
+    u16 max_ops;
+    u16 nr_reads;   // IN slots, size of rdata for swd_bs_run()
+    bool overflow;  // ran out of ops while compiling
+    bool posted;    // transactions added now get ACK_POSTED slots
+    struct swd_bs_op *ops;
+};
+
+// Another way to clock a stream out, i.e. an spi controller.
+// run returns like swd_bs_run(), or -EOPNOTSUPP to fall back to the gpio.
+struct swd_bs_transport {
+    const char *name;
+    int (*run)(struct swd_bs_transport *t, const struct swd_bs *bs, u32 *rdata);
+};
+
+#define SWD_DP_ABORT_REG        0x0
+#define SWD_ABORT_CLR_ALL       0x1E    // ORUNERRCLR | WDERRCLR | STKERRCLR | STKCMPCLR
+#define SWD_ABORT_DAPABORT      0x1     // cancels the AP transaction stuck in WAIT
+#define SWD_CTRLSTAT_PWRUP      (BIT(30) | BIT(28))
+#define SWD_CTRLSTAT_ORUNDETECT BIT(0)
+#define SWD_CTRLSTAT_STICKY     (BIT(1) | BIT(5) | BIT(7))  // STICKYORUN | STICKYERR | WDATAERR
+#define SWD_MEMAP_CSW           0x23000012  // 32-bit privileged data accesses, TAR auto increment
+#define SWD_MEMAP_BD(reg)       (0x10 + ((reg) & 0xC))  // banked data register of reg, AP bank 0x10
+#define SWD_TAR_WRAP            0x400   // TAR auto increment wraps at 1KB
+
+#define SWD_BS_LINE_RESET_BITS  56
+#define SWD_BS_IDLE_BITS        8
+#define SWD_BS_RETRY            100     // WAIT retries of one stream
+
+void swd_bs_init(struct swd_bs *bs, struct swd_bs_op *ops, u16 max_ops);
+
+void swd_bs_raw(struct swd_bs *bs, u64 bits, u8 nbits);
+
+void swd_bs_idle(struct swd_bs *bs);
+
+void swd_bs_line_reset(struct swd_bs *bs);
+
+void swd_bs_jtag_to_swd(struct swd_bs *bs);
+
+void swd_bs_write(struct swd_bs *bs, u8 apndp, u8 reg, u32 data);
+
+int swd_bs_read(struct swd_bs *bs, u8 apndp, u8 reg);
+
+// With CTRL/STAT.ORUNDETECT set the target always expects the data phase,
+// so ACKs can be left unchecked and the sticky flags read at the end.
+static inline void swd_bs_set_posted(struct swd_bs *bs, bool posted)
+{
+    bs->posted = posted;
+}
+
+int swd_bs_run(struct swd_gpio *sg, const struct swd_bs *bs, u32 *rdata);
+
+void swd_bs_set_transport(struct swd_bs_transport *t);
+
+int swd_bs_write_block(struct swd_gpio *sg, u32 base, const void *from, u32 len, u32 csw, u8 idle);
+
+int swd_bs_read_block(struct swd_gpio *sg, void *to, u32 base, u32 len, u32 csw);
+
+int swd_bs_access_sub(struct swd_gpio *sg, void *buf, u32 addr, u32 len, u32 csw, bool write);
+
+// Bytes at addr to access by swd_bs_access_sub(), the unaligned head or the
+// short tail, 0 when a word burst can go on.
+static inline u32 swd_bs_sub_len(u32 addr, u32 len)
+{
+    u32 head = (sizeof(u32) - (addr & 0x3)) & 0x3;
+
+    if (head)
+        return min(len, head);
+
+    return (len < sizeof(u32)) ? len : 0;
+}
+
+#endif
@@ -0,0 +1,226 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/jump_label.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+
+#include "swd_drv.h"
+#include "swd_capture.h"
+#include "swd_debugfs.h"
+#include "swd_gpio/swd_gpio.h"
+#include "../include/swd_module.h"
+
+#define CAPTURE_NAME "swd_capture"
+
+#define CAP_RING_SIZE       65536   // records, power of 2
+#define CAP_DATA_BITS       33      // data and parity
+#define CAP_NOACK           0x7
+
+// Every transaction is decoded from the bits clocked on the gpio, so the
+// accesses of the swd_gpio submodule are seen as well as the bitstreams.
+// A header is 8 driven bits: start, APnDP, RnW, A[3:2], parity, stop, park.
+enum CAP_STATE {
+    CAP_IDLE = 0,   // looking for a header
+    CAP_TRN,        // turnaround after the header
+    CAP_ACK,
+    CAP_WTRN,       // turnaround before the write data
+    CAP_DATA,
+};
+
+DEFINE_STATIC_KEY_FALSE(swd_capture_key);
+struct swd_capture_line swd_cap_line;
+
+// the decoder runs in the bit banging context, the bus lock held
+static struct {
+    u8 state;
+    u8 nbits;
+    u8 window;          // last 8 bits driven in CAP_IDLE
+    u64 bits;
+    u64 t_prev;
+    u8 last_request;
+    u8 waits;           // WAIT acks of last_request in a row
+    bool dropped;
+    struct swd_cap_rec rec;
+} cap;
+
+static struct {
+    struct swd_device *sd;
+    struct swd_dbg_enable enable;
+    spinlock_t ring_lock;
+    struct swd_dbg_ring ring;   // struct swd_cap_rec
+    u64 records;
+    u64 dropped;
+    struct dentry *dir;
+} capture;
+
+static bool cap_header(u8 w)
+{
+    return ((w & 0xC1) == 0x81) && (((hweight8(w & 0x1E) & 0x1) << 5) == (w & 0x20));
+}
+
+static void cap_push(u64 now)
+{
+    struct swd_cap_rec *rec = &cap.rec;
+
+    rec->duration_ns = now - cap.t_prev;
+
+    // WAITs of the same request in a row are its retries
+    if (cap.waits && (rec->request == cap.last_request))
+        rec->retry = min_t(u32, cap.waits, 0xFF);
+    cap.waits = (rec->ack == SWD_WAIT) ? cap.waits + 1 : 0;
+    cap.last_request = rec->request;
+
+    spin_lock(&capture.ring_lock);
+    if (cap.dropped)
+        rec->flags |= SWD_CAP_DROPPED;
+    if (swd_dbg_ring_push(&capture.ring, rec)) {
+        cap.dropped = false;
+        capture.records++;
+    } else {
+        capture.dropped++;
+        cap.dropped = true;
+    }
+    spin_unlock(&capture.ring_lock);
+
+    cap.state = CAP_IDLE;
+    cap.window = 0;
+}
+
+void swd_capture_clock(void)
+{
+    u64 now;
+    u8 bit = swd_cap_line.in ? swd_cap_line.sampled : swd_cap_line.out;
+
+    switch (cap.state) {
+    case CAP_IDLE:
+        if (swd_cap_line.in) {
+            cap.window = 0;
+            break;
+        }
+
+        cap.window = (cap.window >> 1) | (bit << 7);
+        if (!cap_header(cap.window))
+            break;
+
+        now = ktime_get_ns();
+        memset(&cap.rec, 0, sizeof(cap.rec));
+        cap.rec.delta_ns = min_t(u64, now - cap.t_prev, U32_MAX);
+        cap.rec.request = (cap.window >> 1) & 0xF;
+        cap.t_prev = now;
+        cap.state = CAP_TRN;
+        break;
+
+    case CAP_TRN:
+        // a header shaped pattern not followed by the target driving
+        cap.state = swd_cap_line.in ? CAP_ACK : CAP_IDLE;
+        cap.nbits = 0;
+        cap.window = 0;
+        break;
+
+    case CAP_ACK:
+        cap.rec.ack |= bit << cap.nbits;
+        if (++cap.nbits < 3)
+            break;
+
+        cap.nbits = 0;
+        cap.bits = 0;
+        if (cap.rec.ack != SWD_OK) {
+            cap.rec.flags |= SWD_CAP_NO_DATA;
+            cap_push(ktime_get_ns());
+        } else {
+            cap.state = (cap.rec.request & SWD_DAP_RNW) ? CAP_DATA : CAP_WTRN;
+        }
+        break;
+
+    case CAP_WTRN:
+        cap.state = CAP_DATA;
+        break;
+
+    case CAP_DATA:
+        cap.bits |= (u64)bit << cap.nbits;
+        if (++cap.nbits < CAP_DATA_BITS)
+            break;
+
+        cap.rec.data = (u32)cap.bits;
+        if ((hweight32(cap.rec.data) & 0x1) != (cap.bits >> 32))
+            cap.rec.flags |= SWD_CAP_PARITY_ERR;
+        cap_push(ktime_get_ns());
+        break;
+    }
+}
+
+// Switched only between transactions, with the bus lock held.
+static int cap_enable(void *priv, bool enable)
+{
+    struct swd_device *sd = capture.sd;
+
+    if (enable && !capture.ring.recs) {
+        capture.ring.recs = vmalloc(CAP_RING_SIZE * sizeof(struct swd_cap_rec));
+        if (!capture.ring.recs)
+            return -ENOMEM;
+    }
+
+    swd_bus_lock(sd);
+    if (enable) {
+        memset(&cap, 0, sizeof(cap));
+        cap.t_prev = ktime_get_ns();
+        swd_cap_line.in = false;
+        swd_cap_line.out = 1;
+        static_branch_enable(&swd_capture_key);
+    } else {
+        static_branch_disable(&swd_capture_key);
+    }
+    swd_bus_unlock(sd);
+
+    pr_info("%s: [%s] %d capture %s\n", CAPTURE_NAME, __func__, __LINE__, enable ? "on" : "off");
+
+    return 0;
+}
+
+static int cap_stats_show(struct seq_file *m, void *v)
+{
+    u64 records, dropped;
+    u32 pending;
+
+    spin_lock_irq(&capture.ring_lock);
+    records = capture.records;
+    dropped = capture.dropped;
+    pending = swd_dbg_ring_pending(&capture.ring);
+    spin_unlock_irq(&capture.ring_lock);
+
+    seq_printf(m, "records: %llu\ndropped: %llu\npending: %u\n", records, dropped, pending);
+
+    return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(cap_stats);
+
+int swd_capture_init(struct swd_device *sd)
+{
+    capture.sd = sd;
+    swd_dbg_enable_init(&capture.enable, cap_enable, NULL);
+    spin_lock_init(&capture.ring_lock);
+    swd_dbg_ring_init(&capture.ring, &capture.ring_lock, sizeof(struct swd_cap_rec), CAP_RING_SIZE);
+
+    // no debugfs is not an error, the capture is just not there
+    capture.dir = debugfs_create_dir("capture", sd->debugfs);
+    swd_dbg_enable_create("enable", capture.dir, &capture.enable);
+    // records as struct swd_cap_rec in the order taken
+    swd_dbg_ring_create("data", capture.dir, &capture.ring);
+    debugfs_create_file("stats", 0444, capture.dir, NULL, &cap_stats_fops);
+
+    return 0;
+}
+
+void swd_capture_exit(struct swd_device *sd)
+{
+    debugfs_remove_recursive(capture.dir);
+
+    swd_dbg_enable_set(&capture.enable, false);
+
+    vfree(capture.ring.recs);
+    capture.ring.recs = NULL;
+}
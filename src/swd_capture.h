@@ -0,0 +1,31 @@
+#ifndef SWD_CAPTURE_H
+#define SWD_CAPTURE_H
+
+#include <linux/jump_label.h>
+
+#include "swd_drv.h"
+
+// swdio as the gpio callbacks left it, updated only while capturing
+struct swd_capture_line {
+    bool in;        // the target drives swdio
+    u8 out;         // level driven by the host
+    u8 sampled;     // level read last
+};
+
+DECLARE_STATIC_KEY_FALSE(swd_capture_key);
+extern struct swd_capture_line swd_cap_line;
+
+// patched out while the capture is off, the bit banging keeps its timing
+static inline bool swd_capture_on(void)
+{
+    return static_branch_unlikely(&swd_capture_key);
+}
+
+// rising edge of SWCLK, the bit on swdio is decoded
+void swd_capture_clock(void);
+
+int swd_capture_init(struct swd_device *sd);
+
+void swd_capture_exit(struct swd_device *sd);
+
+#endif
@@ -0,0 +1,269 @@
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "swd_drv.h"
+#include "swd_dap.h"
+#include "swd_bitstream.h"
+#include "swd_link.h"
+#include "../include/swd_module.h"
+
+#define SWD_DAP_NAME "swd_dap"
+
+#define SWD_DAP_MATCH_RETRY     100
+#define SWD_DAP_REQ_MSK         0x3F
+
+// SELECT and CSW as the tool left them, written again before its next
+// batch. In between the driver uses its own MEM-AP setup.
+static struct {
+    bool select_valid;
+    u32 select;
+    bool csw_valid;
+    u32 csw_apsel;      // SELECT.APSEL the csw belongs to
+    u32 csw;
+} swd_dap_shadow;
+
+// one access, WAIT is retried
+static u8 swd_dap_access(struct swd_gpio *sg, u8 apndp, u8 rnw, u8 reg, u32 *data)
+{
+    u8 ack;
+    int retry = SWD_BS_RETRY;
+
+    do {
+        if (rnw == SWD_READ)
+            ack = _swd_read(sg, apndp, SWD_READ, reg, data, true);
+        else
+            ack = _swd_send(sg, apndp, SWD_WRITE, reg, *data, true);
+    } while ((ack == SWD_WAIT) && retry--);
+
+    if ((ack != SWD_OK) && (ack != SWD_WAIT) && (ack != SWD_FAULT)) {
+        swd_link_error(SWD_LINK_NOACK);
+        return SWD_DAP_ACK_NOACK;
+    }
+
+    if (ack == SWD_OK)
+        swd_link_ok();
+
+    return ack;
+}
+
+// AP reads are posted, each one returns the value of the one before it
+// and RDBUFF the last, so a block is n + 1 accesses.
+static u8 swd_dap_read(struct swd_gpio *sg, u8 apndp, u8 reg, u32 *to, u32 n)
+{
+    u8 ack;
+    u32 i;
+    u32 data;
+
+    if (apndp == SWD_DP) {
+        for (i = 0 ; i < n ; i++) {
+            ack = swd_dap_access(sg, SWD_DP, SWD_READ, reg, &to[i]);
+            if (ack != SWD_OK)
+                return ack;
+        }
+        return SWD_OK;
+    }
+
+    ack = swd_dap_access(sg, SWD_AP, SWD_READ, reg, &data);
+    for (i = 1 ; (i < n) && (ack == SWD_OK) ; i++)
+        ack = swd_dap_access(sg, SWD_AP, SWD_READ, reg, &to[i - 1]);
+
+    if (ack != SWD_OK)
+        return ack;
+
+    return swd_dap_access(sg, SWD_DP, SWD_READ, SWD_DP_RDBUFF_REG, &to[n - 1]);
+}
+
+// The ack of an AP write only says the write was taken, the bus access
+// completes later. RDBUFF waits for it, the sticky flags of CTRL/STAT
+// tell whether it failed. CTRL/STAT is left out while the tool has
+// another DP bank selected.
+static u8 swd_dap_confirm(struct swd_gpio *sg)
+{
+    u8 ack;
+    u32 data;
+
+    ack = swd_dap_access(sg, SWD_DP, SWD_READ, SWD_DP_RDBUFF_REG, &data);
+    if (ack != SWD_OK)
+        return ack;
+
+    if (swd_dap_shadow.select_valid && (swd_dap_shadow.select & 0xF))
+        return SWD_OK;
+
+    ack = swd_dap_access(sg, SWD_DP, SWD_READ, SWD_DP_CTRLSTAT_REG, &data);
+    if (ack != SWD_OK)
+        return ack;
+
+    return (data & SWD_CTRLSTAT_STICKY) ? SWD_FAULT : SWD_OK;
+}
+
+static u8 swd_dap_write(struct swd_gpio *sg, u8 apndp, u8 reg, const u32 *from, u32 n)
+{
+    u8 ack;
+    u32 i;
+    u32 data;
+
+    for (i = 0 ; i < n ; i++) {
+        data = from[i];
+        ack = swd_dap_access(sg, apndp, SWD_WRITE, reg, &data);
+        if (ack != SWD_OK)
+            return ack;
+
+        // remember what the tool selected for its next batch
+        if ((apndp == SWD_DP) && (reg == SWD_DP_SELECT_REG)) {
+            swd_dap_shadow.select = data;
+            swd_dap_shadow.select_valid = true;
+        } else if ((apndp == SWD_AP) && (reg == (SWD_AP_CSW_REG & 0xC)) && \
+                   swd_dap_shadow.select_valid && !(swd_dap_shadow.select & 0xF0)) {
+            swd_dap_shadow.csw_apsel = swd_dap_shadow.select & 0xFF000000;
+            swd_dap_shadow.csw = data;
+            swd_dap_shadow.csw_valid = true;
+        }
+    }
+
+    return (apndp == SWD_AP) ? swd_dap_confirm(sg) : SWD_OK;
+}
+
+static u8 swd_dap_match(struct swd_gpio *sg, u8 apndp, u8 reg, u32 mask, u32 value, u32 retry)
+{
+    u8 ack;
+    u32 data;
+
+    do {
+        ack = swd_dap_read(sg, apndp, reg, &data, 1);
+        if (ack != SWD_OK)
+            return ack;
+
+        if ((data & mask) == value)
+            return SWD_OK;
+    } while (--retry);
+
+    return SWD_OK | SWD_DAP_ACK_MISMATCH;
+}
+
+static void swd_dap_shadow_apply(struct swd_gpio *sg)
+{
+    if (swd_dap_shadow.csw_valid) {
+        _swd_send(sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, swd_dap_shadow.csw_apsel, true);
+        _swd_send(sg, SWD_AP, SWD_WRITE, SWD_AP_CSW_REG & 0xC, swd_dap_shadow.csw, true);
+    }
+
+    if (swd_dap_shadow.select_valid)
+        _swd_send(sg, SWD_DP, SWD_WRITE, SWD_DP_SELECT_REG, swd_dap_shadow.select, true);
+}
+
+// Run the entries in order until one does not get an OK ack or its value
+// never matches. The result is in done, nr_read and ack, the return value
+// is only for a bad argument. Caller must hold the bus lock.
+long swd_dap_transfer(struct swd_device *sd, struct swd_dap_transfer __user *arg)
+{
+    long ret = 0;
+    u8 ack = SWD_OK;
+    u8 apndp;
+    u8 reg;
+    u32 i;
+    u32 n;
+    u32 nr_write = 0;
+    u32 mask = 0xFFFFFFFF;
+    u32 *rdata = NULL;
+    u32 *wdata = NULL;
+    struct swd_dap_xfer *xfers;
+    struct swd_dap_xfer *x;
+    struct swd_dap_transfer t;
+    struct swd_gpio *sg = sd->sg;
+
+    if (copy_from_user(&t, arg, sizeof(t)))
+        return -EFAULT;
+
+    if (!t.nr_xfers || (t.nr_xfers > SWD_DAP_MAX_XFERS) || \
+        (t.nr_wdata > SWD_DAP_MAX_XFERS) || (t.nr_rdata > SWD_DAP_MAX_XFERS))
+        return -EINVAL;
+
+    xfers = memdup_user(u64_to_user_ptr(t.xfers), t.nr_xfers * sizeof(struct swd_dap_xfer));
+    if (IS_ERR(xfers))
+        return PTR_ERR(xfers);
+
+    if (t.nr_wdata) {
+        wdata = memdup_user(u64_to_user_ptr(t.wdata), t.nr_wdata * sizeof(u32));
+        if (IS_ERR(wdata)) {
+            ret = PTR_ERR(wdata);
+            wdata = NULL;
+            goto swd_dap_transfer_fail;
+        }
+    }
+
+    if (t.nr_rdata) {
+        rdata = kmalloc_array(t.nr_rdata, sizeof(u32), GFP_KERNEL);
+        if (!rdata) {
+            ret = -ENOMEM;
+            goto swd_dap_transfer_fail;
+        }
+    }
+
+    t.nr_read = 0;
+    swd_dap_shadow_apply(sg);
+
+    for (i = 0 ; i < t.nr_xfers ; i++) {
+        x = &xfers[i];
+        n = x->count ? x->count : 1;
+        apndp = (x->request & SWD_DAP_APNDP) ? SWD_AP : SWD_DP;
+        reg = x->request & SWD_DAP_A32;
+
+        if (x->request & ~SWD_DAP_REQ_MSK) {
+            ret = -EINVAL;
+            break;
+        }
+
+        if (x->request & SWD_DAP_MATCH_MASK) {
+            mask = x->data;
+        } else if (x->request & SWD_DAP_MATCH_VALUE) {
+            ack = swd_dap_match(sg, apndp, reg, mask, x->data,
+                                t.match_retry ? t.match_retry : SWD_DAP_MATCH_RETRY);
+        } else if (x->request & SWD_DAP_RNW) {
+            if (t.nr_read + n > t.nr_rdata) {
+                ret = -ENOSPC;
+                break;
+            }
+            ack = swd_dap_read(sg, apndp, reg, rdata + t.nr_read, n);
+            if (ack == SWD_OK)
+                t.nr_read += n;
+        } else if (n == 1) {
+            ack = swd_dap_write(sg, apndp, reg, &x->data, 1);
+        } else {
+            if (nr_write + n > t.nr_wdata) {
+                ret = -ENOSPC;
+                break;
+            }
+            ack = swd_dap_write(sg, apndp, reg, wdata + nr_write, n);
+            nr_write += n;
+        }
+
+        if (ack != SWD_OK)
+            break;
+    }
+
+    t.done = i;
+    t.ack = ack;
+
+    // back to the MEM-AP setup the driver's own accesses expect
+    if (sd->rc->setup_memap())
+        pr_err("%s: [%s] %d error with setup_memap\n", SWD_DAP_NAME, __func__, __LINE__);
+
+    if (ret)
+        goto swd_dap_transfer_fail;
+
+    if (t.nr_read && copy_to_user(u64_to_user_ptr(t.rdata), rdata, t.nr_read * sizeof(u32))) {
+        ret = -EFAULT;
+        goto swd_dap_transfer_fail;
+    }
+
+    if (copy_to_user(arg, &t, sizeof(t)))
+        ret = -EFAULT;
+
+swd_dap_transfer_fail:
+    kfree(rdata);
+    kfree(wdata);
+    kfree(xfers);
+
+    return ret;
+}
@@ -0,0 +1,9 @@
+#ifndef SWD_DAP_H
+#define SWD_DAP_H
+
+#include "swd_drv.h"
+#include "../include/swd_module.h"
+
+long swd_dap_transfer(struct swd_device *sd, struct swd_dap_transfer __user *arg);
+
+#endif
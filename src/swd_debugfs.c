@@ -0,0 +1,139 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+
+#include "swd_debugfs.h"
+
+void swd_dbg_enable_init(struct swd_dbg_enable *en, int (*set)(void *priv, bool enable), void *priv)
+{
+    mutex_init(&en->lock);
+    en->enabled = false;
+    en->set = set;
+    en->priv = priv;
+}
+
+int swd_dbg_enable_set(struct swd_dbg_enable *en, bool enable)
+{
+    int ret = 0;
+
+    mutex_lock(&en->lock);
+    if (enable != en->enabled) {
+        ret = en->set(en->priv, enable);
+        if (!ret)
+            en->enabled = enable;
+    }
+    mutex_unlock(&en->lock);
+
+    return ret;
+}
+
+static ssize_t swd_dbg_enable_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
+{
+    char s[4];
+    struct swd_dbg_enable *en = filp->private_data;
+
+    snprintf(s, sizeof(s), "%d\n", en->enabled ? 1 : 0);
+
+    return simple_read_from_buffer(buf, len, off, s, strlen(s));
+}
+
+static ssize_t swd_dbg_enable_write(struct file *filp, const char __user *buf, size_t len, loff_t *off)
+{
+    int ret;
+    bool enable;
+
+    ret = kstrtobool_from_user(buf, len, &enable);
+    if (ret)
+        return ret;
+
+    ret = swd_dbg_enable_set(filp->private_data, enable);
+
+    return ret ? ret : len;
+}
+
+static const struct file_operations swd_dbg_enable_fops = {
+    .owner  = THIS_MODULE,
+    .open   = simple_open,
+    .read   = swd_dbg_enable_read,
+    .write  = swd_dbg_enable_write,
+};
+
+void swd_dbg_enable_create(const char *name, struct dentry *dir, struct swd_dbg_enable *en)
+{
+    debugfs_create_file(name, 0644, dir, en, &swd_dbg_enable_fops);
+}
+
+void swd_dbg_ring_init(struct swd_dbg_ring *r, spinlock_t *lock, u32 rec_size, u32 size)
+{
+    r->lock = lock;
+    r->recs = NULL;
+    r->rec_size = rec_size;
+    r->size = size;
+    r->head = 0;
+    r->tail = 0;
+}
+
+bool swd_dbg_ring_push(struct swd_dbg_ring *r, const void *rec)
+{
+    if (r->head - r->tail >= r->size)
+        return false;
+
+    memcpy(r->recs + (r->head++ & (r->size - 1)) * r->rec_size, rec, r->rec_size);
+
+    return true;
+}
+
+// whole records only, a short buffer is an error
+static ssize_t swd_dbg_ring_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
+{
+    u32 i;
+    u32 nr;
+    u32 tail;
+    u32 first;
+    void *recs;
+    ssize_t ret;
+    struct swd_dbg_ring *r = filp->private_data;
+
+    nr = min_t(size_t, len / r->rec_size, r->size);
+    if (!nr)
+        return -EINVAL;
+
+    if (!r->recs)
+        return 0;
+
+    recs = vmalloc(nr * r->rec_size);
+    if (!recs)
+        return -ENOMEM;
+
+    // in at most two pieces, the end of the ring and its start
+    spin_lock_irq(r->lock);
+    tail = r->tail;
+    nr = min(nr, r->head - tail);
+    first = tail & (r->size - 1);
+    i = min(nr, r->size - first);
+    memcpy(recs, r->recs + first * r->rec_size, i * r->rec_size);
+    memcpy(recs + i * r->rec_size, r->recs, (nr - i) * r->rec_size);
+    r->tail = tail + nr;
+    spin_unlock_irq(r->lock);
+
+    ret = nr * r->rec_size;
+    if (copy_to_user(buf, recs, ret))
+        ret = -EFAULT;
+
+    vfree(recs);
+
+    return ret;
+}
+
+static const struct file_operations swd_dbg_ring_fops = {
+    .owner  = THIS_MODULE,
+    .open   = simple_open,
+    .read   = swd_dbg_ring_read,
+};
+
+void swd_dbg_ring_create(const char *name, struct dentry *dir, struct swd_dbg_ring *r)
+{
+    debugfs_create_file(name, 0444, dir, r, &swd_dbg_ring_fops);
+}
@@ -0,0 +1,47 @@
+#ifndef SWD_DEBUGFS_H
+#define SWD_DEBUGFS_H
+
+#include <linux/debugfs.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+
+// A file reading 0 or 1, a written bool goes to set with lock held.
+// enabled follows the writes which set accepted.
+struct swd_dbg_enable {
+    struct mutex lock;
+    bool enabled;
+    int (*set)(void *priv, bool enable);
+    void *priv;
+};
+
+// Fixed size records in the order pushed, consumed by the reads.
+// The storage belongs to the owner, size is a power of 2.
+struct swd_dbg_ring {
+    spinlock_t *lock;       // of the owner, taken with interrupts masked by the reads
+    void *recs;
+    u32 rec_size;
+    u32 size;
+    u32 head;
+    u32 tail;
+};
+
+void swd_dbg_enable_init(struct swd_dbg_enable *en, int (*set)(void *priv, bool enable), void *priv);
+
+// the same as a write of the file, for the exit paths
+int swd_dbg_enable_set(struct swd_dbg_enable *en, bool enable);
+
+void swd_dbg_enable_create(const char *name, struct dentry *dir, struct swd_dbg_enable *en);
+
+void swd_dbg_ring_init(struct swd_dbg_ring *r, spinlock_t *lock, u32 rec_size, u32 size);
+
+// with the lock held, false if the ring is full
+bool swd_dbg_ring_push(struct swd_dbg_ring *r, const void *rec);
+
+static inline u32 swd_dbg_ring_pending(struct swd_dbg_ring *r)
+{
+    return r->head - r->tail;
+}
+
+void swd_dbg_ring_create(const char *name, struct dentry *dir, struct swd_dbg_ring *r);
+
+#endif
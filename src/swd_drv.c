@@ -5,15 +5,30 @@
 #include <linux/gpio.h>
 #include <linux/fs.h>
 #include <linux/platform_device.h>
+#include <linux/debugfs.h>
 
 #include "swd_drv.h"
+#include "swd_session.h"
+#include "swd_sampler.h"
+#include "swd_profiler.h"
+#include "swd_rtt.h"
+#include "swd_pool.h"
+#include "swd_spi.h"
+#include "swd_zflash.h"
+#include "swd_dap.h"
+#include "swd_exec.h"
+#include "swd_link.h"
+#include "swd_worker.h"
+#include "swd_monitor.h"
+#include "swd_capture.h"
+#include "swd_timing.h"
+#include "cortex_m.h"
 #include "rpu_sysfs.h"
+#include "rpu_firmware.h"
 #include "rproc_core.h"
 #include "swd_gpio/swd_gpio.h"
 #include "../include/swd_module.h"
 
-#define SWD_DELAY   (1000000000UL / 2000)
-
 static struct swd_device swd_dev;
 static int swd_major = 0;
 
@@ -25,6 +40,7 @@ extern struct rproc_core stm32f103c8t6_rc;
 extern struct rproc_core stm32f411ceu6_rc;
 
 extern int rpu_status;
+extern int rpu_live;
 
 atomic_t open_lock = ATOMIC_INIT(1);
 
@@ -35,34 +51,57 @@ static inline void _delay(unsigned long long time_out)
 }
 
 static inline void delay (void) {
-    _delay(SWD_DELAY);
+    _delay(swd_link_delay());
 }
 
+// the line is followed for the bus capture, see swd_capture.c,
+// the clock edges are timed by swd_timing.c
 static inline void SWCLK_SET (int v) {
     gpiod_direction_output(_swclk, v);
+    if (swd_timing_on())
+        swd_timing_edge(v);
+    if (v && swd_capture_on())
+        swd_capture_clock();
 }
 
 static inline void SWDIO_SET (int v) {
     gpiod_direction_output(_swdio, v);
+    if (swd_capture_on())
+        swd_cap_line.out = v;
 }
 
 static inline void SWDIO_DIR_IN (void) {
     gpiod_direction_input(_swdio);
+    if (swd_capture_on())
+        swd_cap_line.in = true;
 }
 
 static inline void SWDIO_DIR_OUT (void) {
     gpiod_direction_output(_swdio, 1);
+    if (swd_capture_on()) {
+        swd_cap_line.in = false;
+        swd_cap_line.out = 1;
+    }
 }
 
 static inline int SWDIO_GET (void) {
-    return gpiod_get_value(_swdio);
+    int v = gpiod_get_value(_swdio);
+
+    if (swd_capture_on())
+        swd_cap_line.sampled = v;
+
+    return v;
 }
 
 static inline void signal_begin (void) {
     spin_lock_irq(&__lock);
+    if (swd_timing_on())
+        swd_timing_begin();
 }
 
 static inline void signal_end (void) {
+    if (swd_timing_on())
+        swd_timing_end();
     spin_unlock_irq(&__lock);
 }
 
@@ -92,14 +131,31 @@ static int swd_open(struct inode *inode, struct file* filp)
         return -EBUSY;
     }
 
-    ret = rc->core_init();
+    swd_bus_lock(sd);
+
+    // reuse the attached session, only the first open does the full init
+    ret = swd_session_get(sd);
     if (ret) {
         pr_err("%s: [%s] %d error with _swd_init\n", SWDDEV_NAME, __func__, __LINE__);
         goto swd_init_fail;
     }
 
-    rc->core_halt();
-    rpu_status = RPU_STATUS_HALT;
+    // data still buffered by the flash attribute goes out first
+    if (rpu_flash_sync())
+        pr_err("%s: [%s] %d error with rpu_flash_sync\n", SWDDEV_NAME, __func__, __LINE__);
+
+    // in live mode the core keeps running
+    if (!rpu_live && (rpu_status != RPU_STATUS_HALT)) {
+        if (rc->core_halt()) {
+            ret = swd_session_recover(sd);
+            if (ret)
+                goto swd_init_fail;
+            rc->core_halt();
+        }
+        rpu_status = RPU_STATUS_HALT;
+    }
+
+    swd_bus_unlock(sd);
 
     filp->f_pos = rc->ci->cm->flash.base;
     filp->private_data = &swd_dev;
@@ -109,6 +165,7 @@ static int swd_open(struct inode *inode, struct file* filp)
     return 0;
 
 swd_init_fail:
+    swd_bus_unlock(sd);
     atomic_inc(&open_lock);
     return ret;
 }
@@ -116,11 +173,14 @@ swd_init_fail:
 static int swd_release(struct inode *inode, struct file* filp)
 {
     struct swd_device *sd = (struct swd_device*)filp->private_data;
-    struct rproc_core *rc = sd->rc;
 
     pr_info("%s: [%s] %d release start\n", SWDDEV_NAME, __func__, __LINE__);
 
-    rc->core_reset();
+    swd_monitor_release();
+
+    swd_bus_lock(sd);
+    swd_session_put(sd, true);
+    swd_bus_unlock(sd);
     atomic_inc(&open_lock);
 
     pr_info("%s: [%s] %d release finished\n", SWDDEV_NAME, __func__, __LINE__);
@@ -154,9 +214,9 @@ loff_t swd_llseek(struct file *filp, loff_t off, int whence)
 
 static ssize_t swd_read(struct file *filp, char *user_buf, size_t len, loff_t *off)
 {
-    int ret;
     u32 base;
     char *buf;
+    size_t chunk;
     ssize_t len_to_cpy;
     ssize_t read_len;
     struct swd_device *sd = (struct swd_device*)filp->private_data;
@@ -164,40 +224,151 @@ static ssize_t swd_read(struct file *filp, char *user_buf, size_t len, loff_t *o
 
     pr_info("%s: [%s] %d read start\n", SWDDEV_NAME, __func__, __LINE__);
 
-    buf = kmalloc(len, GFP_KERNEL);
-    if (!buf) {
-        pr_err("%s: [%s] %d NULL from kmalloc\n", SWDDEV_NAME, __func__, __LINE__);
-        return 0;
-    }
+    swd_bus_lock(sd);
+    buf = swd_pool_get(sd);
 
+    // one pool buffer at a time, whatever size userspace asks for
     len_to_cpy = 0;
     base = filp->f_pos;
     do {
-        read_len = rc->read_ram(buf + len_to_cpy, base, len);
+        if (swd_bus_yield(sd)) {
+            len_to_cpy = -EIO;
+            goto swd_ap_read_fault;
+        }
+
+        chunk = min(len, sd->pool.size);
+        read_len = rc->read_ram(buf, base, chunk);
+        if ((read_len < 0) && !swd_session_recover(sd))
+            read_len = rc->read_ram(buf, base, chunk);
         if (read_len < 0) {
             len_to_cpy = -1;
             goto swd_ap_read_fault;
         }
 
+        if (copy_to_user(user_buf + len_to_cpy, buf, read_len)) {
+            len_to_cpy = -EFAULT;
+            goto swd_ap_read_fault;
+        }
+
         len_to_cpy += read_len;
         base += read_len;
         len -= read_len;
-    } while(len/4);
-
-    ret = copy_to_user(user_buf, buf, len_to_cpy);
-    if (ret)
-        return ret;
+    } while(len);
 
     *off += len_to_cpy;
 
 swd_ap_read_fault:
-    kfree(buf);
+    swd_pool_put(sd, buf);
+    swd_bus_unlock(sd);
 
     pr_info("%s: [%s] %d read finished\n", SWDDEV_NAME, __func__, __LINE__);
 
     return len_to_cpy;
 }
 
+static ssize_t swd_write(struct file *filp, const char *user_buf, size_t len, loff_t *off)
+{
+    u32 base;
+    char *buf;
+    size_t pos;
+    size_t chunk;
+    ssize_t len_written;
+    ssize_t write_len;
+    struct swd_device *sd = (struct swd_device*)filp->private_data;
+    struct rproc_core *rc = sd->rc;
+
+    pr_info("%s: [%s] %d write start\n", SWDDEV_NAME, __func__, __LINE__);
+
+    swd_bus_lock(sd);
+    buf = swd_pool_get(sd);
+    // any address, the flash controller too
+    swd_exec_forget();
+    rc->erased_forget();
+
+    len_written = 0;
+    base = filp->f_pos;
+    while (len_written < len) {
+        chunk = min(len - len_written, sd->pool.size);
+        if (copy_from_user(buf, user_buf + len_written, chunk)) {
+            len_written = -EFAULT;
+            goto swd_ap_write_fault;
+        }
+
+        for (pos = 0 ; pos < chunk ; pos += write_len) {
+            if (swd_bus_yield(sd)) {
+                len_written = -EIO;
+                goto swd_ap_write_fault;
+            }
+
+            write_len = rc->write_mem(buf + pos, base + pos, chunk - pos);
+            if ((write_len < 0) && !swd_session_recover(sd))
+                write_len = rc->write_mem(buf + pos, base + pos, chunk - pos);
+            if (write_len < 0) {
+                len_written = -EIO;
+                goto swd_ap_write_fault;
+            }
+        }
+
+        len_written += chunk;
+        base += chunk;
+    }
+
+    *off += len_written;
+
+swd_ap_write_fault:
+    swd_pool_put(sd, buf);
+    swd_bus_unlock(sd);
+
+    pr_info("%s: [%s] %d write finished\n", SWDDEV_NAME, __func__, __LINE__);
+
+    return len_written;
+}
+
+// Copy a user buffer to the target through pool buffers, chunk by chunk.
+// download is write_ram or program_flash, offset is in the sram/flash.
+// It is called for unit bytes (the program_size) at a time, the bus is
+// yielded to urgent users between the calls.
+static long swd_download(struct swd_device *sd, void __user *from, u32 offset, u32 len,
+        ssize_t (*download)(struct core_mem*, void*, u32, u32), u32 unit, bool recover)
+{
+    long ret = 0;
+    u32 pos;
+    u32 n;
+    u32 len_to_write;
+    u32 chunk;
+    char *buf;
+    struct core_mem *cm = sd->rc->ci->cm;
+
+    buf = swd_pool_get(sd);
+
+    for (pos = 0 ; pos < len ; pos += chunk) {
+        chunk = min_t(u32, len - pos, sd->pool.size);
+        if (copy_from_user(buf, (char __user *)from + pos, chunk)) {
+            ret = -EFAULT;
+            break;
+        }
+
+        for (n = 0 ; n < chunk ; n += len_to_write) {
+            ret = swd_bus_yield(sd);
+            if (ret)
+                break;
+
+            len_to_write = min(chunk - n, unit);
+            ret = download(cm, buf + n, offset + pos + n, len_to_write);
+            if (recover && (ret < 0) && !swd_session_recover(sd))
+                ret = download(cm, buf + n, offset + pos + n, len_to_write);
+            if (ret)
+                break;
+        }
+        if (ret)
+            break;
+    }
+
+    swd_pool_put(sd, buf);
+
+    return ret;
+}
+
 //  0. reset line
 //  1. halt core
 //  2. unhalt core
@@ -207,11 +378,16 @@ swd_ap_read_fault:
 //  6. erase flash
 //  7. erase flash by page
 //  8. verify
-static long swd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+// 12. compressed download to flash
+// 13. core register snapshot
+// 14. batch of DP/AP accesses
+// 15. run a function on the core
+static long _swd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
     long ret = 0;
-    char *buf = NULL;
+    u32 rate = 0;
     struct swd_parameters params;
+    struct swd_core_regs regs;
     struct swd_device *sd = (struct swd_device*)filp->private_data;
     struct rproc_core *rc = sd->rc;
 
@@ -222,14 +398,20 @@ static long swd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
         rc->setup_swd();
         break;
     case SWDDEV_IOC_HLTCORE:
-        rc->setup_swd();
-        rc->core_halt();
+        if (rc->core_halt()) {
+            ret = swd_session_recover(sd);
+            if (ret)
+                break;
+            rc->core_halt();
+        }
         rpu_status = RPU_STATUS_HALT;
         break;
     case SWDDEV_IOC_UNHLTCORE:
+        swd_exec_forget();
         rc->core_unhalt();
         rc->core_reset();
         rpu_status = RPU_STATUS_UNHALT;
+        swd_monitor_kick();
         break;
     case SWDDEV_IOC_TSTALIVE:
         rc->setup_swd();
@@ -240,28 +422,36 @@ static long swd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     case SWDDEV_IOC_DWNLDSRAM:
         if(copy_from_user(&params, (void*)arg, sizeof(struct swd_parameters)))
             return -EFAULT;
-        buf = kmalloc(params.arg[2], GFP_KERNEL);
-        if (!buf)
-            return -ENOMEM;
-        if(copy_from_user(buf, (void*)(params.arg[0]), params.arg[2])){
-            kfree(buf);
-            return -EFAULT;
-        }
-        ret = rc->write_ram(rc->ci->cm, buf, params.arg[1], params.arg[2]);
-        kfree(buf);
+        swd_exec_forget();
+        ret = swd_download(sd, (void*)(params.arg[0]), params.arg[1], params.arg[2],
+                           rc->write_ram, rc->ci->cm->sram.program_size, true);
         break;
     case SWDDEV_IOC_DWNLDFLSH:
         if(copy_from_user(&params, (void*)arg, sizeof(struct swd_parameters)))
             return -EFAULT;
-        buf = kmalloc(params.arg[2], GFP_KERNEL);
-        if (!buf)
-            return -ENOMEM;
-        if(copy_from_user(buf, (void*)(params.arg[0]), params.arg[2])){
-            kfree(buf);
+        ret = swd_download(sd, (void*)(params.arg[0]), params.arg[1], params.arg[2],
+                           rc->program_flash, rc->ci->cm->flash.program_size, false);
+        break;
+    case SWDDEV_IOC_DWNLDFLSH_Z:
+        if(copy_from_user(&params, (void*)arg, sizeof(struct swd_parameters)))
+            return -EFAULT;
+        ret = swd_zflash_download(sd, (void*)(params.arg[0]), params.arg[1], params.arg[2], &rate);
+        params.ret = rate;
+        if(copy_to_user((void*)arg, &params, sizeof(struct swd_parameters)))
             return -EFAULT;
-        }
-        ret = rc->program_flash(rc->ci->cm, buf, params.arg[1], params.arg[2]);
-        kfree(buf);
+        break;
+    case SWDDEV_IOC_REGS_GET:
+        ret = cortex_m_snapshot(sd, &regs);
+        if (!ret && copy_to_user((void*)arg, &regs, sizeof(struct swd_core_regs)))
+            return -EFAULT;
+        break;
+    case SWDDEV_IOC_DAP_XFER:
+        swd_exec_forget();
+        rc->erased_forget();
+        ret = swd_dap_transfer(sd, (struct swd_dap_transfer __user *)arg);
+        break;
+    case SWDDEV_IOC_EXEC:
+        ret = swd_exec(sd, (struct swd_exec __user *)arg);
         break;
     case SWDDEV_IOC_ERSFLSH:
         rc->erase_flash_all();
@@ -285,11 +475,25 @@ static long swd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     return ret;
 }
 
+static long swd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    long ret;
+    struct swd_device *sd = (struct swd_device*)filp->private_data;
+
+    swd_bus_lock(sd);
+    ret = _swd_ioctl(filp, cmd, arg);
+    swd_bus_unlock(sd);
+
+    return ret;
+}
+
 static struct file_operations fops = {
     .open       = swd_open,
     .release    = swd_release,
     .read       = swd_read,
+    .write      = swd_write,
     .llseek     = swd_llseek,
+    .poll       = swd_monitor_poll,
     .unlocked_ioctl = swd_ioctl
 };
 
@@ -322,6 +526,9 @@ static int swd_probe(struct platform_device *pdev)
         goto swdio_request_fail;
     }
 
+    // the bus state comes before anything which may clock the bus
+    spin_lock_init(&__lock);
+
     // find the matching core
     swd_dev.rc = &stm32f103c8t6_rc;
     if (!of_property_read_string(dev->of_node, "core", &core_name)) {
@@ -335,6 +542,20 @@ static int swd_probe(struct platform_device *pdev)
         pr_err("%s [%s] %d Err with get core\n", SWDDEV_NAME, __func__, __LINE__);
     }
     swd_dev.rc->gpio_bind(&sg);
+    swd_dev.sg = &sg;
+    mutex_init(&swd_dev.bus_lock);
+    atomic_set(&swd_dev.bus_urgent, 0);
+    init_waitqueue_head(&swd_dev.bus_wq);
+    swd_session_init(&swd_dev);
+    swd_monitor_init(&swd_dev);
+
+    ret = swd_pool_init(&swd_dev);
+    if (ret)
+        goto swd_pool_init_fail;
+
+    ret = swd_worker_init(&swd_dev);
+    if (ret)
+        goto swd_worker_init_fail;
 
     cdev_init(&swd_dev.cdev, &fops);
     swd_dev.cdev.owner = THIS_MODULE;
@@ -364,13 +585,61 @@ static int swd_probe(struct platform_device *pdev)
     if (ret)
         goto rpu_sysfs_init_fail;
 
+    ret = swd_sampler_init(&swd_dev);
+    if (ret)
+        goto swd_sampler_init_fail;
+
+    // debugfs is optional, its calls take the error pointer of a missing parent
+    swd_dev.debugfs = debugfs_create_dir(SWDDEV_NAME, NULL);
+
+    ret = swd_profiler_init(&swd_dev);
+    if (ret)
+        goto swd_profiler_init_fail;
+
+    ret = swd_capture_init(&swd_dev);
+    if (ret)
+        goto swd_capture_init_fail;
+
+    ret = swd_timing_init(&swd_dev);
+    if (ret)
+        goto swd_timing_init_fail;
+
+    ret = swd_rtt_init(&swd_dev);
+    if (ret)
+        goto swd_rtt_init_fail;
+
     platform_set_drvdata(pdev, &swd_dev);
 
-    spin_lock_init(&__lock);
+    // last, its callback may program the target as soon as it is queued
+    ret = rpu_firmware_init(&swd_dev);
+    if (ret)
+        goto rpu_firmware_init_fail;
+
     pr_info("%s: [%s] %d finished\n", SWDDEV_NAME, __func__, __LINE__);
     return 0;
 
+rpu_firmware_init_fail:
+    swd_rtt_exit(&swd_dev);
+
+swd_rtt_init_fail:
+    swd_timing_exit(&swd_dev);
+
+swd_timing_init_fail:
+    swd_capture_exit(&swd_dev);
+
+swd_capture_init_fail:
+    swd_profiler_exit(&swd_dev);
+
+swd_profiler_init_fail:
+    debugfs_remove_recursive(swd_dev.debugfs);
+    swd_sampler_exit(&swd_dev);
+
+swd_sampler_init_fail:
+    rpu_sysfs_exit(&swd_dev);
+
 rpu_sysfs_init_fail:
+    device_destroy(swd_dev.cls, MKDEV(swd_major, 0));
+
 device_create_fail:
     class_destroy(swd_dev.cls);
 
@@ -381,6 +650,14 @@ cdev_add_fail:
     unregister_chrdev_region(MKDEV(swd_major, 0), 1);
 
 chrdev_region_fail:
+    swd_worker_exit(&swd_dev);
+
+swd_worker_init_fail:
+    swd_pool_exit(&swd_dev);
+
+swd_pool_init_fail:
+    swd_monitor_exit(&swd_dev);
+    swd_session_exit(&swd_dev);
     gpiod_put(_swdio);
 
 swdio_request_fail:
@@ -396,7 +673,18 @@ static int swd_remove(struct platform_device *pdev)
 
     pr_info("%s: [%s] %d start\n", SWDDEV_NAME, __func__, __LINE__);
 
+    rpu_firmware_exit(sd);
+    swd_monitor_exit(sd);
+    swd_rtt_exit(sd);
+    swd_timing_exit(sd);
+    swd_capture_exit(sd);
+    swd_profiler_exit(sd);
+    debugfs_remove_recursive(sd->debugfs);
+    swd_sampler_exit(sd);
     rpu_sysfs_exit(sd);
+    swd_session_exit(sd);
+    swd_worker_exit(sd);
+    swd_pool_exit(sd);
     gpiod_put(_swdio);
     gpiod_put(_swclk);
     device_destroy(sd->cls, MKDEV(swd_major, 0));
@@ -433,6 +721,13 @@ static int __init swd_init(void)
         return -1;
     }
 
+    // optional spi transport, used once a "rproc,swd-spi" device shows up
+    if(swd_spi_init()) {
+        pr_err("%s: [%s] %d Err with swd_spi_init\n", SWDDEV_NAME, __func__, __LINE__);
+        platform_driver_unregister(&swd_driver);
+        return -1;
+    }
+
     pr_info("%s: [%s] %d finished\n", SWDDEV_NAME, __func__, __LINE__);
 
     return 0;
@@ -442,6 +737,7 @@ static void __exit swd_exit(void)
 {
     pr_info("%s: [%s] %d start\n", SWDDEV_NAME, __func__, __LINE__);
 
+    swd_spi_exit();
     platform_driver_unregister(&swd_driver);
 
     pr_info("%s: [%s] %d finished\n", SWDDEV_NAME, __func__, __LINE__);
@@ -2,17 +2,67 @@
 #define SWD_H
 
 #include <linux/cdev.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
 
 #include "rproc_core.h"
 
-#define SWDDEV_NAME "swd" 
+#define SWDDEV_NAME "swd"
 
-struct swd_device 
+// state of the debug session, kept across open/close
+struct swd_session {
+    bool attached;          // DP powered up and AP probed
+    u32 idcode;             // DP IDCODE read when attaching
+    struct delayed_work idle_work;
+};
+
+// buffers reused by the data paths, so they do not allocate per call.
+// one may be held by the sysfs flash write-back, the other serves the
+// transfer holding the bus lock.
+#define SWD_POOL_NR 2
+
+struct swd_pool {
+    size_t size;            // bytes in each buffer
+    unsigned long busy;     // bit per buffer in use
+    void *bufs[SWD_POOL_NR];
+    wait_queue_head_t wq;
+};
+
+struct swd_device
 {
     struct cdev cdev;
     struct class *cls;
     struct device *dev;
     struct rproc_core *rc;
+    struct swd_gpio *sg;    // bound to rc, for the bitstreams
+    struct swd_session session;
+    struct mutex bus_lock;  // one user of the swd bus at a time
+    atomic_t bus_urgent;    // interactive users waiting for the bus
+    wait_queue_head_t bus_wq;   // bulk users yielded to them
+    u32 bus_yields;         // times swd_bus_yield() gave the bus away, bus lock held
+    struct swd_pool pool;
+    struct dentry *debugfs; // "swd" directory in debugfs
 };
 
-#endif
\ No newline at end of file
+static inline void swd_bus_lock(struct swd_device *sd)
+{
+    mutex_lock(&sd->bus_lock);
+}
+
+static inline void swd_bus_unlock(struct swd_device *sd)
+{
+    mutex_unlock(&sd->bus_lock);
+}
+
+// Short interactive requests go before the bulk operation holding the bus,
+// it gives the bus away at its next chunk boundary by swd_bus_yield().
+static inline void swd_bus_lock_urgent(struct swd_device *sd)
+{
+    atomic_inc(&sd->bus_urgent);
+    mutex_lock(&sd->bus_lock);
+    if (atomic_dec_and_test(&sd->bus_urgent))
+        wake_up(&sd->bus_wq);
+}
+
+#endif
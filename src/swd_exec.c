@@ -0,0 +1,170 @@
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/uaccess.h>
+
+#include "swd_drv.h"
+#include "swd_exec.h"
+#include "cortex_m.h"
+#include "../include/swd_module.h"
+
+// A function run on the halted core: the blob is loaded in a window of
+// the sram after a bkpt the function returns to, the stack follows it.
+//
+//   sram.base + exec_sram_off  bkpt, bkpt  <- lr
+//   + 0x4                      blob        <- pc = + 0x4 + entry
+//   + 0x1004                   stack       <- sp = + 0x1404
+
+#define SWD_EXEC_NAME       "swd_exec"
+#define SWD_EXEC_CODE_OFF   0x4
+#define SWD_EXEC_STACK_SIZE 0x400
+#define SWD_EXEC_SP_OFF     (SWD_EXEC_CODE_OFF + SWD_EXEC_MAX_CODE + SWD_EXEC_STACK_SIZE)
+#define SWD_EXEC_TIMEOUT_MS 1000
+#define SWD_EXEC_BKPT       0xBE00BE00
+
+static unsigned int exec_sram_off = 0;
+module_param(exec_sram_off, uint, 0644);
+MODULE_PARM_DESC(exec_sram_off, "offset in the sram of the 0x1404 bytes used by SWDDEV_IOC_EXEC, 8 byte aligned");
+
+// the blob loaded, until something may have written over it
+static struct {
+    bool valid;
+    u32 base;
+    u32 hash;
+    u32 len;
+} swd_exec_cache;
+
+void swd_exec_forget(void)
+{
+    swd_exec_cache.valid = false;
+}
+
+static int swd_exec_read(struct rproc_core *rc, u32 addr, u32 *val)
+{
+    return (rc->read_ram(val, addr, sizeof(u32)) == sizeof(u32)) ? 0 : -EIO;
+}
+
+static int swd_exec_write(struct rproc_core *rc, u32 addr, u32 val)
+{
+    return (rc->write_mem(&val, addr, sizeof(u32)) == sizeof(u32)) ? 0 : -EIO;
+}
+
+// CYCCNT counts only while the core is not halted, zeroed for the call
+static int swd_exec_cyccnt_start(struct rproc_core *rc)
+{
+    u32 val;
+
+    if (swd_exec_read(rc, CORTEX_M_DEMCR, &val) || \
+        swd_exec_write(rc, CORTEX_M_DEMCR, val | CORTEX_M_DEMCR_TRCENA))
+        return -EIO;
+
+    if (swd_exec_write(rc, CORTEX_M_DWT_CYCCNT, 0) || \
+        swd_exec_read(rc, CORTEX_M_DWT_CTRL, &val) || \
+        swd_exec_write(rc, CORTEX_M_DWT_CTRL, val | CORTEX_M_DWT_CYCCNTENA))
+        return -EIO;
+
+    return 0;
+}
+
+static int swd_exec_load(struct rproc_core *rc, u32 base, const void *code, u32 len, u32 hash)
+{
+    int ret;
+    u32 *buf;
+    struct core_mem *cm = rc->ci->cm;
+
+    buf = kmalloc(SWD_EXEC_CODE_OFF + len, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+
+    buf[0] = SWD_EXEC_BKPT;
+    memcpy((char*)buf + SWD_EXEC_CODE_OFF, code, len);
+
+    swd_exec_forget();
+    ret = rc->write_ram(cm, buf, base - cm->sram.base, SWD_EXEC_CODE_OFF + len) ? -EIO : 0;
+    if (!ret) {
+        swd_exec_cache.base = base;
+        swd_exec_cache.hash = hash;
+        swd_exec_cache.len = len;
+        swd_exec_cache.valid = true;
+    }
+
+    kfree(buf);
+
+    return ret;
+}
+
+// Load the blob unless it is there already, set r0-r3, sp, lr and pc and
+// run it until it returns to the bkpt. The exec window of the sram is
+// overwritten. Caller must hold the bus lock, -EBUSY if the core runs.
+long swd_exec(struct swd_device *sd, struct swd_exec __user *arg)
+{
+    long ret;
+    u32 hash;
+    u32 base;
+    void *code;
+    struct swd_exec e;
+    struct rproc_core *rc = sd->rc;
+    struct core_mem *cm = rc->ci->cm;
+
+    if (copy_from_user(&e, arg, sizeof(e)))
+        return -EFAULT;
+
+    if (!e.code_len || (e.code_len > SWD_EXEC_MAX_CODE) || (e.entry >= e.code_len) || \
+        (exec_sram_off & 0x7) || (exec_sram_off > cm->sram.len) || \
+        (cm->sram.len - exec_sram_off < SWD_EXEC_SP_OFF))
+        return -EINVAL;
+
+    // the window would be written under the firmware, the registers of a
+    // running core can not be set
+    ret = cortex_m_halted(rc);
+    if (ret)
+        return ret;
+
+    code = memdup_user(u64_to_user_ptr(e.code), e.code_len);
+    if (IS_ERR(code))
+        return PTR_ERR(code);
+
+    base = cm->sram.base + exec_sram_off;
+    hash = jhash(code, e.code_len, 0);
+
+    e.cached = swd_exec_cache.valid && (swd_exec_cache.base == base) && \
+               (swd_exec_cache.hash == hash) && (swd_exec_cache.len == e.code_len);
+    if (!e.cached) {
+        ret = swd_exec_load(rc, base, code, e.code_len, hash);
+        if (ret)
+            goto swd_exec_fail;
+    }
+
+    // the function may program the flash
+    rc->erased_forget();
+
+    ret = cortex_m_write_reg(rc, CORTEX_M_LR, base | 0x1);
+    if (!ret)
+        ret = swd_exec_cyccnt_start(rc);
+    if (ret)
+        goto swd_exec_fail;
+
+    ret = cortex_m_run(rc, (base + SWD_EXEC_CODE_OFF + e.entry) | 0x1, base + SWD_EXEC_SP_OFF,
+                       e.args, ARRAY_SIZE(e.args),
+                       e.timeout_ms ? e.timeout_ms : SWD_EXEC_TIMEOUT_MS, &e.ret);
+    if (ret) {
+        // a runaway function may have written anywhere
+        swd_exec_forget();
+        goto swd_exec_fail;
+    }
+
+    ret = swd_exec_read(rc, CORTEX_M_DWT_CYCCNT, &e.cycles);
+    if (ret)
+        goto swd_exec_fail;
+
+    pr_debug("%s: [%s] %d r0:%08x cycles:%u cached:%u\n", SWD_EXEC_NAME, __func__, __LINE__,
+             e.ret, e.cycles, e.cached);
+
+    if (copy_to_user(arg, &e, sizeof(e)))
+        ret = -EFAULT;
+
+swd_exec_fail:
+    kfree(code);
+
+    return ret;
+}
@@ -0,0 +1,12 @@
+#ifndef SWD_EXEC_H
+#define SWD_EXEC_H
+
+#include "swd_drv.h"
+#include "../include/swd_module.h"
+
+long swd_exec(struct swd_device *sd, struct swd_exec __user *arg);
+
+// the sram holding the blob may have been written or the core run
+void swd_exec_forget(void);
+
+#endif
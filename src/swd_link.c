@@ -0,0 +1,130 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+#include "swd_link.h"
+#include "swd_gpio/swd_gpio.h"
+
+#define SWD_LINK_NAME "swd_link"
+
+// Adaptive SWCLK: every link error makes the clock slower at once, a run
+// of clean transactions tries it faster again. A faster rate failing
+// within its first run is given up and the next try waits twice as long,
+// so the link settles just above the rate it can not hold.
+#define SWD_LINK_DELAY_DEF      (1000000000UL / 2000)
+#define SWD_LINK_DELAY_MAX      (SWD_LINK_DELAY_DEF * 8)
+#define SWD_LINK_DELAY_MIN      (SWD_LINK_DELAY_DEF / 256)
+#define SWD_LINK_STEP_MIN       16      // slower by at least this many loops
+#define SWD_LINK_CLEAN_RUN      256     // clean transactions before trying faster
+#define SWD_LINK_BACKOFF_MAX    64      // longest wait, in clean runs
+
+unsigned long swclk_delay = SWD_LINK_DELAY_DEF;
+module_param(swclk_delay, ulong, 0644);
+MODULE_PARM_DESC(swclk_delay, "half period of SWCLK in busy loops, updated as the link is learned");
+
+static bool swclk_adaptive = true;
+module_param(swclk_adaptive, bool, 0644);
+MODULE_PARM_DESC(swclk_adaptive, "slow SWCLK down on link errors and try it faster after clean transactions");
+
+static unsigned long swclk_delay_min = SWD_LINK_DELAY_MIN;
+module_param(swclk_delay_min, ulong, 0644);
+MODULE_PARM_DESC(swclk_delay_min, "the fastest SWCLK tried, in busy loops, at least 1");
+
+// updated under the bus lock
+static struct {
+    u32 clean;              // transactions since the last error or change
+    u32 backoff;            // clean runs to wait before trying faster
+    bool probing;           // running at a rate not proven yet
+    unsigned long good;     // delay of the last rate held for a full run
+    u32 errors[SWD_LINK_NR_ERR];
+    u32 slower;
+    u32 faster;
+} swd_link = {
+    .backoff = 1,
+};
+
+static const char * const swd_link_err_name[SWD_LINK_NR_ERR] = {
+    [SWD_LINK_PARITY] = "parity",
+    [SWD_LINK_NOACK] = "noack",
+    [SWD_LINK_VERIFY] = "verify",
+};
+
+static void swd_link_set(unsigned long delay)
+{
+    WRITE_ONCE(swclk_delay, clamp(delay, max(swclk_delay_min, 1UL), SWD_LINK_DELAY_MAX));
+    swd_link.clean = 0;
+}
+
+void swd_link_ok(void)
+{
+    unsigned long delay = swd_link_delay();
+
+    if (!swclk_adaptive)
+        return;
+
+    if (++swd_link.clean < SWD_LINK_CLEAN_RUN * (swd_link.probing ? 1 : swd_link.backoff))
+        return;
+
+    // this rate held for a run, try a quarter faster
+    swd_link.good = delay;
+    swd_link.probing = false;
+
+    if (delay <= swclk_delay_min) {
+        swd_link.clean = 0;
+        return;
+    }
+
+    swd_link_set(delay - max(delay / 4, 1UL));
+    swd_link.probing = true;
+    swd_link.faster++;
+}
+
+void swd_link_error(enum SWD_LINK_ERR err)
+{
+    unsigned long delay = swd_link_delay();
+
+    swd_link.errors[err]++;
+
+    if (!swclk_adaptive)
+        return;
+
+    if (swd_link.probing && (swd_link.good > delay)) {
+        // the faster rate did not hold, back to the last good one
+        swd_link.backoff = min(swd_link.backoff * 2, (u32)SWD_LINK_BACKOFF_MAX);
+        swd_link_set(swd_link.good);
+    } else {
+        swd_link.backoff = 1;
+        swd_link_set(max(delay * 2, delay + SWD_LINK_STEP_MIN));
+    }
+
+    swd_link.probing = false;
+    swd_link.slower++;
+
+    pr_info("%s: [%s] %d %s error, swclk_delay %lu -> %lu\n", SWD_LINK_NAME, __func__, __LINE__,
+            swd_link_err_name[err], delay, swd_link_delay());
+}
+
+// The ack of a single access of swd_gpio, counted like a stream:
+// WAIT and FAULT are answers of the target, anything else is no answer.
+u8 swd_link_ack(u8 ack)
+{
+    if (ack == SWD_OK)
+        swd_link_ok();
+    else if ((ack != SWD_WAIT) && (ack != SWD_FAULT))
+        swd_link_error(SWD_LINK_NOACK);
+
+    return ack;
+}
+
+ssize_t swd_link_show(char *buf, size_t len)
+{
+    int i;
+    ssize_t n;
+
+    n = scnprintf(buf, len, "swclk_delay: %lu\nadaptive: %d\nslower: %u\nfaster: %u\n",
+                  swd_link_delay(), swclk_adaptive, swd_link.slower, swd_link.faster);
+
+    for (i = 0 ; i < SWD_LINK_NR_ERR ; i++)
+        n += scnprintf(buf + n, len - n, "%s: %u\n", swd_link_err_name[i], swd_link.errors[i]);
+
+    return n;
+}
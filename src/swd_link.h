@@ -0,0 +1,30 @@
+#ifndef SWD_LINK_H
+#define SWD_LINK_H
+
+#include <linux/types.h>
+
+// Errors of the wire, not of the target: a FAULT ack is an answer.
+enum SWD_LINK_ERR {
+    SWD_LINK_PARITY = 0,    // read data with a bad parity bit
+    SWD_LINK_NOACK,         // no valid ack, the line floated or was misread
+    SWD_LINK_VERIFY,        // data read back differs from what was written
+    SWD_LINK_NR_ERR,
+};
+
+// half period of SWCLK, in busy loops, tracked by the link quality
+extern unsigned long swclk_delay;
+
+static inline unsigned long swd_link_delay(void)
+{
+    return READ_ONCE(swclk_delay);
+}
+
+void swd_link_ok(void);
+
+void swd_link_error(enum SWD_LINK_ERR err);
+
+u8 swd_link_ack(u8 ack);
+
+ssize_t swd_link_show(char *buf, size_t len);
+
+#endif
@@ -0,0 +1,246 @@
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+
+#include "swd_drv.h"
+#include "swd_session.h"
+#include "swd_monitor.h"
+#include "swd_exec.h"
+#include "cortex_m.h"
+#include "rpu_sysfs.h"
+
+#define MONITOR_NAME "swd_monitor"
+
+#define MONITOR_SLACK_NS    (100 * NSEC_PER_USEC)
+#define MONITOR_STATE_MSK   (CORTEX_M_S_HALT | CORTEX_M_S_LOCKUP)
+
+static unsigned int monitor_min_us = 1000;
+module_param(monitor_min_us, uint, 0644);
+MODULE_PARM_DESC(monitor_min_us, "shortest DHCSR poll interval(us), used right after the core state changed");
+
+static unsigned int monitor_max_us = 100000;
+module_param(monitor_max_us, uint, 0644);
+MODULE_PARM_DESC(monitor_max_us, "longest DHCSR poll interval(us), used while the core state stays the same");
+
+extern int rpu_status;
+
+// DHCSR is read in the background while someone watches: a /dev/swd file
+// which called poll(), or a writer of the rpu "monitor" attribute. The
+// bus is only taken when it is free, a bulk transfer is never delayed.
+static struct {
+    struct swd_device *sd;
+    struct mutex lock;          // watchers and thread
+    int watchers;
+    struct task_struct *thread;
+    bool kick;
+    u32 dhcsr;                  // last read
+    u32 events;                 // state changes seen
+    u32 halts;
+    u32 lockups;
+    u32 resets;
+    wait_queue_head_t wq;
+} mon;
+
+// the /dev/swd file which polls, it is opened once at a time
+static struct {
+    bool watching;
+    u32 seen;                   // events reported by poll()
+} mon_file;
+
+static void monitor_event(u32 dhcsr)
+{
+    u32 changed = (dhcsr ^ mon.dhcsr) & MONITOR_STATE_MSK;
+
+    if (!changed && !(dhcsr & CORTEX_M_S_RESET_ST))
+        return;
+
+    if (changed & dhcsr & CORTEX_M_S_HALT)
+        mon.halts++;
+    if (changed & dhcsr & CORTEX_M_S_LOCKUP)
+        mon.lockups++;
+    if (dhcsr & CORTEX_M_S_RESET_ST)
+        mon.resets++;
+
+    // rpu_status follows the core, also when it stopped at a bkpt or was
+    // resumed by a DAP batch
+    if (dhcsr & CORTEX_M_S_HALT) {
+        rpu_status = RPU_STATUS_HALT;
+    } else if (rpu_status == RPU_STATUS_HALT) {
+        rpu_status = RPU_STATUS_UNHALT;
+        swd_exec_forget();
+        mon.sd->rc->erased_forget();
+    }
+
+    pr_debug("%s: [%s] %d dhcsr:%08x -> %08x\n", MONITOR_NAME, __func__, __LINE__, mon.dhcsr, dhcsr);
+
+    WRITE_ONCE(mon.events, mon.events + 1);
+    wake_up_interruptible(&mon.wq);
+    rpu_status_notify();
+}
+
+// returns true when the state changed
+static bool monitor_once(void)
+{
+    u32 dhcsr;
+    u32 events = mon.events;
+    struct swd_device *sd = mon.sd;
+    struct rproc_core *rc = sd->rc;
+
+    if (!mutex_trylock(&sd->bus_lock))
+        return false;
+
+    if (sd->session.attached && (rc->read_ram(&dhcsr, CORTEX_M_DHCSR, sizeof(u32)) == sizeof(u32))) {
+        monitor_event(dhcsr);
+        mon.dhcsr = dhcsr;
+    }
+
+    swd_bus_unlock(sd);
+
+    return events != mon.events;
+}
+
+static int monitor_thread(void *data)
+{
+    u32 interval_us = monitor_min_us;
+    ktime_t timeout;
+
+    pr_debug("%s: [%s] %d start\n", MONITOR_NAME, __func__, __LINE__);
+
+    while (!kthread_should_stop()) {
+        // poll fast after a change, back off while nothing happens
+        if (monitor_once())
+            interval_us = monitor_min_us;
+        else
+            interval_us = min_t(u32, interval_us * 2, monitor_max_us);
+
+        timeout = ns_to_ktime((u64)interval_us * NSEC_PER_USEC);
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!READ_ONCE(mon.kick) && !kthread_should_stop())
+            schedule_hrtimeout_range(&timeout, MONITOR_SLACK_NS, HRTIMER_MODE_REL);
+        __set_current_state(TASK_RUNNING);
+
+        if (xchg(&mon.kick, false))
+            interval_us = monitor_min_us;
+    }
+
+    pr_debug("%s: [%s] %d stop\n", MONITOR_NAME, __func__, __LINE__);
+
+    return 0;
+}
+
+int swd_monitor_watch(bool on)
+{
+    int ret = 0;
+    struct swd_device *sd = mon.sd;
+
+    mutex_lock(&mon.lock);
+
+    if (!on) {
+        if (mon.watchers && !--mon.watchers) {
+            kthread_stop(mon.thread);
+            mon.thread = NULL;
+
+            swd_bus_lock(sd);
+            swd_session_put(sd, false);
+            swd_bus_unlock(sd);
+        }
+        goto swd_monitor_watch_finish;
+    }
+
+    if (mon.watchers++)
+        goto swd_monitor_watch_finish;
+
+    swd_bus_lock(sd);
+    ret = swd_session_get(sd);
+    swd_bus_unlock(sd);
+    if (ret)
+        goto swd_monitor_watch_fail;
+
+    // the first read gives the state the changes are compared with
+    mon.dhcsr = (rpu_status == RPU_STATUS_HALT) ? CORTEX_M_S_HALT : 0;
+
+    mon.thread = kthread_run(monitor_thread, NULL, MONITOR_NAME);
+    if (IS_ERR(mon.thread)) {
+        ret = PTR_ERR(mon.thread);
+        mon.thread = NULL;
+        swd_bus_lock(sd);
+        swd_session_put(sd, false);
+        swd_bus_unlock(sd);
+        goto swd_monitor_watch_fail;
+    }
+
+    goto swd_monitor_watch_finish;
+
+swd_monitor_watch_fail:
+    mon.watchers--;
+
+swd_monitor_watch_finish:
+    mutex_unlock(&mon.lock);
+
+    return ret;
+}
+
+void swd_monitor_kick(void)
+{
+    struct task_struct *thread = READ_ONCE(mon.thread);
+
+    if (!thread)
+        return;
+
+    WRITE_ONCE(mon.kick, true);
+    wake_up_process(thread);
+}
+
+__poll_t swd_monitor_poll(struct file *filp, poll_table *wait)
+{
+    u32 events;
+
+    // the first poll() makes the file a watcher until it is closed
+    if (!mon_file.watching && !swd_monitor_watch(true)) {
+        mon_file.watching = true;
+        mon_file.seen = READ_ONCE(mon.events);
+    }
+
+    poll_wait(filp, &mon.wq, wait);
+
+    events = READ_ONCE(mon.events);
+    if (events == mon_file.seen)
+        return 0;
+
+    mon_file.seen = events;
+
+    return EPOLLPRI;
+}
+
+void swd_monitor_release(void)
+{
+    if (mon_file.watching)
+        swd_monitor_watch(false);
+    mon_file.watching = false;
+}
+
+ssize_t swd_monitor_show(char *buf, size_t len)
+{
+    return scnprintf(buf, len, "watchers: %d\ndhcsr: %08x\nhalts: %u\nlockups: %u\nresets: %u\n",
+                     mon.watchers, mon.dhcsr, mon.halts, mon.lockups, mon.resets);
+}
+
+void swd_monitor_init(struct swd_device *sd)
+{
+    mon.sd = sd;
+    mutex_init(&mon.lock);
+    init_waitqueue_head(&mon.wq);
+}
+
+void swd_monitor_exit(struct swd_device *sd)
+{
+    mutex_lock(&mon.lock);
+    if (mon.thread) {
+        kthread_stop(mon.thread);
+        mon.thread = NULL;
+    }
+    mon.watchers = 0;
+    mutex_unlock(&mon.lock);
+}
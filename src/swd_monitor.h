@@ -0,0 +1,27 @@
+#ifndef SWD_MONITOR_H
+#define SWD_MONITOR_H
+
+#include <linux/fs.h>
+#include <linux/poll.h>
+
+#include "swd_drv.h"
+
+void swd_monitor_init(struct swd_device *sd);
+
+void swd_monitor_exit(struct swd_device *sd);
+
+// a watcher more (on) or less, the monitor runs while there is one
+int swd_monitor_watch(bool on);
+
+// the core was resumed by the driver, watch it closely for a while
+void swd_monitor_kick(void);
+
+// /dev/swd: EPOLLPRI once for each change of the core state
+__poll_t swd_monitor_poll(struct file *filp, poll_table *wait);
+
+// /dev/swd is closed, it watches no more
+void swd_monitor_release(void);
+
+ssize_t swd_monitor_show(char *buf, size_t len);
+
+#endif
@@ -0,0 +1,105 @@
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "swd_drv.h"
+#include "swd_pool.h"
+
+// Size the buffers for the largest unit moved in one go: a flash sector
+// (the sysfs write-back buffer) or a program_size chunk of flash/sram.
+static size_t swd_pool_size(struct core_mem *cm)
+{
+    int i;
+    size_t size = PAGE_SIZE;
+
+    size = max_t(size_t, size, cm->sram.program_size);
+    size = max_t(size_t, size, cm->flash.program_size);
+
+    if (!cm->flash.attr) {
+        size = max_t(size_t, size, cm->mem_segs[cm->flash.offset].size);
+    } else {
+        for (i = cm->flash.offset ; i < cm->flash.offset + cm->flash.len ; i++)
+            size = max_t(size_t, size, cm->mem_segs[i].size);
+    }
+
+    return PAGE_ALIGN(size);
+}
+
+static void *swd_pool_try_get(struct swd_pool *pool)
+{
+    int i;
+
+    for (i = 0 ; i < SWD_POOL_NR ; i++) {
+        if (!test_and_set_bit(i, &pool->busy))
+            return pool->bufs[i];
+    }
+
+    return NULL;
+}
+
+// Take a buffer of sd->pool.size bytes, waits if all of them are in use.
+void *swd_pool_get(struct swd_device *sd)
+{
+    void *buf = NULL;
+    struct swd_pool *pool = &sd->pool;
+
+    wait_event(pool->wq, (buf = swd_pool_try_get(pool)) != NULL);
+
+    return buf;
+}
+
+void swd_pool_put(struct swd_device *sd, void *buf)
+{
+    int i;
+    struct swd_pool *pool = &sd->pool;
+
+    for (i = 0 ; i < SWD_POOL_NR ; i++) {
+        if (pool->bufs[i] == buf) {
+            clear_bit(i, &pool->busy);
+            wake_up(&pool->wq);
+            return;
+        }
+    }
+
+    pr_err("%s: [%s] %d buffer %p not from the pool\n", SWDDEV_NAME, __func__, __LINE__, buf);
+}
+
+int swd_pool_init(struct swd_device *sd)
+{
+    int i;
+    struct swd_pool *pool = &sd->pool;
+
+    pool->busy = 0;
+    pool->size = swd_pool_size(sd->rc->ci->cm);
+    init_waitqueue_head(&pool->wq);
+
+    for (i = 0 ; i < SWD_POOL_NR ; i++) {
+        pool->bufs[i] = vmalloc(pool->size);
+        if (!pool->bufs[i])
+            goto swd_pool_init_fail;
+    }
+
+    pr_info("%s: [%s] %d %d buffers of %zu bytes\n", SWDDEV_NAME, __func__, __LINE__,
+            SWD_POOL_NR, pool->size);
+
+    return 0;
+
+swd_pool_init_fail:
+    while (i--) {
+        vfree(pool->bufs[i]);
+        pool->bufs[i] = NULL;
+    }
+
+    return -ENOMEM;
+}
+
+void swd_pool_exit(struct swd_device *sd)
+{
+    int i;
+    struct swd_pool *pool = &sd->pool;
+
+    for (i = 0 ; i < SWD_POOL_NR ; i++) {
+        vfree(pool->bufs[i]);
+        pool->bufs[i] = NULL;
+    }
+}
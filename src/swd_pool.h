@@ -0,0 +1,14 @@
+#ifndef SWD_POOL_H
+#define SWD_POOL_H
+
+#include "swd_drv.h"
+
+int swd_pool_init(struct swd_device *sd);
+
+void swd_pool_exit(struct swd_device *sd);
+
+void *swd_pool_get(struct swd_device *sd);
+
+void swd_pool_put(struct swd_device *sd, void *buf);
+
+#endif
@@ -0,0 +1,387 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#include "swd_drv.h"
+#include "swd_session.h"
+#include "swd_bitstream.h"
+#include "swd_debugfs.h"
+#include "swd_profiler.h"
+#include "cortex_m.h"
+
+#define PROFILER_NAME "swd_profiler"
+
+#define PROF_MAX_BURST      64
+#define PROF_MIN_PERIOD_US  100
+#define PROF_SLACK_NS       (10 * NSEC_PER_USEC)
+#define PROF_HIST_BITS      12
+#define PROF_HIST_SIZE      (1 << PROF_HIST_BITS)
+#define PROF_HIST_PROBE     16      // linear probes before a pc goes to "other"
+#define PROF_RING_SIZE      16384   // raw samples, power of 2
+#define PROF_PC_HALTED      0xFFFFFFFF  // PCSR of a halted core
+
+
+struct prof_bucket {
+    u32 pc;
+    u32 count;
+};
+
+struct swd_profiler {
+    struct swd_device *sd;
+    struct swd_dbg_enable enable;   // its lock protects thread
+    struct task_struct *thread;
+    u32 period_us;          // between bursts
+    u32 burst;              // PCSR reads in one stream
+
+    spinlock_t hist_lock;   // protects the histogram, the ring and the counters
+    struct prof_bucket *hist;
+    struct swd_dbg_ring ring;   // raw samples, u32 pcs
+    u64 samples;
+    u64 halted;
+    u64 other;              // pcs not fitting the histogram
+    u64 missed;             // bursts skipped, bus busy or failed
+    u64 dropped;            // raw samples not read in time
+
+    struct dentry *dir;
+};
+
+static struct swd_profiler profiler = {
+    .period_us = 1000,
+    .burst = 32,
+};
+
+static struct swd_bs_op prof_ops[(PROF_MAX_BURST + 16) * 4];
+static struct swd_bs prof_bs;
+
+// slots in rdata of the compiled stream
+static struct {
+    int demcr;
+    int pcsr;       // first of burst consecutive samples
+    int nr;
+} prof_slot;
+
+// With TAR at 0xE000EDF0 BD3 is DEMCR, with TAR at 0xE0001010 BD3 is
+// PCSR. Reading a banked register does not move TAR, so the burst is
+// back to back AP reads, each one returning the sample before it.
+static void prof_compile(u32 burst)
+{
+    int i;
+    struct swd_bs *bs = &prof_bs;
+
+    swd_bs_init(bs, prof_ops, ARRAY_SIZE(prof_ops));
+
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_CSW_REG & 0xC, SWD_MEMAP_CSW);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, CORTEX_M_DHCSR);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x10);
+    swd_bs_read(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_DEMCR));
+    prof_slot.demcr = swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+    swd_bs_write(bs, SWD_AP, SWD_AP_TAR_REG & 0xC, CORTEX_M_DWT_PCSR & ~0xF);
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x10);
+    swd_bs_read(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_DWT_PCSR));
+    for (i = 1 ; i < burst ; i++) {
+        int slot = swd_bs_read(bs, SWD_AP, SWD_MEMAP_BD(CORTEX_M_DWT_PCSR));
+
+        if (i == 1)
+            prof_slot.pcsr = slot;
+    }
+    i = swd_bs_read(bs, SWD_DP, SWD_DP_RDBUFF_REG);
+    if (burst == 1)
+        prof_slot.pcsr = i;
+
+    swd_bs_write(bs, SWD_DP, SWD_DP_SELECT_REG, 0x0);
+    swd_bs_idle(bs);
+
+    prof_slot.nr = bs->nr_reads;
+}
+
+static void prof_hist_add(struct swd_profiler *prof, u32 pc)
+{
+    int i;
+    u32 idx = jhash(&pc, sizeof(pc), 0) & (PROF_HIST_SIZE - 1);
+    struct prof_bucket *b;
+
+    for (i = 0 ; i < PROF_HIST_PROBE ; i++) {
+        b = &prof->hist[(idx + i) & (PROF_HIST_SIZE - 1)];
+        if (b->count && (b->pc != pc))
+            continue;
+
+        b->pc = pc;
+        b->count++;
+        return;
+    }
+
+    prof->other++;
+}
+
+static void prof_push(struct swd_profiler *prof, const u32 *pcs, u32 nr)
+{
+    int i;
+
+    spin_lock(&prof->hist_lock);
+    for (i = 0 ; i < nr ; i++) {
+        prof->samples++;
+
+        if (pcs[i] == PROF_PC_HALTED) {
+            prof->halted++;
+            continue;
+        }
+
+        prof_hist_add(prof, pcs[i]);
+
+        if (!swd_dbg_ring_push(&prof->ring, &pcs[i]))
+            prof->dropped++;
+    }
+    spin_unlock(&prof->hist_lock);
+}
+
+static void prof_missed(struct swd_profiler *prof, u32 nr)
+{
+    spin_lock(&prof->hist_lock);
+    prof->missed += nr;
+    spin_unlock(&prof->hist_lock);
+}
+
+// PCSR reads as zero unless the DWT is enabled by DEMCR.TRCENA,
+// a reset of the core may have cleared it.
+static int prof_trace_enable(struct rproc_core *rc, u32 demcr)
+{
+    demcr |= CORTEX_M_DEMCR_TRCENA;
+
+    return (rc->write_mem(&demcr, CORTEX_M_DEMCR, sizeof(u32)) == sizeof(u32)) ? 0 : -EIO;
+}
+
+static int prof_thread(void *data)
+{
+    int ret;
+    u32 late;
+    u32 *rdata;
+    ktime_t next;
+    struct swd_profiler *prof = data;
+    struct swd_device *sd = prof->sd;
+    u32 burst = prof->burst;    // the stream is compiled for it
+    u64 period_ns = (u64)prof->period_us * NSEC_PER_USEC;
+
+    rdata = kmalloc_array(prof_slot.nr, sizeof(u32), GFP_KERNEL);
+    if (!rdata)
+        return -ENOMEM;
+
+    pr_info("%s: [%s] %d start period:%uus burst:%u\n", PROFILER_NAME, __func__, __LINE__,
+            prof->period_us, burst);
+
+    next = ktime_get();
+    while (!kthread_should_stop()) {
+        next = ktime_add_ns(next, period_ns);
+
+        // the core keeps running, a skipped burst only costs resolution
+        if (mutex_trylock(&sd->bus_lock)) {
+            ret = swd_bs_run(sd->sg, &prof_bs, rdata);
+            if (!ret && !(rdata[prof_slot.demcr] & CORTEX_M_DEMCR_TRCENA))
+                ret = prof_trace_enable(sd->rc, rdata[prof_slot.demcr]) ? : -EAGAIN;
+            swd_bus_unlock(sd);
+
+            if (!ret)
+                prof_push(prof, &rdata[prof_slot.pcsr], burst);
+            else
+                prof_missed(prof, 1);
+        } else {
+            prof_missed(prof, 1);
+        }
+
+        for (late = 0 ; ktime_before(next, ktime_get()) ; late++)
+            next = ktime_add_ns(next, period_ns);
+        if (late)
+            prof_missed(prof, late);
+
+        set_current_state(TASK_INTERRUPTIBLE);
+        schedule_hrtimeout_range(&next, PROF_SLACK_NS, HRTIMER_MODE_ABS);
+    }
+
+    kfree(rdata);
+
+    pr_info("%s: [%s] %d stop samples:%llu\n", PROFILER_NAME, __func__, __LINE__, prof->samples);
+
+    return 0;
+}
+
+static void prof_stop(struct swd_profiler *prof)
+{
+    kthread_stop(prof->thread);
+    prof->thread = NULL;
+
+    swd_bus_lock(prof->sd);
+    swd_session_put(prof->sd, false);
+    swd_bus_unlock(prof->sd);
+}
+
+static int prof_start(struct swd_profiler *prof)
+{
+    int ret;
+    struct swd_device *sd = prof->sd;
+
+    if (!prof->burst || (prof->burst > PROF_MAX_BURST) || (prof->period_us < PROF_MIN_PERIOD_US))
+        return -EINVAL;
+
+    prof_compile(prof->burst);
+    if (prof_bs.overflow)
+        return -ENOSPC;
+
+    swd_bus_lock(sd);
+    ret = swd_session_get(sd);
+    swd_bus_unlock(sd);
+    if (ret)
+        return ret;
+
+    prof->thread = kthread_run(prof_thread, prof, PROFILER_NAME);
+    if (IS_ERR(prof->thread)) {
+        ret = PTR_ERR(prof->thread);
+        prof->thread = NULL;
+        return ret;
+    }
+
+    return 0;
+}
+
+static int prof_set(void *priv, bool enable)
+{
+    if (!enable) {
+        prof_stop(priv);
+        return 0;
+    }
+
+    return prof_start(priv);
+}
+
+static void prof_reset(struct swd_profiler *prof)
+{
+    spin_lock(&prof->hist_lock);
+    memset(prof->hist, 0, PROF_HIST_SIZE * sizeof(struct prof_bucket));
+    prof->ring.tail = prof->ring.head;
+    prof->samples = 0;
+    prof->halted = 0;
+    prof->other = 0;
+    prof->missed = 0;
+    prof->dropped = 0;
+    spin_unlock(&prof->hist_lock);
+}
+
+static int prof_bucket_cmp(const void *a, const void *b)
+{
+    const struct prof_bucket *ba = a;
+    const struct prof_bucket *bb = b;
+
+    if (ba->count != bb->count)
+        return (ba->count < bb->count) ? 1 : -1;
+
+    return (ba->pc < bb->pc) ? -1 : (ba->pc > bb->pc);
+}
+
+// "pc count" lines, the hottest first
+static int prof_hist_show(struct seq_file *m, void *v)
+{
+    int i;
+    int nr = 0;
+    u64 samples, halted, other, missed;
+    struct swd_profiler *prof = m->private;
+    struct prof_bucket *sorted;
+
+    sorted = vmalloc(PROF_HIST_SIZE * sizeof(struct prof_bucket));
+    if (!sorted)
+        return -ENOMEM;
+
+    spin_lock(&prof->hist_lock);
+    for (i = 0 ; i < PROF_HIST_SIZE ; i++) {
+        if (prof->hist[i].count)
+            sorted[nr++] = prof->hist[i];
+    }
+    samples = prof->samples;
+    halted = prof->halted;
+    other = prof->other;
+    missed = prof->missed;
+    spin_unlock(&prof->hist_lock);
+
+    sort(sorted, nr, sizeof(struct prof_bucket), prof_bucket_cmp, NULL);
+
+    seq_printf(m, "# samples:%llu halted:%llu other:%llu missed:%llu\n", samples, halted, other, missed);
+    for (i = 0 ; i < nr ; i++)
+        seq_printf(m, "%08x %u\n", sorted[i].pc, sorted[i].count);
+
+    vfree(sorted);
+
+    return 0;
+}
+
+static int prof_hist_open(struct inode *inode, struct file *filp)
+{
+    return single_open(filp, prof_hist_show, inode->i_private);
+}
+
+// any write clears the histogram and the raw samples
+static ssize_t prof_hist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off)
+{
+    struct seq_file *m = filp->private_data;
+
+    prof_reset(m->private);
+
+    return len;
+}
+
+static const struct file_operations prof_hist_fops = {
+    .owner      = THIS_MODULE,
+    .open       = prof_hist_open,
+    .read       = seq_read,
+    .write      = prof_hist_write,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+int swd_profiler_init(struct swd_device *sd)
+{
+    struct swd_profiler *prof = &profiler;
+
+    prof->sd = sd;
+    swd_dbg_enable_init(&prof->enable, prof_set, prof);
+    spin_lock_init(&prof->hist_lock);
+    swd_dbg_ring_init(&prof->ring, &prof->hist_lock, sizeof(u32), PROF_RING_SIZE);
+
+    prof->hist = vzalloc(PROF_HIST_SIZE * sizeof(struct prof_bucket));
+    prof->ring.recs = vmalloc(PROF_RING_SIZE * sizeof(u32));
+    if (!prof->hist || !prof->ring.recs) {
+        vfree(prof->hist);
+        vfree(prof->ring.recs);
+        return -ENOMEM;
+    }
+
+    // no debugfs is not an error, the profiler is just not there
+    prof->dir = debugfs_create_dir("pcsr", sd->debugfs);
+    swd_dbg_enable_create("enable", prof->dir, &prof->enable);
+    debugfs_create_u32("period_us", 0644, prof->dir, &prof->period_us);
+    debugfs_create_u32("burst", 0644, prof->dir, &prof->burst);
+    debugfs_create_file("hist", 0644, prof->dir, prof, &prof_hist_fops);
+    // raw samples as u32 pcs in the order taken
+    swd_dbg_ring_create("samples", prof->dir, &prof->ring);
+
+    return 0;
+}
+
+void swd_profiler_exit(struct swd_device *sd)
+{
+    struct swd_profiler *prof = &profiler;
+
+    debugfs_remove_recursive(prof->dir);
+
+    swd_dbg_enable_set(&prof->enable, false);
+
+    vfree(prof->hist);
+    vfree(prof->ring.recs);
+}
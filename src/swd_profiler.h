@@ -0,0 +1,10 @@
+#ifndef SWD_PROFILER_H
+#define SWD_PROFILER_H
+
+#include "swd_drv.h"
+
+int swd_profiler_init(struct swd_device *sd);
+
+void swd_profiler_exit(struct swd_device *sd);
+
+#endif
@@ -0,0 +1,720 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "swd_drv.h"
+#include "swd_session.h"
+#include "swd_rtt.h"
+#include "swd_bitstream.h"
+
+#define RTT_NAME "swd_rtt"
+
+#define RTT_MAX_CHANNELS    4       // /dev/swd_rtt0 - /dev/swd_rtt3
+#define RTT_MAX_UP          16      // up descriptors read in the index burst
+#define RTT_FIFO_SIZE       4096
+#define RTT_ID              "SEGGER RTT"
+#define RTT_ID_LEN          16
+#define RTT_CB_HDR_SIZE     24      // acID[16], MaxNumUpBuffers, MaxNumDownBuffers
+#define RTT_DESC_SIZE       24      // sName, pBuffer, SizeOfBuffer, WrOff, RdOff, Flags
+#define RTT_DESC_WORDS      (RTT_DESC_SIZE / sizeof(u32))
+#define RTT_DESC_WROFF      12
+#define RTT_DESC_RDOFF      16
+#define RTT_SCAN_CHUNK      SWD_TAR_WRAP
+#define RTT_BOUNCE_SIZE     SWD_TAR_WRAP
+#define RTT_ERR_RECOVER     3
+#define RTT_SLACK_NS        (20 * NSEC_PER_USEC)
+
+static unsigned int rtt_addr = 0;
+module_param(rtt_addr, uint, 0644);
+MODULE_PARM_DESC(rtt_addr, "address of the RTT control block, 0 scans the sram for it");
+
+// a zero interval would keep the thread taking the bus
+static int rtt_poll_set(const char *val, const struct kernel_param *kp)
+{
+    int ret;
+    unsigned int us;
+
+    ret = kstrtouint(val, 0, &us);
+    if (ret)
+        return ret;
+
+    if (!us)
+        return -EINVAL;
+
+    return param_set_uint(val, kp);
+}
+
+static const struct kernel_param_ops rtt_poll_ops = {
+    .set = rtt_poll_set,
+    .get = param_get_uint,
+};
+
+static unsigned int rtt_poll_min_us = 100;
+module_param_cb(rtt_poll_min_us, &rtt_poll_ops, &rtt_poll_min_us, 0644);
+MODULE_PARM_DESC(rtt_poll_min_us, "shortest RTT poll interval(us), used while data is moving, at least 1");
+
+static unsigned int rtt_poll_max_us = 100000;
+module_param_cb(rtt_poll_max_us, &rtt_poll_ops, &rtt_poll_max_us, 0644);
+MODULE_PARM_DESC(rtt_poll_max_us, "longest RTT poll interval(us), used while the channels are idle");
+
+struct rtt_desc {
+    u32 name;
+    u32 buf;
+    u32 size;
+    u32 wr_off;
+    u32 rd_off;
+    u32 flags;
+};
+
+struct rtt_channel {
+    int idx;
+    char name[16];
+    struct miscdevice misc;
+    bool opened;
+    struct kfifo rx;            // up buffer, target -> host
+    struct kfifo tx;            // down buffer, host -> target
+    struct mutex rx_lock;
+    struct mutex tx_lock;
+    wait_queue_head_t rx_wq;
+    wait_queue_head_t tx_wq;
+};
+
+struct swd_rtt {
+    struct swd_device *sd;
+    struct mutex lock;          // protects users, control block and thread
+    struct task_struct *thread;
+    bool kick;
+    int users;
+    int errors;
+
+    u32 cb_addr;
+    u32 max_up;
+    u32 max_down;
+    struct rtt_desc desc[RTT_MAX_UP + RTT_MAX_CHANNELS];
+    u32 bounce[RTT_BOUNCE_SIZE / sizeof(u32)];
+
+    struct rtt_channel ch[RTT_MAX_CHANNELS];
+};
+
+static struct swd_rtt rtt;
+
+// The cores split the bursts where the TAR auto increment wraps,
+// only a short read or write is continued here.
+static int rtt_read_mem(struct swd_rtt *r, void *to, u32 base, u32 len)
+{
+    u32 pos = 0;
+    ssize_t read_len;
+    struct rproc_core *rc = r->sd->rc;
+
+    while (pos < len) {
+        read_len = rc->read_ram((char*)to + pos, base + pos, len - pos);
+        if (read_len <= 0)
+            return -EIO;
+        pos += read_len;
+    }
+
+    return 0;
+}
+
+static int rtt_write_mem(struct swd_rtt *r, void *from, u32 base, u32 len)
+{
+    u32 pos = 0;
+    ssize_t write_len;
+    struct rproc_core *rc = r->sd->rc;
+
+    while (pos < len) {
+        write_len = rc->write_mem((char*)from + pos, base + pos, len - pos);
+        if (write_len <= 0)
+            return -EIO;
+        pos += write_len;
+    }
+
+    return 0;
+}
+
+static int rtt_check_cb(struct swd_rtt *r, u32 addr)
+{
+    int ret;
+    u32 hdr[RTT_CB_HDR_SIZE / sizeof(u32)];
+
+    ret = rtt_read_mem(r, hdr, addr, RTT_CB_HDR_SIZE);
+    if (ret)
+        return ret;
+
+    if (memcmp(hdr, RTT_ID, sizeof(RTT_ID)))
+        return -ENOENT;
+
+    r->cb_addr = addr;
+    r->max_up = hdr[RTT_ID_LEN / sizeof(u32)];
+    r->max_down = hdr[RTT_ID_LEN / sizeof(u32) + 1];
+
+    if ((r->max_up > RTT_MAX_UP) || (r->max_down > RTT_MAX_UP)) {
+        pr_err("%s: [%s] %d too many buffers up:%u down:%u\n", RTT_NAME, __func__, __LINE__,
+                r->max_up, r->max_down);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+// Look for the control block id in [start, start + size).
+// Chunks overlap by the id length, so an id across two chunks is not missed.
+static int rtt_scan_range(struct swd_rtt *r, u32 start, u32 size)
+{
+    int ret;
+    u32 pos;
+    u32 off;
+    u32 len;
+    char *chunk = (char*)r->bounce;
+
+    for (pos = 0 ; pos + RTT_ID_LEN <= size ; pos += RTT_SCAN_CHUNK - RTT_ID_LEN) {
+        len = min_t(u32, RTT_SCAN_CHUNK, size - pos);
+
+        ret = rtt_read_mem(r, chunk, start + pos, len);
+        if (ret)
+            return ret;
+
+        for (off = 0 ; off + RTT_ID_LEN <= len ; off += sizeof(u32)) {
+            if (!memcmp(chunk + off, RTT_ID, sizeof(RTT_ID)))
+                return rtt_check_cb(r, start + pos + off);
+        }
+    }
+
+    return -ENOENT;
+}
+
+static int rtt_locate(struct swd_rtt *r)
+{
+    int i;
+    int ret;
+    struct core_mem *cm = r->sd->rc->ci->cm;
+
+    if (rtt_addr)
+        return rtt_check_cb(r, rtt_addr & ~0x3);
+
+    // still at the place found last time
+    if (r->cb_addr && !rtt_check_cb(r, r->cb_addr))
+        return 0;
+
+    r->cb_addr = 0;
+    if (!cm->sram.attr) {
+        ret = rtt_scan_range(r, cm->sram.base, cm->sram.len);
+    } else {
+        ret = -ENOENT;
+        for (i = cm->sram.offset ; (ret == -ENOENT) && (i < cm->sram.offset + cm->sram.len) ; i++)
+            ret = rtt_scan_range(r, cm->mem_segs[i].start, cm->mem_segs[i].size);
+    }
+
+    if (!ret)
+        pr_info("%s: [%s] %d control block at %08x up:%u down:%u\n", RTT_NAME, __func__, __LINE__,
+                r->cb_addr, r->max_up, r->max_down);
+
+    return ret;
+}
+
+// Read all up and down descriptors in a single burst, they are contiguous
+// after the control block header.
+static int rtt_read_desc(struct swd_rtt *r)
+{
+    u32 nr_down = min_t(u32, r->max_down, RTT_MAX_CHANNELS);
+
+    return rtt_read_mem(r, r->desc, r->cb_addr + RTT_CB_HDR_SIZE,
+                        (r->max_up + nr_down) * RTT_DESC_SIZE);
+}
+
+static u32 rtt_desc_addr(struct swd_rtt *r, bool up, int idx)
+{
+    return r->cb_addr + RTT_CB_HDR_SIZE + (up ? idx : r->max_up + idx) * RTT_DESC_SIZE;
+}
+
+// Copy [addr, addr + len) of the target into the rx fifo through the bounce buffer.
+static int rtt_up_copy(struct swd_rtt *r, struct rtt_channel *ch, u32 addr, u32 len)
+{
+    int ret;
+    u32 chunk;
+    char *bounce = (char*)r->bounce;
+
+    while (len) {
+        chunk = min_t(u32, len, RTT_BOUNCE_SIZE);
+
+        ret = rtt_read_mem(r, bounce, addr, chunk);
+        if (ret)
+            return ret;
+
+        kfifo_in(&ch->rx, bounce, chunk);
+
+        addr += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+// Copy len bytes from the tx fifo to [addr, addr + len) of the target.
+// The unaligned edges are byte/halfword writes, the bytes around are not touched.
+static int rtt_down_copy(struct swd_rtt *r, struct rtt_channel *ch, u32 addr, u32 len)
+{
+    int ret;
+    u32 chunk;
+    char *bounce = (char*)r->bounce;
+
+    while (len) {
+        chunk = min_t(u32, len, RTT_BOUNCE_SIZE);
+
+        kfifo_out_peek(&ch->tx, bounce, chunk);
+
+        ret = rtt_write_mem(r, bounce, addr, chunk);
+        if (ret)
+            return ret;
+
+        // only drop what reached the target
+        kfifo_out(&ch->tx, bounce, chunk);
+
+        addr += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+static int rtt_poll_up(struct swd_rtt *r, struct rtt_channel *ch, struct rtt_desc *d, u32 *moved)
+{
+    int ret;
+    u32 avail;
+    u32 len;
+    u32 rd = d->rd_off;
+    u32 wr = d->wr_off;
+
+    if (!d->buf || !d->size || (rd >= d->size) || (wr >= d->size))
+        return 0;
+
+    avail = (wr >= rd) ? wr - rd : d->size - rd + wr;
+    avail = min_t(u32, avail, kfifo_avail(&ch->rx));
+    if (!avail)
+        return 0;
+
+    mutex_lock(&ch->rx_lock);
+
+    // up to the end of the buffer, then from its start
+    len = min_t(u32, avail, d->size - rd);
+    ret = rtt_up_copy(r, ch, d->buf + rd, len);
+    if (!ret && (avail > len))
+        ret = rtt_up_copy(r, ch, d->buf, avail - len);
+
+    mutex_unlock(&ch->rx_lock);
+
+    if (ret)
+        return ret;
+
+    rd = (rd + avail) % d->size;
+    ret = rtt_write_mem(r, &rd, rtt_desc_addr(r, true, ch->idx) + RTT_DESC_RDOFF, sizeof(u32));
+    if (ret)
+        return ret;
+
+    *moved += avail;
+    wake_up_interruptible(&ch->rx_wq);
+
+    return 0;
+}
+
+static int rtt_poll_down(struct swd_rtt *r, struct rtt_channel *ch, struct rtt_desc *d, u32 *moved)
+{
+    int ret;
+    u32 space;
+    u32 len;
+    u32 rd = d->rd_off;
+    u32 wr = d->wr_off;
+
+    if (!d->buf || !d->size || (rd >= d->size) || (wr >= d->size))
+        return 0;
+
+    // one byte is kept free to tell a full buffer from an empty one
+    space = (rd > wr) ? rd - wr - 1 : d->size - wr + rd - 1;
+
+    mutex_lock(&ch->tx_lock);
+
+    space = min_t(u32, space, kfifo_len(&ch->tx));
+    if (!space) {
+        mutex_unlock(&ch->tx_lock);
+        return 0;
+    }
+
+    len = min_t(u32, space, d->size - wr);
+    ret = rtt_down_copy(r, ch, d->buf + wr, len);
+    if (!ret && (space > len))
+        ret = rtt_down_copy(r, ch, d->buf, space - len);
+
+    mutex_unlock(&ch->tx_lock);
+
+    if (ret)
+        return ret;
+
+    wr = (wr + space) % d->size;
+    ret = rtt_write_mem(r, &wr, rtt_desc_addr(r, false, ch->idx) + RTT_DESC_WROFF, sizeof(u32));
+    if (ret)
+        return ret;
+
+    *moved += space;
+    wake_up_interruptible(&ch->tx_wq);
+
+    return 0;
+}
+
+// Look for the control block again, the channels are not polled until
+// it is found.
+static int rtt_relocate(struct swd_rtt *r)
+{
+    int ret;
+
+    ret = rtt_locate(r);
+    if (ret)
+        r->cb_addr = 0;
+
+    return ret;
+}
+
+static int rtt_poll_once(struct swd_rtt *r, u32 *moved)
+{
+    int i;
+    int ret;
+    struct rtt_channel *ch;
+
+    ret = rtt_read_desc(r);
+    if (ret)
+        return ret;
+
+    for (i = 0 ; i < RTT_MAX_CHANNELS ; i++) {
+        ch = &r->ch[i];
+        if (!ch->opened)
+            continue;
+
+        if (i < r->max_up) {
+            ret = rtt_poll_up(r, ch, &r->desc[i], moved);
+            if (ret)
+                return ret;
+        }
+
+        if (i < r->max_down) {
+            ret = rtt_poll_down(r, ch, &r->desc[r->max_up + i], moved);
+            if (ret)
+                return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int rtt_thread(void *data)
+{
+    int ret;
+    u32 moved;
+    u32 interval_us = max_t(u32, rtt_poll_min_us, 1);
+    ktime_t timeout;
+    struct swd_rtt *r = data;
+    struct swd_device *sd = r->sd;
+
+    pr_info("%s: [%s] %d start\n", RTT_NAME, __func__, __LINE__);
+
+    while (!kthread_should_stop()) {
+        moved = 0;
+
+        swd_bus_lock(sd);
+        if (r->cb_addr || !rtt_relocate(r)) {
+            ret = rtt_poll_once(r, &moved);
+            if (ret && (++r->errors >= RTT_ERR_RECOVER)) {
+                // a target reset moves or clears the control block
+                if (!swd_session_recover(sd))
+                    rtt_relocate(r);
+                r->errors = 0;
+            } else if (!ret) {
+                r->errors = 0;
+            }
+        }
+        swd_bus_unlock(sd);
+
+        // poll fast while data is moving, back off while idle
+        if (moved)
+            interval_us = max_t(u32, interval_us / 2, rtt_poll_min_us);
+        else
+            interval_us = min_t(u32, interval_us * 2, rtt_poll_max_us);
+        interval_us = max_t(u32, interval_us, 1);
+
+        timeout = ns_to_ktime((u64)interval_us * NSEC_PER_USEC);
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!READ_ONCE(r->kick) && !kthread_should_stop())
+            schedule_hrtimeout_range(&timeout, RTT_SLACK_NS, HRTIMER_MODE_REL);
+        __set_current_state(TASK_RUNNING);
+
+        // a writer woke us up, new data will follow soon
+        if (xchg(&r->kick, false))
+            interval_us = max_t(u32, rtt_poll_min_us, 1);
+    }
+
+    pr_info("%s: [%s] %d stop\n", RTT_NAME, __func__, __LINE__);
+
+    return 0;
+}
+
+static void rtt_kick(struct swd_rtt *r)
+{
+    WRITE_ONCE(r->kick, true);
+    wake_up_process(r->thread);
+}
+
+static int rtt_start(struct swd_rtt *r)
+{
+    int ret;
+    struct swd_device *sd = r->sd;
+
+    swd_bus_lock(sd);
+    ret = swd_session_get(sd);
+    if (ret) {
+        swd_bus_unlock(sd);
+        return ret;
+    }
+
+    ret = rtt_locate(r);
+    if (ret) {
+        pr_err("%s: [%s] %d no control block found\n", RTT_NAME, __func__, __LINE__);
+        goto rtt_start_fail;
+    }
+
+    r->thread = kthread_run(rtt_thread, r, RTT_NAME);
+    if (IS_ERR(r->thread)) {
+        ret = PTR_ERR(r->thread);
+        r->thread = NULL;
+        goto rtt_start_fail;
+    }
+
+    swd_bus_unlock(sd);
+
+    return 0;
+
+rtt_start_fail:
+    swd_session_put(sd, false);
+    swd_bus_unlock(sd);
+
+    return ret;
+}
+
+static void rtt_stop(struct swd_rtt *r)
+{
+    kthread_stop(r->thread);
+    r->thread = NULL;
+
+    swd_bus_lock(r->sd);
+    swd_session_put(r->sd, false);
+    swd_bus_unlock(r->sd);
+}
+
+static int rtt_open(struct inode *inode, struct file *filp)
+{
+    int ret = 0;
+    struct swd_rtt *r = &rtt;
+    struct rtt_channel *ch = container_of(filp->private_data, struct rtt_channel, misc);
+
+    mutex_lock(&r->lock);
+
+    if (ch->opened) {
+        ret = -EBUSY;
+        goto rtt_open_out;
+    }
+
+    if (!r->users) {
+        ret = rtt_start(r);
+        if (ret)
+            goto rtt_open_out;
+    }
+
+    if ((ch->idx >= r->max_up) && (ch->idx >= r->max_down)) {
+        ret = -ENODEV;
+        if (!r->users)
+            rtt_stop(r);
+        goto rtt_open_out;
+    }
+
+    kfifo_reset(&ch->rx);
+    kfifo_reset(&ch->tx);
+    ch->opened = true;
+    r->users++;
+
+    filp->private_data = ch;
+
+rtt_open_out:
+    mutex_unlock(&r->lock);
+
+    return ret;
+}
+
+static int rtt_release(struct inode *inode, struct file *filp)
+{
+    struct swd_rtt *r = &rtt;
+    struct rtt_channel *ch = filp->private_data;
+
+    mutex_lock(&r->lock);
+
+    ch->opened = false;
+    if (!--r->users)
+        rtt_stop(r);
+
+    mutex_unlock(&r->lock);
+
+    return 0;
+}
+
+static ssize_t rtt_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
+{
+    int ret;
+    unsigned int copied;
+    struct rtt_channel *ch = filp->private_data;
+
+    if (ch->idx >= rtt.max_up)
+        return -EINVAL;
+
+    if (kfifo_is_empty(&ch->rx)) {
+        if (filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+
+        ret = wait_event_interruptible(ch->rx_wq, !kfifo_is_empty(&ch->rx));
+        if (ret)
+            return ret;
+    }
+
+    mutex_lock(&ch->rx_lock);
+    ret = kfifo_to_user(&ch->rx, buf, len, &copied);
+    mutex_unlock(&ch->rx_lock);
+
+    // room in the fifo, let the poller pick up what is pending
+    if (copied)
+        rtt_kick(&rtt);
+
+    return ret ? ret : copied;
+}
+
+static ssize_t rtt_write(struct file *filp, const char __user *buf, size_t len, loff_t *off)
+{
+    int ret;
+    unsigned int copied;
+    struct rtt_channel *ch = filp->private_data;
+
+    if (ch->idx >= rtt.max_down)
+        return -EINVAL;
+
+    if (!kfifo_avail(&ch->tx)) {
+        if (filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+
+        ret = wait_event_interruptible(ch->tx_wq, kfifo_avail(&ch->tx));
+        if (ret)
+            return ret;
+    }
+
+    mutex_lock(&ch->tx_lock);
+    ret = kfifo_from_user(&ch->tx, buf, len, &copied);
+    mutex_unlock(&ch->tx_lock);
+
+    if (copied)
+        rtt_kick(&rtt);
+
+    return ret ? ret : copied;
+}
+
+static __poll_t rtt_poll(struct file *filp, poll_table *wait)
+{
+    __poll_t mask = 0;
+    struct rtt_channel *ch = filp->private_data;
+
+    poll_wait(filp, &ch->rx_wq, wait);
+    poll_wait(filp, &ch->tx_wq, wait);
+
+    if (!kfifo_is_empty(&ch->rx))
+        mask |= EPOLLIN | EPOLLRDNORM;
+
+    if ((ch->idx < rtt.max_down) && kfifo_avail(&ch->tx))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+
+    return mask;
+}
+
+static const struct file_operations rtt_fops = {
+    .owner          = THIS_MODULE,
+    .open           = rtt_open,
+    .release        = rtt_release,
+    .read           = rtt_read,
+    .write          = rtt_write,
+    .poll           = rtt_poll,
+    .llseek         = no_llseek,
+};
+
+int swd_rtt_init(struct swd_device *sd)
+{
+    int i;
+    int ret;
+    struct rtt_channel *ch;
+
+    rtt.sd = sd;
+    mutex_init(&rtt.lock);
+
+    for (i = 0 ; i < RTT_MAX_CHANNELS ; i++) {
+        ch = &rtt.ch[i];
+        ch->idx = i;
+        mutex_init(&ch->rx_lock);
+        mutex_init(&ch->tx_lock);
+        init_waitqueue_head(&ch->rx_wq);
+        init_waitqueue_head(&ch->tx_wq);
+
+        ret = kfifo_alloc(&ch->rx, RTT_FIFO_SIZE, GFP_KERNEL);
+        if (ret)
+            goto swd_rtt_init_fail;
+
+        ret = kfifo_alloc(&ch->tx, RTT_FIFO_SIZE, GFP_KERNEL);
+        if (ret) {
+            kfifo_free(&ch->rx);
+            goto swd_rtt_init_fail;
+        }
+
+        snprintf(ch->name, sizeof(ch->name), RTT_NAME "%d", i);
+        ch->misc.minor = MISC_DYNAMIC_MINOR;
+        ch->misc.name = ch->name;
+        ch->misc.fops = &rtt_fops;
+        ch->misc.parent = sd->dev;
+
+        ret = misc_register(&ch->misc);
+        if (ret) {
+            kfifo_free(&ch->tx);
+            kfifo_free(&ch->rx);
+            goto swd_rtt_init_fail;
+        }
+    }
+
+    return 0;
+
+swd_rtt_init_fail:
+    while (i--) {
+        ch = &rtt.ch[i];
+        misc_deregister(&ch->misc);
+        kfifo_free(&ch->tx);
+        kfifo_free(&ch->rx);
+    }
+
+    return ret;
+}
+
+void swd_rtt_exit(struct swd_device *sd)
+{
+    int i;
+    struct rtt_channel *ch;
+
+    for (i = 0 ; i < RTT_MAX_CHANNELS ; i++) {
+        ch = &rtt.ch[i];
+        misc_deregister(&ch->misc);
+        kfifo_free(&ch->tx);
+        kfifo_free(&ch->rx);
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef SWD_RTT_H
+#define SWD_RTT_H
+
+#include "swd_drv.h"
+
+int swd_rtt_init(struct swd_device *sd);
+
+void swd_rtt_exit(struct swd_device *sd);
+
+#endif
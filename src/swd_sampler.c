@@ -0,0 +1,482 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/miscdevice.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+
+#include "swd_drv.h"
+#include "swd_session.h"
+#include "swd_sampler.h"
+#include "swd_bitstream.h"
+#include "../include/swd_module.h"
+
+#define SAMPLER_NAME "swd_sampler"
+
+#define SAMPLER_MIN_PERIOD_US   100
+#define SAMPLER_MAX_RECORDS     65536
+#define SAMPLER_SLACK_NS        (10 * NSEC_PER_USEC)
+
+// contiguous words read in one pipelined MEM-AP burst
+struct sampler_span {
+    u32 base;
+    u32 nr_words;
+    u32 word_idx;   // first word of the span in words[]
+};
+
+struct swd_sampler {
+    struct swd_device *sd;
+    struct mutex lock;      // protects cfg, ring and thread
+    struct task_struct *thread;
+    wait_queue_head_t wq;
+    bool opened;
+
+    struct swd_sampler_cfg cfg;
+    struct sampler_span spans[SWD_SAMPLER_MAX_VARS];
+    u32 nr_spans;
+    u32 var_word[SWD_SAMPLER_MAX_VARS];
+    u32 words[SWD_SAMPLER_MAX_VARS];   // a variable adds one word at most
+    u32 seq;
+
+    struct swd_sampler_ring *ring;
+    size_t ring_size;
+};
+
+static struct swd_sampler sampler;
+
+// Group the variables into word aligned spans, so each span is one
+// TAR setup followed by auto incremented DRW reads.
+static int sampler_plan(struct swd_sampler *smp, struct swd_sampler_cfg *cfg)
+{
+    int i, j;
+    u32 word;
+    u32 nr_words = 0;
+    u8 order[SWD_SAMPLER_MAX_VARS];
+    struct sampler_span *span = NULL;
+
+    for (i = 0 ; i < cfg->nr_vars ; i++) {
+        struct swd_sampler_var *var = &cfg->vars[i];
+
+        if ((var->width != 1) && (var->width != 2) && (var->width != 4))
+            return -EINVAL;
+
+        // a variable crossing a word can not be read atomically
+        if ((var->addr & 0x3) + var->width > sizeof(u32))
+            return -EINVAL;
+
+        order[i] = i;
+    }
+
+    // sort by address, there are only a few variables
+    for (i = 1 ; i < cfg->nr_vars ; i++) {
+        for (j = i ; j > 0 && cfg->vars[order[j]].addr < cfg->vars[order[j - 1]].addr ; j--)
+            swap(order[j], order[j - 1]);
+    }
+
+    smp->nr_spans = 0;
+    for (i = 0 ; i < cfg->nr_vars ; i++) {
+        word = cfg->vars[order[i]].addr & ~0x3;
+
+        if (!span || (word > span->base + span->nr_words * sizeof(u32)) || \
+            ((word & ~(SWD_TAR_WRAP - 1)) != (span->base & ~(SWD_TAR_WRAP - 1)))) {
+            span = &smp->spans[smp->nr_spans++];
+            span->base = word;
+            span->nr_words = 0;
+            span->word_idx = nr_words;
+        }
+
+        if (word == span->base + span->nr_words * sizeof(u32)) {
+            span->nr_words++;
+            nr_words++;
+        }
+
+        smp->var_word[order[i]] = span->word_idx + (word - span->base) / sizeof(u32);
+    }
+
+    return 0;
+}
+
+static int sampler_read_spans(struct swd_sampler *smp)
+{
+    int i;
+    u32 pos;
+    u32 len;
+    ssize_t read_len;
+    struct rproc_core *rc = smp->sd->rc;
+
+    for (i = 0 ; i < smp->nr_spans ; i++) {
+        struct sampler_span *span = &smp->spans[i];
+        char *to = (char*)&smp->words[span->word_idx];
+
+        pos = 0;
+        len = span->nr_words * sizeof(u32);
+        while (pos < len) {
+            read_len = rc->read_ram(to + pos, span->base + pos, len - pos);
+            if (read_len <= 0)
+                return -EIO;
+            pos += read_len;
+        }
+    }
+
+    return 0;
+}
+
+static u32 sampler_avail(struct swd_sampler *smp)
+{
+    struct swd_sampler_ring *ring = smp->ring;
+
+    if (!ring)
+        return 0;
+
+    return smp_load_acquire(&ring->head) - READ_ONCE(ring->tail);
+}
+
+static void sampler_push(struct swd_sampler *smp, u64 timestamp)
+{
+    int i;
+    u32 val;
+    u32 head;
+    struct swd_sampler_record *rec;
+    struct swd_sampler_ring *ring = smp->ring;
+
+    head = ring->head;
+    if (head - READ_ONCE(ring->tail) >= ring->nr_records) {
+        ring->dropped++;
+        return;
+    }
+
+    rec = (struct swd_sampler_record*)((char*)ring + ring->rec_offset + \
+            (head % ring->nr_records) * ring->rec_size);
+    rec->timestamp_ns = timestamp;
+    rec->seq = smp->seq++;
+    rec->nr_vars = smp->cfg.nr_vars;
+
+    for (i = 0 ; i < smp->cfg.nr_vars ; i++) {
+        struct swd_sampler_var *var = &smp->cfg.vars[i];
+
+        val = smp->words[smp->var_word[i]] >> ((var->addr & 0x3) * 8);
+        if (var->width < sizeof(u32))
+            val &= BIT(var->width * 8) - 1;
+        rec->values[i] = val;
+    }
+
+    smp_store_release(&ring->head, head + 1);
+    wake_up_interruptible(&smp->wq);
+}
+
+static int sampler_thread(void *data)
+{
+    int ret;
+    u64 timestamp;
+    ktime_t next;
+    struct swd_sampler *smp = data;
+    struct swd_device *sd = smp->sd;
+    u64 period_ns = (u64)smp->cfg.period_us * NSEC_PER_USEC;
+
+    pr_info("%s: [%s] %d start period:%uus vars:%u spans:%u\n", SAMPLER_NAME, __func__, __LINE__,
+            smp->cfg.period_us, smp->cfg.nr_vars, smp->nr_spans);
+
+    next = ktime_get();
+    while (!kthread_should_stop()) {
+        next = ktime_add_ns(next, period_ns);
+
+        // never wait for the bus, a late sample is worse than a missing one
+        if (mutex_trylock(&sd->bus_lock)) {
+            timestamp = ktime_get_ns();
+            ret = sampler_read_spans(smp);
+            swd_bus_unlock(sd);
+
+            if (!ret)
+                sampler_push(smp, timestamp);
+            else
+                smp->ring->missed++;
+        } else {
+            smp->ring->missed++;
+        }
+
+        // fell behind, skip the periods already passed
+        while (ktime_before(next, ktime_get())) {
+            next = ktime_add_ns(next, period_ns);
+            smp->ring->missed++;
+        }
+
+        set_current_state(TASK_INTERRUPTIBLE);
+        schedule_hrtimeout_range(&next, SAMPLER_SLACK_NS, HRTIMER_MODE_ABS);
+    }
+
+    pr_info("%s: [%s] %d stop\n", SAMPLER_NAME, __func__, __LINE__);
+
+    return 0;
+}
+
+static void sampler_stop(struct swd_sampler *smp)
+{
+    if (!smp->thread)
+        return;
+
+    kthread_stop(smp->thread);
+    smp->thread = NULL;
+    wake_up_interruptible(&smp->wq);
+
+    swd_bus_lock(smp->sd);
+    swd_session_put(smp->sd, false);
+    swd_bus_unlock(smp->sd);
+}
+
+static int sampler_start(struct swd_sampler *smp)
+{
+    int ret;
+    struct swd_device *sd = smp->sd;
+
+    if (!smp->ring)
+        return -EINVAL;
+
+    if (smp->thread)
+        return -EBUSY;
+
+    swd_bus_lock(sd);
+    ret = swd_session_get(sd);
+    swd_bus_unlock(sd);
+    if (ret)
+        return ret;
+
+    smp->thread = kthread_run(sampler_thread, smp, SAMPLER_NAME);
+    if (IS_ERR(smp->thread)) {
+        ret = PTR_ERR(smp->thread);
+        smp->thread = NULL;
+        return ret;
+    }
+
+    return 0;
+}
+
+static int sampler_config(struct swd_sampler *smp, struct swd_sampler_cfg __user *ucfg)
+{
+    int ret;
+    u32 rec_size;
+    size_t ring_size;
+    struct swd_sampler_ring *ring;
+    struct swd_sampler_cfg *cfg;
+
+    if (smp->thread)
+        return -EBUSY;
+
+    cfg = memdup_user(ucfg, sizeof(struct swd_sampler_cfg));
+    if (IS_ERR(cfg))
+        return PTR_ERR(cfg);
+
+    if (!cfg->nr_vars || (cfg->nr_vars > SWD_SAMPLER_MAX_VARS) || \
+        !cfg->nr_records || (cfg->nr_records > SAMPLER_MAX_RECORDS) || \
+        (cfg->period_us < SAMPLER_MIN_PERIOD_US)) {
+        ret = -EINVAL;
+        goto sampler_config_fail;
+    }
+
+    ret = sampler_plan(smp, cfg);
+    if (ret) {
+        // the old plan is gone, so is the old configuration
+        vfree(smp->ring);
+        smp->ring = NULL;
+        goto sampler_config_fail;
+    }
+
+    rec_size = sizeof(struct swd_sampler_record) + cfg->nr_vars * sizeof(u32);
+    ring_size = PAGE_ALIGN(PAGE_SIZE + (size_t)rec_size * cfg->nr_records);
+
+    ring = vmalloc_user(ring_size);
+    if (!ring) {
+        ret = -ENOMEM;
+        goto sampler_config_fail;
+    }
+
+    ring->rec_size = rec_size;
+    ring->nr_records = cfg->nr_records;
+    ring->rec_offset = PAGE_SIZE;
+
+    vfree(smp->ring);
+    smp->ring = ring;
+    smp->ring_size = ring_size;
+    smp->cfg = *cfg;
+    smp->seq = 0;
+
+sampler_config_fail:
+    kfree(cfg);
+
+    return ret;
+}
+
+static int sampler_open(struct inode *inode, struct file *filp)
+{
+    struct swd_sampler *smp = &sampler;
+
+    mutex_lock(&smp->lock);
+    if (smp->opened) {
+        mutex_unlock(&smp->lock);
+        return -EBUSY;
+    }
+    smp->opened = true;
+    mutex_unlock(&smp->lock);
+
+    filp->private_data = smp;
+
+    return 0;
+}
+
+static int sampler_release(struct inode *inode, struct file *filp)
+{
+    struct swd_sampler *smp = filp->private_data;
+
+    mutex_lock(&smp->lock);
+    sampler_stop(smp);
+    vfree(smp->ring);
+    smp->ring = NULL;
+    smp->opened = false;
+    mutex_unlock(&smp->lock);
+
+    return 0;
+}
+
+static ssize_t sampler_read(struct file *filp, char __user *buf, size_t len, loff_t *off)
+{
+    int ret;
+    u32 tail;
+    u32 nr;
+    u32 i;
+    ssize_t copied = 0;
+    struct swd_sampler *smp = filp->private_data;
+    struct swd_sampler_ring *ring;
+
+    if (filp->f_flags & O_NONBLOCK) {
+        if (!sampler_avail(smp))
+            return -EAGAIN;
+    } else {
+        ret = wait_event_interruptible(smp->wq, sampler_avail(smp) || !smp->thread);
+        if (ret)
+            return ret;
+    }
+
+    mutex_lock(&smp->lock);
+
+    ring = smp->ring;
+    if (!ring) {
+        mutex_unlock(&smp->lock);
+        return 0;
+    }
+
+    if (len < ring->rec_size) {
+        mutex_unlock(&smp->lock);
+        return -EINVAL;
+    }
+
+    tail = ring->tail;
+    nr = min_t(u32, sampler_avail(smp), len / ring->rec_size);
+    for (i = 0 ; i < nr ; i++) {
+        char *rec = (char*)ring + ring->rec_offset + \
+                    ((tail + i) % ring->nr_records) * ring->rec_size;
+
+        if (copy_to_user(buf + copied, rec, ring->rec_size)) {
+            copied = copied ? copied : -EFAULT;
+            break;
+        }
+        copied += ring->rec_size;
+    }
+
+    if (copied > 0)
+        smp_store_release(&ring->tail, tail + copied / ring->rec_size);
+
+    mutex_unlock(&smp->lock);
+
+    return copied;
+}
+
+static __poll_t sampler_poll(struct file *filp, poll_table *wait)
+{
+    struct swd_sampler *smp = filp->private_data;
+
+    poll_wait(filp, &smp->wq, wait);
+
+    if (sampler_avail(smp))
+        return EPOLLIN | EPOLLRDNORM;
+
+    return 0;
+}
+
+static int sampler_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    int ret;
+    struct swd_sampler *smp = filp->private_data;
+
+    mutex_lock(&smp->lock);
+    if (!smp->ring)
+        ret = -ENODATA;
+    else
+        ret = remap_vmalloc_range(vma, smp->ring, vma->vm_pgoff);
+    mutex_unlock(&smp->lock);
+
+    return ret;
+}
+
+static long sampler_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    long ret;
+    struct swd_sampler *smp = filp->private_data;
+
+    mutex_lock(&smp->lock);
+
+    switch(cmd) {
+    case SWDDEV_IOC_SAMPLER_CFG:
+        ret = sampler_config(smp, (struct swd_sampler_cfg __user *)arg);
+        break;
+    case SWDDEV_IOC_SAMPLER_START:
+        ret = sampler_start(smp);
+        break;
+    case SWDDEV_IOC_SAMPLER_STOP:
+        sampler_stop(smp);
+        ret = 0;
+        break;
+    default:
+        pr_err("%s [%s] %d unknown cmd %08x\n", SAMPLER_NAME, __func__, __LINE__, cmd);
+        ret = -ENOTTY;
+    }
+
+    mutex_unlock(&smp->lock);
+
+    return ret;
+}
+
+static const struct file_operations sampler_fops = {
+    .owner          = THIS_MODULE,
+    .open           = sampler_open,
+    .release        = sampler_release,
+    .read           = sampler_read,
+    .poll           = sampler_poll,
+    .mmap           = sampler_mmap,
+    .unlocked_ioctl = sampler_ioctl,
+};
+
+static struct miscdevice sampler_misc = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = SAMPLER_NAME,
+    .fops = &sampler_fops,
+};
+
+int swd_sampler_init(struct swd_device *sd)
+{
+    sampler.sd = sd;
+    mutex_init(&sampler.lock);
+    init_waitqueue_head(&sampler.wq);
+
+    sampler_misc.parent = sd->dev;
+
+    return misc_register(&sampler_misc);
+}
+
+void swd_sampler_exit(struct swd_device *sd)
+{
+    misc_deregister(&sampler_misc);
+}
@@ -0,0 +1,10 @@
+#ifndef SWD_SAMPLER_H
+#define SWD_SAMPLER_H
+
+#include "swd_drv.h"
+
+int swd_sampler_init(struct swd_device *sd);
+
+void swd_sampler_exit(struct swd_device *sd);
+
+#endif
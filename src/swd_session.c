@@ -0,0 +1,149 @@
+#include <linux/module.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+
+#include "swd_drv.h"
+#include "swd_session.h"
+#include "swd_exec.h"
+
+static unsigned int session_idle_ms = 5000;
+module_param(session_idle_ms, uint, 0644);
+MODULE_PARM_DESC(session_idle_ms, "idle time(ms) before the debug session is detached, 0 keeps it attached");
+
+static bool reset_on_close = false;
+module_param(reset_on_close, bool, 0644);
+MODULE_PARM_DESC(reset_on_close, "reset the swd line when /dev/swd is closed");
+
+extern atomic_t open_lock;
+
+// detach the session once nobody used it for session_idle_ms,
+// the next user does the full attach again.
+static void swd_session_idle(struct work_struct *work)
+{
+    struct swd_session *ss = container_of(to_delayed_work(work), struct swd_session, idle_work);
+    struct swd_device *sd = container_of(ss, struct swd_device, session);
+
+    // someone is using the device, it will re-arm the timer when done
+    if(!atomic_dec_and_test(&open_lock)){
+        atomic_inc(&open_lock);
+        return;
+    }
+
+    if (mutex_trylock(&sd->bus_lock)) {
+        if (ss->attached)
+            pr_info("%s: [%s] %d session idle, detached\n", SWDDEV_NAME, __func__, __LINE__);
+        ss->attached = false;
+        swd_bus_unlock(sd);
+    }
+
+    atomic_inc(&open_lock);
+}
+
+// Attach to the target if the session is not attached yet.
+// Caller must hold the bus lock.
+int swd_session_get(struct swd_device *sd)
+{
+    int ret;
+    struct swd_session *ss = &sd->session;
+    struct rproc_core *rc = sd->rc;
+
+    cancel_delayed_work_sync(&ss->idle_work);
+
+    if (ss->attached)
+        return 0;
+
+    ret = rc->core_init();
+    if (ret) {
+        pr_err("%s: [%s] %d error with core_init\n", SWDDEV_NAME, __func__, __LINE__);
+        return ret;
+    }
+
+    // word access to the MEM-AP, so memory can be used without halting
+    ret = rc->setup_memap();
+    if (ret) {
+        pr_err("%s: [%s] %d error with setup_memap\n", SWDDEV_NAME, __func__, __LINE__);
+        return ret;
+    }
+
+    ss->idcode = rc->test_alive();
+    ss->attached = true;
+
+    // the target may have been reset, reflashed or powered off meanwhile
+    swd_exec_forget();
+    rc->erased_forget();
+
+    pr_info("%s: [%s] %d attached idcode:%08x\n", SWDDEV_NAME, __func__, __LINE__, ss->idcode);
+
+    return 0;
+}
+
+// Release the session, it stays attached until the idle timer expires.
+// Caller must hold the bus lock.
+void swd_session_put(struct swd_device *sd, bool closing)
+{
+    struct swd_session *ss = &sd->session;
+
+    if (closing && reset_on_close)
+        sd->rc->core_reset();
+
+    if (session_idle_ms)
+        schedule_delayed_work(&ss->idle_work, msecs_to_jiffies(session_idle_ms));
+}
+
+// A transaction failed, the cached DP/AP state can not be trusted anymore.
+// Reset the line and probe the DP/AP again.
+// Caller must hold the bus lock.
+int swd_session_recover(struct swd_device *sd)
+{
+    int ret;
+    u32 idcode;
+    struct swd_session *ss = &sd->session;
+
+    pr_info("%s: [%s] %d transaction failed, re-probing\n", SWDDEV_NAME, __func__, __LINE__);
+
+    idcode = ss->idcode;
+    ss->attached = false;
+
+    ret = swd_session_get(sd);
+    if (ret)
+        return ret;
+
+    if (idcode != ss->idcode)
+        pr_info("%s: [%s] %d idcode changed %08x -> %08x\n", SWDDEV_NAME, __func__, __LINE__, idcode, ss->idcode);
+
+    return 0;
+}
+
+// Bulk operations call it between chunks, holding the bus lock with no
+// state of their own left in the DAP or the flash controller. The urgent
+// users waiting go first, then the MEM-AP setup they may have changed is
+// restored, or the session attached again if one of them lost it.
+// Caller must hold the bus lock.
+int swd_bus_yield(struct swd_device *sd)
+{
+    if (!atomic_read(&sd->bus_urgent))
+        return 0;
+
+    sd->bus_yields++;
+    swd_bus_unlock(sd);
+    wait_event(sd->bus_wq, !atomic_read(&sd->bus_urgent));
+    swd_bus_lock(sd);
+
+    if (!sd->session.attached)
+        return swd_session_get(sd);
+
+    return sd->rc->setup_memap();
+}
+
+void swd_session_init(struct swd_device *sd)
+{
+    sd->session.attached = false;
+    sd->session.idcode = 0;
+    INIT_DELAYED_WORK(&sd->session.idle_work, swd_session_idle);
+}
+
+void swd_session_exit(struct swd_device *sd)
+{
+    cancel_delayed_work_sync(&sd->session.idle_work);
+    sd->session.attached = false;
+}
@@ -0,0 +1,18 @@
+#ifndef SWD_SESSION_H
+#define SWD_SESSION_H
+
+#include "swd_drv.h"
+
+void swd_session_init(struct swd_device *sd);
+
+void swd_session_exit(struct swd_device *sd);
+
+int swd_session_get(struct swd_device *sd);
+
+void swd_session_put(struct swd_device *sd, bool closing);
+
+int swd_session_recover(struct swd_device *sd);
+
+int swd_bus_yield(struct swd_device *sd);
+
+#endif
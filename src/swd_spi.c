@@ -0,0 +1,339 @@
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/slab.h>
+#include <linux/bitrev.h>
+#include <linux/spi/spi.h>
+#include <linux/pinctrl/consumer.h>
+
+#include "swd_bitstream.h"
+#include "swd_spi.h"
+
+#define SWD_SPI_NAME "swd_spi"
+
+// Streams are shifted through an spi controller in one full-duplex transfer.
+// MOSI drives swdio through a resistor and MISO reads swdio, so the target
+// overrides MOSI in its own slots and no direction switching is needed.
+// ACKs are checked after the transfer, that is only safe with
+// CTRL/STAT.ORUNDETECT set: the target then expects the data phase even
+// after WAIT/FAULT and the overrun stays sticky until ABORT clears it.
+
+#define SWD_SPI_BUF_SIZE        2048    // longer streams fall back to the gpio
+#define SWD_SPI_RETRY           10
+#define SWD_SPI_MAX_ACKS        128
+#define SWD_SPI_MAX_READS       32
+
+struct swd_spi {
+    struct spi_device *spi;
+    struct swd_bs_transport transport;
+    struct pinctrl *pinctrl;
+    struct pinctrl_state *pins_spi;     // swclk/swdio muxed to the controller
+    struct pinctrl_state *pins_gpio;    // back to gpio for bit-banging
+    bool lsb_first;                     // controller shifts LSB first itself
+    bool loopback;                      // MISO is MOSI, drive what the target would
+    u32 rx_skew;                        // MISO sampled this many bits late
+
+    // encoder state
+    u32 nbits;
+    bool out;
+    u16 nr_acks;
+    u16 nr_reads;
+    u32 ack_pos[SWD_SPI_MAX_ACKS];
+    u32 read_pos[SWD_SPI_MAX_READS];
+    u16 read_slot[SWD_SPI_MAX_READS];
+
+    u8 *tx;
+    u8 *rx;
+};
+
+// ORUNDETECT around the stream, compiled once
+static struct swd_bs_op swd_spi_setup_ops[8];
+static struct swd_bs swd_spi_setup_bs;
+static struct swd_bs_op swd_spi_teardown_ops[8];
+static struct swd_bs swd_spi_teardown_bs;
+
+static void swd_spi_put_bits(struct swd_spi *ss, u64 bits, u32 nbits)
+{
+    u32 i;
+
+    for (i = 0 ; i < nbits ; i++, ss->nbits++) {
+        if (ss->nbits >= SWD_SPI_BUF_SIZE * 8)
+            return;
+        if ((bits >> i) & 0x1)
+            ss->tx[ss->nbits / 8] |= BIT(ss->nbits % 8);
+    }
+}
+
+static u32 swd_spi_get_bits(struct swd_spi *ss, u32 pos, u32 nbits)
+{
+    u32 i;
+    u32 v = 0;
+
+    pos += ss->rx_skew;
+    for (i = 0 ; i < nbits ; i++, pos++) {
+        if (ss->rx[pos / 8] & BIT(pos % 8))
+            v |= BIT(i);
+    }
+
+    return v;
+}
+
+// one turnaround cycle when the driver of swdio changes
+static void swd_spi_turn(struct swd_spi *ss, bool out)
+{
+    if (ss->out == out)
+        return;
+
+    swd_spi_put_bits(ss, 0x1, 1);
+    ss->out = out;
+}
+
+static int swd_spi_encode(struct swd_spi *ss, const struct swd_bs *bs)
+{
+    int i;
+    const struct swd_bs_op *op;
+
+    for (i = 0 ; i < bs->nr_ops ; i++) {
+        op = &bs->ops[i];
+
+        switch (op->type) {
+        case SWD_BS_OUT:
+        case SWD_BS_HDR:
+            swd_spi_turn(ss, true);
+            swd_spi_put_bits(ss, op->bits, op->nbits);
+            break;
+        case SWD_BS_ACK:
+            if (ss->nr_acks == SWD_SPI_MAX_ACKS)
+                return -EOPNOTSUPP;
+            swd_spi_turn(ss, false);
+            ss->ack_pos[ss->nr_acks++] = ss->nbits;
+            // the target pulls the bits it drives low, loopback sees OK
+            swd_spi_put_bits(ss, ss->loopback ? SWD_OK : 0x7, 3);
+            break;
+        case SWD_BS_ACK_POSTED:
+            // checked by the CTRL/STAT read of the stream itself
+            swd_spi_turn(ss, false);
+            swd_spi_put_bits(ss, ss->loopback ? SWD_OK : 0x7, 3);
+            break;
+        case SWD_BS_IN:
+            if (ss->nr_reads == SWD_SPI_MAX_READS)
+                return -EOPNOTSUPP;
+            swd_spi_turn(ss, false);
+            ss->read_pos[ss->nr_reads] = ss->nbits;
+            ss->read_slot[ss->nr_reads++] = op->slot;
+            // loopback reads zero with even parity
+            swd_spi_put_bits(ss, ss->loopback ? 0 : U64_MAX, 33);
+            break;
+        }
+    }
+
+    swd_spi_turn(ss, true);
+
+    if (ss->nbits + ss->rx_skew > SWD_SPI_BUF_SIZE * 8)
+        return -EOPNOTSUPP;
+
+    return 0;
+}
+
+static int swd_spi_xfer(struct swd_spi *ss, const struct swd_bs *setup, const struct swd_bs *bs,
+        const struct swd_bs *teardown)
+{
+    int i;
+    int ret;
+    u32 len;
+    struct spi_transfer xfer = {0};
+
+    ss->nbits = 0;
+    ss->out = true;
+    ss->nr_acks = 0;
+    ss->nr_reads = 0;
+    memset(ss->tx, 0, SWD_SPI_BUF_SIZE);
+
+    ret = setup ? swd_spi_encode(ss, setup) : 0;
+    if (!ret)
+        ret = swd_spi_encode(ss, bs);
+    if (!ret && teardown)
+        ret = swd_spi_encode(ss, teardown);
+    if (ret)
+        return ret;
+
+    // the idle bits padding the last byte also cover the rx skew
+    len = DIV_ROUND_UP(ss->nbits + ss->rx_skew, 8);
+
+    if (!ss->lsb_first) {
+        for (i = 0 ; i < len ; i++)
+            ss->tx[i] = bitrev8(ss->tx[i]);
+    }
+
+    xfer.tx_buf = ss->tx;
+    xfer.rx_buf = ss->rx;
+    xfer.len = len;
+
+    pinctrl_select_state(ss->pinctrl, ss->pins_spi);
+    ret = spi_sync_transfer(ss->spi, &xfer, 1);
+    pinctrl_select_state(ss->pinctrl, ss->pins_gpio);
+    if (ret)
+        return ret;
+
+    if (!ss->lsb_first) {
+        for (i = 0 ; i < len ; i++)
+            ss->rx[i] = bitrev8(ss->rx[i]);
+    }
+
+    return 0;
+}
+
+static int swd_spi_run(struct swd_bs_transport *t, const struct swd_bs *bs, u32 *rdata)
+{
+    int i;
+    int ret;
+    u32 ack = SWD_OK;
+    u32 data;
+    u32 parity;
+    int retry = SWD_SPI_RETRY;
+    const struct swd_bs *setup;
+    struct swd_spi *ss = container_of(t, struct swd_spi, transport);
+
+    // a stream starting with a line reset can not be preceded by transactions
+    setup = (bs->nr_ops && (bs->ops[0].type == SWD_BS_HDR)) ? &swd_spi_setup_bs : NULL;
+
+    do {
+        ret = swd_spi_xfer(ss, setup, bs, setup ? &swd_spi_teardown_bs : NULL);
+        if (ret)
+            return ret;
+
+        // the first failing ACK makes the rest FAULT, find it
+        for (i = 0 ; i < ss->nr_acks ; i++) {
+            ack = swd_spi_get_bits(ss, ss->ack_pos[i], 3);
+            if (ack != SWD_OK)
+                break;
+        }
+
+        if (i == ss->nr_acks) {
+            for (i = 0 ; i < ss->nr_reads ; i++) {
+                data = swd_spi_get_bits(ss, ss->read_pos[i], 32);
+                parity = swd_spi_get_bits(ss, ss->read_pos[i] + 32, 1);
+                if ((hweight32(data) & 0x1) != parity)
+                    return -EIO;
+                rdata[ss->read_slot[i]] = data;
+            }
+            return 0;
+        }
+
+        // no answer at all, nothing to retry
+        if (ack == 0x7)
+            return -EIO;
+
+        // the setup stream clears the sticky flags before the retry
+    } while ((ack == SWD_WAIT) && retry--);
+
+    return (ack == SWD_WAIT) ? -EAGAIN : -EIO;
+}
+
+static int swd_spi_probe(struct spi_device *spi)
+{
+    int ret;
+    struct swd_spi *ss;
+    struct device *dev = &spi->dev;
+
+    pr_info("%s: [%s] %d start\n", SWD_SPI_NAME, __func__, __LINE__);
+
+    ss = devm_kzalloc(dev, sizeof(struct swd_spi), GFP_KERNEL);
+    if (!ss)
+        return -ENOMEM;
+
+    // dma-able buffers
+    ss->tx = devm_kzalloc(dev, SWD_SPI_BUF_SIZE, GFP_KERNEL);
+    ss->rx = devm_kzalloc(dev, SWD_SPI_BUF_SIZE, GFP_KERNEL);
+    if (!ss->tx || !ss->rx)
+        return -ENOMEM;
+
+    ss->pinctrl = devm_pinctrl_get(dev);
+    if (IS_ERR(ss->pinctrl)) {
+        pr_err("%s: [%s] %d Err with get pinctrl\n", SWD_SPI_NAME, __func__, __LINE__);
+        return PTR_ERR(ss->pinctrl);
+    }
+
+    ss->pins_spi = pinctrl_lookup_state(ss->pinctrl, PINCTRL_STATE_DEFAULT);
+    ss->pins_gpio = pinctrl_lookup_state(ss->pinctrl, "gpio");
+    if (IS_ERR(ss->pins_spi) || IS_ERR(ss->pins_gpio)) {
+        pr_err("%s: [%s] %d Err with pinctrl states default/gpio\n", SWD_SPI_NAME, __func__, __LINE__);
+        return -EINVAL;
+    }
+
+    ss->loopback = of_property_read_bool(dev->of_node, "swd,loopback");
+    ss->rx_skew = ss->loopback ? 0 : 1;
+    of_property_read_u32(dev->of_node, "swd,rx-skew", &ss->rx_skew);
+    if (ss->rx_skew > 8)
+        return -EINVAL;
+
+    // clock idles high, MOSI changes on the falling edge, the target
+    // samples on the rising edge
+    spi->mode = SPI_MODE_3 | SPI_LSB_FIRST;
+    spi->bits_per_word = 8;
+    ret = spi_setup(spi);
+    if (ret) {
+        spi->mode = SPI_MODE_3;
+        ret = spi_setup(spi);
+        if (ret)
+            return ret;
+    }
+    ss->lsb_first = !!(spi->mode & SPI_LSB_FIRST);
+
+    ss->spi = spi;
+    ss->transport.name = SWD_SPI_NAME;
+    ss->transport.run = swd_spi_run;
+    spi_set_drvdata(spi, ss);
+
+    pinctrl_select_state(ss->pinctrl, ss->pins_gpio);
+    swd_bs_set_transport(&ss->transport);
+
+    pr_info("%s: [%s] %d finished %uHz lsb_first:%d loopback:%d rx_skew:%u\n", SWD_SPI_NAME, __func__, __LINE__,
+            spi->max_speed_hz, ss->lsb_first, ss->loopback, ss->rx_skew);
+
+    return 0;
+}
+
+static void swd_spi_remove(struct spi_device *spi)
+{
+    swd_bs_set_transport(NULL);
+}
+
+static const struct of_device_id swd_spi_ids[] = {
+    {.compatible = "rproc,swd-spi"},
+    {}
+};
+MODULE_DEVICE_TABLE(of, swd_spi_ids);
+
+static struct spi_driver swd_spi_driver = {
+    .probe = swd_spi_probe,
+    .remove = swd_spi_remove,
+    .driver = {
+        .name = SWD_SPI_NAME,
+        .of_match_table = swd_spi_ids,
+    },
+};
+
+int swd_spi_init(void)
+{
+    struct swd_bs *bs = &swd_spi_setup_bs;
+
+    // clear the sticky flags, then ORUNDETECT, DP writes never WAIT
+    swd_bs_init(bs, swd_spi_setup_ops, ARRAY_SIZE(swd_spi_setup_ops));
+    swd_bs_write(bs, SWD_DP, SWD_DP_ABORT_REG, SWD_ABORT_CLR_ALL);
+    swd_bs_write(bs, SWD_DP, SWD_DP_CTRLSTAT_REG, SWD_CTRLSTAT_PWRUP | SWD_CTRLSTAT_ORUNDETECT);
+
+    // the gpio transfers after the stream expect ORUNDETECT off,
+    // posted so a failed stream still gets it cleared
+    bs = &swd_spi_teardown_bs;
+    swd_bs_init(bs, swd_spi_teardown_ops, ARRAY_SIZE(swd_spi_teardown_ops));
+    swd_bs_set_posted(bs, true);
+    swd_bs_write(bs, SWD_DP, SWD_DP_CTRLSTAT_REG, SWD_CTRLSTAT_PWRUP);
+    swd_bs_idle(bs);
+
+    return spi_register_driver(&swd_spi_driver);
+}
+
+void swd_spi_exit(void)
+{
+    spi_unregister_driver(&swd_spi_driver);
+}
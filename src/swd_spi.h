@@ -0,0 +1,8 @@
+#ifndef SWD_SPI_H
+#define SWD_SPI_H
+
+int swd_spi_init(void);
+
+void swd_spi_exit(void);
+
+#endif
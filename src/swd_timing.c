@@ -0,0 +1,303 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/jump_label.h>
+#include <linux/sched/clock.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "swd_drv.h"
+#include "swd_timing.h"
+#include "swd_debugfs.h"
+
+#define TIMING_NAME "swd_timing"
+
+// Edge intervals go to log2 buckets split in 4, within 25% of the value:
+// 0-3ns exact, then [4 << e, 5 << e, 6 << e, 7 << e) for e = 0..29.
+#define TIMING_SUB_BITS     2
+#define TIMING_BUCKETS      128
+#define TIMING_NR_XFERS     512     // summaries kept, the newest overwrite the oldest
+#define TIMING_MIN_EDGES    8       // shorter transfers are not summed up
+#define TIMING_STALL        4       // intervals this many times p50 are stalls
+
+struct timing_xfer {
+    u64 start_ns;
+    u32 edges;
+    u32 hz;             // rising to rising edge
+    u16 duty;           // high time, per mille
+    u16 cpu;
+    u32 p50_ns;         // edge intervals
+    u32 p99_ns;
+    u32 max_ns;
+    u32 stalls;
+};
+
+DEFINE_STATIC_KEY_FALSE(swd_timing_key);
+
+// the transfer being clocked, bus lock held and interrupts masked
+static struct {
+    u64 first_rise;
+    u64 last_rise;
+    u64 prev;
+    u64 high_ns;
+    u64 low_ns;
+    u32 rises;
+    u32 edges;
+    u32 max_ns;
+    u32 hist[TIMING_BUCKETS];
+} cur;
+
+static struct {
+    struct swd_device *sd;
+    struct swd_dbg_enable enable;
+    spinlock_t xfer_lock;   // xfers, hist and the counts
+    struct timing_xfer xfers[TIMING_NR_XFERS];
+    u32 nr_xfers;
+    u64 hist[TIMING_BUCKETS];   // all transfers
+    u64 edges;
+    u32 max_ns;
+    struct dentry *dir;
+} timing;
+
+static inline int timing_bucket(u32 ns)
+{
+    int e;
+
+    if (ns < (1 << TIMING_SUB_BITS))
+        return ns;
+
+    e = ilog2(ns);
+
+    return ((e - 1) << TIMING_SUB_BITS) | ((ns >> (e - TIMING_SUB_BITS)) & 0x3);
+}
+
+static u32 timing_bucket_ns(int idx)
+{
+    int e;
+
+    if (idx < (1 << TIMING_SUB_BITS))
+        return idx;
+
+    e = (idx >> TIMING_SUB_BITS) + 1;
+
+    return (u32)(0x4 | (idx & 0x3)) << (e - TIMING_SUB_BITS);
+}
+
+// value of the bucket holding the permille-th interval
+static u32 timing_percentile(const void *hist, bool wide, u64 nr, u32 permille)
+{
+    int i;
+    u64 sum = 0;
+    u64 rank = div_u64(nr * permille + 999, 1000);
+
+    for (i = 0 ; i < TIMING_BUCKETS ; i++) {
+        sum += wide ? ((const u64*)hist)[i] : ((const u32*)hist)[i];
+        if (sum >= rank)
+            return timing_bucket_ns(i);
+    }
+
+    return 0;
+}
+
+void swd_timing_begin(void)
+{
+    memset(&cur, 0, sizeof(cur));
+}
+
+void swd_timing_edge(int level)
+{
+    u32 ns;
+    u64 now = local_clock();
+
+    if (cur.edges++) {
+        ns = min_t(u64, now - cur.prev, U32_MAX);
+        cur.hist[timing_bucket(ns)]++;
+        cur.max_ns = max(cur.max_ns, ns);
+
+        // a rising edge ends a low phase
+        if (level)
+            cur.low_ns += ns;
+        else
+            cur.high_ns += ns;
+    }
+
+    if (level) {
+        if (!cur.rises++)
+            cur.first_rise = now;
+        cur.last_rise = now;
+    }
+
+    cur.prev = now;
+}
+
+void swd_timing_end(void)
+{
+    int i;
+    u32 stall_ns;
+    struct timing_xfer *x;
+
+    if (cur.edges < TIMING_MIN_EDGES)
+        return;
+
+    spin_lock(&timing.xfer_lock);
+
+    x = &timing.xfers[timing.nr_xfers++ % TIMING_NR_XFERS];
+    x->start_ns = cur.first_rise;
+    x->edges = cur.edges;
+    x->cpu = smp_processor_id();
+    x->hz = (cur.last_rise > cur.first_rise) ?
+            div64_u64((u64)(cur.rises - 1) * NSEC_PER_SEC, cur.last_rise - cur.first_rise) : 0;
+    x->duty = (cur.high_ns + cur.low_ns) ?
+            div64_u64(cur.high_ns * 1000, cur.high_ns + cur.low_ns) : 0;
+    x->p50_ns = timing_percentile(cur.hist, false, cur.edges - 1, 500);
+    x->p99_ns = timing_percentile(cur.hist, false, cur.edges - 1, 990);
+    x->max_ns = cur.max_ns;
+
+    // the buckets from TIMING_STALL times p50 on, the host took the cpu away
+    x->stalls = 0;
+    stall_ns = x->p50_ns * TIMING_STALL;
+    for (i = timing_bucket(stall_ns) ; i < TIMING_BUCKETS ; i++)
+        x->stalls += cur.hist[i];
+
+    for (i = 0 ; i < TIMING_BUCKETS ; i++)
+        timing.hist[i] += cur.hist[i];
+    timing.edges += cur.edges - 1;
+    timing.max_ns = max(timing.max_ns, cur.max_ns);
+
+    spin_unlock(&timing.xfer_lock);
+}
+
+static void timing_reset(void)
+{
+    spin_lock_irq(&timing.xfer_lock);
+    memset(timing.hist, 0, sizeof(timing.hist));
+    timing.nr_xfers = 0;
+    timing.edges = 0;
+    timing.max_ns = 0;
+    spin_unlock_irq(&timing.xfer_lock);
+}
+
+// Switched only between transfers, with the bus lock held.
+static int timing_enable(void *priv, bool enable)
+{
+    struct swd_device *sd = timing.sd;
+
+    swd_bus_lock(sd);
+    if (enable)
+        static_branch_enable(&swd_timing_key);
+    else
+        static_branch_disable(&swd_timing_key);
+    swd_bus_unlock(sd);
+
+    pr_info("%s: [%s] %d timing %s\n", TIMING_NAME, __func__, __LINE__, enable ? "on" : "off");
+
+    return 0;
+}
+
+// one line per transfer, the oldest first
+static int timing_xfers_show(struct seq_file *m, void *v)
+{
+    u32 i;
+    u32 nr;
+    u32 first;
+    struct timing_xfer *xfers;
+
+    xfers = kmalloc_array(TIMING_NR_XFERS, sizeof(struct timing_xfer), GFP_KERNEL);
+    if (!xfers)
+        return -ENOMEM;
+
+    spin_lock_irq(&timing.xfer_lock);
+    nr = min_t(u32, timing.nr_xfers, TIMING_NR_XFERS);
+    first = timing.nr_xfers - nr;
+    for (i = 0 ; i < nr ; i++)
+        xfers[i] = timing.xfers[(first + i) % TIMING_NR_XFERS];
+    spin_unlock_irq(&timing.xfer_lock);
+
+    seq_puts(m, "# start_ns cpu edges hz duty p50_ns p99_ns max_ns stalls\n");
+    for (i = 0 ; i < nr ; i++)
+        seq_printf(m, "%llu %u %u %u %u.%u%% %u %u %u %u\n", xfers[i].start_ns, xfers[i].cpu,
+                   xfers[i].edges, xfers[i].hz, xfers[i].duty / 10, xfers[i].duty % 10,
+                   xfers[i].p50_ns, xfers[i].p99_ns, xfers[i].max_ns, xfers[i].stalls);
+
+    kfree(xfers);
+
+    return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(timing_xfers);
+
+// edge intervals of all transfers: "ns count" for each bucket in use
+static int timing_hist_show(struct seq_file *m, void *v)
+{
+    int i;
+    u64 edges;
+    u32 max_ns;
+    u64 *hist;
+
+    hist = kmalloc_array(TIMING_BUCKETS, sizeof(u64), GFP_KERNEL);
+    if (!hist)
+        return -ENOMEM;
+
+    spin_lock_irq(&timing.xfer_lock);
+    memcpy(hist, timing.hist, sizeof(timing.hist));
+    edges = timing.edges;
+    max_ns = timing.max_ns;
+    spin_unlock_irq(&timing.xfer_lock);
+
+    seq_printf(m, "# intervals:%llu p50:%u p99:%u max:%u\n", edges,
+               timing_percentile(hist, true, edges, 500), timing_percentile(hist, true, edges, 990), max_ns);
+    for (i = 0 ; i < TIMING_BUCKETS ; i++) {
+        if (hist[i])
+            seq_printf(m, "%u %llu\n", timing_bucket_ns(i), hist[i]);
+    }
+
+    kfree(hist);
+
+    return 0;
+}
+
+static int timing_hist_open(struct inode *inode, struct file *filp)
+{
+    return single_open(filp, timing_hist_show, inode->i_private);
+}
+
+// any write clears the histogram and the transfers
+static ssize_t timing_hist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off)
+{
+    timing_reset();
+
+    return len;
+}
+
+static const struct file_operations timing_hist_fops = {
+    .owner      = THIS_MODULE,
+    .open       = timing_hist_open,
+    .read       = seq_read,
+    .write      = timing_hist_write,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+int swd_timing_init(struct swd_device *sd)
+{
+    timing.sd = sd;
+    swd_dbg_enable_init(&timing.enable, timing_enable, NULL);
+    spin_lock_init(&timing.xfer_lock);
+
+    // no debugfs is not an error, the measurement is just not there
+    timing.dir = debugfs_create_dir("timing", sd->debugfs);
+    swd_dbg_enable_create("enable", timing.dir, &timing.enable);
+    debugfs_create_file("transfers", 0444, timing.dir, NULL, &timing_xfers_fops);
+    debugfs_create_file("hist", 0644, timing.dir, NULL, &timing_hist_fops);
+
+    return 0;
+}
+
+void swd_timing_exit(struct swd_device *sd)
+{
+    debugfs_remove_recursive(timing.dir);
+
+    swd_dbg_enable_set(&timing.enable, false);
+}
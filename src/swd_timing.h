@@ -0,0 +1,28 @@
+#ifndef SWD_TIMING_H
+#define SWD_TIMING_H
+
+#include <linux/jump_label.h>
+
+#include "swd_drv.h"
+
+DECLARE_STATIC_KEY_FALSE(swd_timing_key);
+
+// patched out while the measurement is off
+static inline bool swd_timing_on(void)
+{
+    return static_branch_unlikely(&swd_timing_key);
+}
+
+// a transfer is what is clocked between signal_begin and signal_end,
+// on one cpu with the interrupts masked
+void swd_timing_begin(void);
+
+void swd_timing_edge(int level);
+
+void swd_timing_end(void);
+
+int swd_timing_init(struct swd_device *sd);
+
+void swd_timing_exit(struct swd_device *sd);
+
+#endif
@@ -0,0 +1,124 @@
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/llist.h>
+#include <linux/completion.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+
+#include "swd_drv.h"
+#include "swd_worker.h"
+
+#define SWD_WORKER_NAME "swd_bus"
+
+// The bitstreams are clocked by one SCHED_FIFO thread, pinned to bus_cpu
+// (an isolated cpu keeps the timing steady). Callers on other cpus queue
+// their stream and sleep with interrupts and preemption enabled.
+static bool bus_worker = false;
+module_param(bus_worker, bool, 0444);
+MODULE_PARM_DESC(bus_worker, "clock the swd bitstreams on a SCHED_FIFO kernel thread");
+
+static int bus_cpu = -1;
+module_param(bus_cpu, int, 0444);
+MODULE_PARM_DESC(bus_cpu, "cpu the bus thread is bound to, -1 leaves it to the scheduler");
+
+struct swd_worker_req {
+    struct llist_node node;
+    struct swd_gpio *sg;
+    const struct swd_bs *bs;
+    u32 *rdata;
+    int ret;
+    struct completion done;
+};
+
+static struct {
+    struct task_struct *thread;
+    struct llist_head reqs;     // pushed lock free by the callers
+    wait_queue_head_t wq;
+} swd_worker;
+
+static void swd_worker_drain(void)
+{
+    struct llist_node *list;
+    struct swd_worker_req *req, *tmp;
+
+    // llist pops the newest first, the streams go out in queued order
+    list = llist_reverse_order(llist_del_all(&swd_worker.reqs));
+    llist_for_each_entry_safe(req, tmp, list, node) {
+        req->ret = swd_bs_run(req->sg, req->bs, req->rdata);
+        complete(&req->done);
+    }
+}
+
+static int swd_worker_thread(void *data)
+{
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(swd_worker.wq,
+                !llist_empty(&swd_worker.reqs) || kthread_should_stop());
+        swd_worker_drain();
+    }
+
+    swd_worker_drain();
+
+    return 0;
+}
+
+int swd_worker_run(struct swd_gpio *sg, const struct swd_bs *bs, u32 *rdata)
+{
+    struct swd_worker_req req;
+    struct task_struct *thread = READ_ONCE(swd_worker.thread);
+
+    if (!thread || (current == thread))
+        return -EOPNOTSUPP;
+
+    req.sg = sg;
+    req.bs = bs;
+    req.rdata = rdata;
+    init_completion(&req.done);
+
+    if (llist_add(&req.node, &swd_worker.reqs))
+        wake_up(&swd_worker.wq);
+
+    wait_for_completion(&req.done);
+
+    return req.ret;
+}
+
+int swd_worker_init(struct swd_device *sd)
+{
+    struct task_struct *thread;
+
+    init_llist_head(&swd_worker.reqs);
+    init_waitqueue_head(&swd_worker.wq);
+
+    if (!bus_worker)
+        return 0;
+
+    thread = kthread_create(swd_worker_thread, NULL, SWD_WORKER_NAME);
+    if (IS_ERR(thread))
+        return PTR_ERR(thread);
+
+    if ((bus_cpu >= 0) && (bus_cpu < nr_cpu_ids) && cpu_online(bus_cpu))
+        kthread_bind(thread, bus_cpu);
+    else if (bus_cpu >= 0)
+        pr_err("%s: [%s] %d cpu %d is not online, not bound\n", SWD_WORKER_NAME, __func__, __LINE__, bus_cpu);
+
+    sched_set_fifo(thread);
+    WRITE_ONCE(swd_worker.thread, thread);
+    wake_up_process(thread);
+
+    pr_info("%s: [%s] %d bus thread on cpu %d\n", SWD_WORKER_NAME, __func__, __LINE__, bus_cpu);
+
+    return 0;
+}
+
+// Users of the bus are gone, what is still queued runs before the thread ends.
+void swd_worker_exit(struct swd_device *sd)
+{
+    struct task_struct *thread = swd_worker.thread;
+
+    if (!thread)
+        return;
+
+    WRITE_ONCE(swd_worker.thread, NULL);
+    kthread_stop(thread);
+}
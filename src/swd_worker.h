@@ -0,0 +1,15 @@
+#ifndef SWD_WORKER_H
+#define SWD_WORKER_H
+
+#include "swd_drv.h"
+#include "swd_bitstream.h"
+
+int swd_worker_init(struct swd_device *sd);
+
+void swd_worker_exit(struct swd_device *sd);
+
+// Run the stream on the bus thread, the caller sleeps until it is done.
+// -EOPNOTSUPP when there is no bus thread or it is the caller.
+int swd_worker_run(struct swd_gpio *sg, const struct swd_bs *bs, u32 *rdata);
+
+#endif
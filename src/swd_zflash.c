@@ -0,0 +1,249 @@
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+
+#include "swd_drv.h"
+#include "swd_session.h"
+#include "swd_pool.h"
+#include "swd_zflash.h"
+#include "swd_exec.h"
+#include "cortex_m.h"
+
+// Compressed download to flash: each chunk is run length encoded by
+// halfwords, copied to the target sram and expanded there by a small thumb
+// routine storing straight to flash, the flash controller in programming
+// mode. Chunks which do not shrink enough go the usual way.
+//
+// Stream of halfwords, ends with 0:
+//   0x8000 | n, v       n times v
+//   n, v1 ... vn        n literals
+
+#define SWD_ZFLASH_NAME     "swd_zflash"
+#define SWD_RLE_RUN         0x8000
+#define SWD_RLE_MAX         0x7FFF
+#define SWD_RLE_MIN_RUN     3       // shorter runs stay in literals
+
+#define SWD_ZFLASH_CODE_SIZE    0x40
+#define SWD_ZFLASH_STACK_SIZE   0xC0    // the routine does not push, just in case
+#define SWD_ZFLASH_STAGE_OFF    (SWD_ZFLASH_CODE_SIZE + SWD_ZFLASH_STACK_SIZE)
+#define SWD_ZFLASH_RATIO        75      // percent, compressed only below it
+#define SWD_ZFLASH_TIMEOUT_MS   2000
+
+// r0 = compressed stream, r1 = destination, returns the end of the
+// destination in r0 and stops on a bkpt
+static const u16 swd_zflash_code[] = {
+    0x8802,     // loop:    ldrh  r2, [r0]
+    0x3002,     //          adds  r0, #2
+    0x2A00,     //          cmp   r2, #0
+    0xD011,     //          beq   done
+    0x0BD3,     //          lsrs  r3, r2, #15
+    0xD008,     //          beq   lit
+    0x0452,     //          lsls  r2, r2, #17
+    0x0C52,     //          lsrs  r2, r2, #17
+    0x8803,     //          ldrh  r3, [r0]
+    0x3002,     //          adds  r0, #2
+    0x800B,     // run:     strh  r3, [r1]
+    0x3102,     //          adds  r1, #2
+    0x3A01,     //          subs  r2, #1
+    0xD1FB,     //          bne   run
+    0xE7F0,     //          b     loop
+    0x8803,     // lit:     ldrh  r3, [r0]
+    0x3002,     //          adds  r0, #2
+    0x800B,     //          strh  r3, [r1]
+    0x3102,     //          adds  r1, #2
+    0x3A01,     //          subs  r2, #1
+    0xD1F9,     //          bne   lit
+    0xE7E9,     //          b     loop
+    0x0008,     // done:    movs  r0, r1
+    0xBE00,     //          bkpt  #0
+};
+
+static u32 swd_rle_run_len(const u16 *src, u32 nr)
+{
+    u32 i;
+
+    for (i = 1 ; (i < nr) && (i < SWD_RLE_MAX) && (src[i] == src[0]) ; i++)
+        ;
+
+    return i;
+}
+
+// Encode nr halfwords of src, returns the halfwords in dst or -ENOSPC
+// when more than max are needed.
+int swd_rle_compress(const u16 *src, u32 nr, u16 *dst, u32 max)
+{
+    u32 i = 0;
+    u32 n = 0;
+    u32 run;
+    u32 lit;
+
+    while (i < nr) {
+        run = swd_rle_run_len(src + i, nr - i);
+        if (run >= SWD_RLE_MIN_RUN) {
+            if (n + 2 > max)
+                return -ENOSPC;
+            dst[n++] = SWD_RLE_RUN | run;
+            dst[n++] = src[i];
+            i += run;
+            continue;
+        }
+
+        // literals up to the next run worth encoding
+        for (lit = 0 ; (i + lit < nr) && (lit < SWD_RLE_MAX) ; lit++) {
+            if (swd_rle_run_len(src + i + lit, nr - i - lit) >= SWD_RLE_MIN_RUN)
+                break;
+        }
+
+        if (n + 1 + lit > max)
+            return -ENOSPC;
+        dst[n++] = lit;
+        memcpy(&dst[n], &src[i], lit * sizeof(u16));
+        n += lit;
+        i += lit;
+    }
+
+    if (n + 1 > max)
+        return -ENOSPC;
+    dst[n++] = 0;
+
+    return n;
+}
+
+static int swd_zflash_write_mem(struct rproc_core *rc, const void *from, u32 base, u32 len)
+{
+    u32 pos = 0;
+    ssize_t write_len;
+
+    while (pos < len) {
+        write_len = rc->write_mem((char*)from + pos, base + pos, len - pos);
+        if (write_len <= 0)
+            return -EIO;
+        pos += write_len;
+    }
+
+    return 0;
+}
+
+// expand the staged stream to flash, checks the routine wrote it all
+static int swd_zflash_expand(struct rproc_core *rc, u32 stage, u32 dst, u32 len)
+{
+    int ret;
+    u32 end = 0;
+    u32 args[2] = {stage, dst};
+    struct core_mem *cm = rc->ci->cm;
+
+    ret = rc->flash_program_mode(true);
+    if (ret)
+        return ret;
+
+    ret = cortex_m_run(rc, cm->sram.base | 0x1, cm->sram.base + SWD_ZFLASH_STAGE_OFF,
+                       args, ARRAY_SIZE(args), SWD_ZFLASH_TIMEOUT_MS, &end);
+
+    if (rc->flash_program_mode(false) && !ret)
+        ret = -EIO;
+
+    if (!ret && (end != dst + len)) {
+        pr_err("%s: [%s] %d stopped at %08x, expected %08x\n", SWD_ZFLASH_NAME, __func__, __LINE__, end, dst + len);
+        ret = -EIO;
+    }
+
+    return ret;
+}
+
+// Download len bytes from the user buffer to flash at offset, each chunk
+// compressed or raw by its ratio. rate gets the bytes/s achieved.
+// The start of the sram is used for the routine and the stream.
+// Caller must hold the bus lock, -EBUSY if the core runs.
+long swd_zflash_download(struct swd_device *sd, void __user *from, u32 offset, u32 len, u32 *rate)
+{
+    long ret = 0;
+    int zn;
+    u32 yields;
+    u32 pos;
+    u32 chunk;
+    u32 stage;
+    u32 nr_z = 0;
+    u64 ns;
+    ktime_t start;
+    char *buf;
+    u16 *zbuf;
+    struct rproc_core *rc = sd->rc;
+    struct core_mem *cm = rc->ci->cm;
+
+    // the raw chunks go by words
+    if ((offset | len) & 0x3)
+        return -EINVAL;
+
+    if (!rc->flash_program_mode)
+        return -EOPNOTSUPP;
+
+    // the sram would be written under the firmware and cortex_m_run()
+    // needs the core halted
+    ret = cortex_m_halted(rc);
+    if (ret)
+        return ret;
+
+    stage = min_t(u32, sd->pool.size, cm->sram.len - SWD_ZFLASH_STAGE_OFF) & ~0x3;
+
+    zbuf = kmalloc(stage, GFP_KERNEL);
+    if (!zbuf)
+        return -ENOMEM;
+
+    buf = swd_pool_get(sd);
+    start = ktime_get();
+
+    // the routine may go over a swd_exec blob
+    swd_exec_forget();
+
+    ret = swd_zflash_write_mem(rc, swd_zflash_code, cm->sram.base, sizeof(swd_zflash_code));
+    if (ret)
+        goto swd_zflash_fail;
+
+    for (pos = 0 ; pos < len ; pos += chunk) {
+        // flash is locked between the chunks. The urgent users may have
+        // reset or resumed the core, or run an exec blob over the routine.
+        yields = sd->bus_yields;
+        ret = swd_bus_yield(sd);
+        if (!ret && (yields != sd->bus_yields)) {
+            ret = cortex_m_halted(rc);
+            if (!ret)
+                ret = swd_zflash_write_mem(rc, swd_zflash_code, cm->sram.base, sizeof(swd_zflash_code));
+        }
+        if (ret)
+            break;
+
+        // the stream is never larger than its chunk, both fit the stage
+        chunk = min_t(u32, len - pos, stage);
+        if (copy_from_user(buf, (char __user *)from + pos, chunk)) {
+            ret = -EFAULT;
+            break;
+        }
+
+        zn = swd_rle_compress((u16*)buf, chunk / sizeof(u16), zbuf,
+                              chunk * SWD_ZFLASH_RATIO / 100 / sizeof(u16));
+        if (zn > 0) {
+            ret = swd_zflash_write_mem(rc, zbuf, cm->sram.base + SWD_ZFLASH_STAGE_OFF, zn * sizeof(u16));
+            if (!ret)
+                ret = swd_zflash_expand(rc, cm->sram.base + SWD_ZFLASH_STAGE_OFF,
+                                        cm->flash.base + offset + pos, chunk);
+            nr_z++;
+        } else {
+            ret = rc->program_flash(cm, buf, offset + pos, chunk);
+        }
+        if (ret)
+            break;
+    }
+
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    *rate = ns ? div64_u64((u64)pos * NSEC_PER_SEC, ns) : 0;
+
+    pr_debug("%s: [%s] %d %u bytes, %u chunks compressed, %u bytes/s\n",
+            SWD_ZFLASH_NAME, __func__, __LINE__, pos, nr_z, *rate);
+
+swd_zflash_fail:
+    swd_pool_put(sd, buf);
+    kfree(zbuf);
+
+    return ret;
+}
@@ -0,0 +1,10 @@
+#ifndef SWD_ZFLASH_H
+#define SWD_ZFLASH_H
+
+#include "swd_drv.h"
+
+int swd_rle_compress(const u16 *src, u32 nr, u16 *dst, u32 max);
+
+long swd_zflash_download(struct swd_device *sd, void __user *from, u32 offset, u32 len, u32 *rate);
+
+#endif
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "../../include/swd_module.h"
+
+#define NR_WORDS    8
+
+#define DP_READ(reg)    (SWD_DAP_RNW | (reg))
+#define DP_WRITE(reg)   (reg)
+#define AP_READ(reg)    (SWD_DAP_APNDP | SWD_DAP_RNW | (reg))
+#define AP_WRITE(reg)   (SWD_DAP_APNDP | (reg))
+
+int main(int argc, char **argv)
+{
+    int i;
+    int fd = -1;
+    uint32_t base;
+    uint32_t rdata[1 + NR_WORDS];
+    uint32_t words[NR_WORDS];
+    struct swd_parameters params;
+    struct swd_dap_transfer t;
+    void *meminfo_buf = NULL;
+    struct user_core_mem *cm;
+
+    meminfo_buf = malloc(4096);
+    if (!meminfo_buf)
+        return -1;
+
+    fd = open("/dev/swd", O_RDWR);
+    if(fd < 0){
+        printf("Err with open dev\n");
+        return -1;
+    }
+
+    params.arg[0] = (unsigned long)meminfo_buf;
+    ioctl(fd, SWDDEV_IOC_MEMINFO_GET, &params);
+    cm = (struct user_core_mem*)meminfo_buf;
+    base = cm->sram.base;
+
+    // IDCODE, wait for the power up acks, then a block read of the sram
+    struct swd_dap_xfer xfers[] = {
+        {.request = DP_READ(0x0)},
+        {.request = SWD_DAP_MATCH_MASK, .data = 0xA0000000},
+        {.request = DP_READ(0x4) | SWD_DAP_MATCH_VALUE, .data = 0xA0000000},
+        {.request = DP_WRITE(0x8), .data = 0x0},
+        {.request = AP_WRITE(0x0), .data = 0x23000012},
+        {.request = AP_WRITE(0x4), .data = base},
+        {.request = AP_READ(0xC), .count = NR_WORDS},
+    };
+
+    memset(&t, 0, sizeof(t));
+    t.xfers = (uintptr_t)xfers;
+    t.nr_xfers = sizeof(xfers) / sizeof(xfers[0]);
+    t.rdata = (uintptr_t)rdata;
+    t.nr_rdata = sizeof(rdata) / sizeof(rdata[0]);
+
+    if (ioctl(fd, SWDDEV_IOC_DAP_XFER, &t)) {
+        printf("Err with dap transfer\n");
+        goto error;
+    }
+
+    printf("done:%u/%u read:%u ack:%x idcode:%08x\n", t.done, t.nr_xfers, t.nr_read, t.ack, rdata[0]);
+    if ((t.done != t.nr_xfers) || (t.ack != SWD_DAP_ACK_OK)) {
+        printf("Err, transfer stopped\n");
+        goto error;
+    }
+
+    // the same words by read()
+    lseek(fd, base, SEEK_SET);
+    if (read(fd, words, sizeof(words)) != sizeof(words)) {
+        printf("Err with read\n");
+        goto error;
+    }
+
+    for (i = 0 ; i < NR_WORDS ; i++) {
+        if (words[i] != rdata[1 + i]) {
+            printf("Err, word %d dap:%08x read:%08x\n", i, rdata[1 + i], words[i]);
+            goto error;
+        }
+    }
+
+    printf("DAP transfer Success\n");
+
+error:
+    close(fd);
+    free(meminfo_buf);
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "../../include/swd_module.h"
+
+#define NR_WORDS    256
+#define DATA_OFF    0x2000  // past the blob and its stack
+
+// uint32_t sum(uint32_t *p, uint32_t n)
+static const uint16_t sum_code[] = {
+    0x2200,     //          movs  r2, #0
+    0x2900,     // loop:    cmp   r1, #0
+    0xD003,     //          beq   done
+    0xC808,     //          ldmia r0!, {r3}
+    0x18D2,     //          adds  r2, r2, r3
+    0x3901,     //          subs  r1, #1
+    0xE7F9,     //          b     loop
+    0x0010,     // done:    movs  r0, r2
+    0x4770,     //          bx    lr
+};
+
+int main(int argc, char **argv)
+{
+    int i;
+    int fd = -1;
+    uint32_t sum = 0;
+    uint32_t base;
+    uint32_t words[NR_WORDS];
+    struct swd_parameters params;
+    struct swd_exec e;
+    void *meminfo_buf = NULL;
+    struct user_core_mem *cm;
+
+    meminfo_buf = malloc(4096);
+    if (!meminfo_buf)
+        return -1;
+
+    srand((unsigned long)time(NULL));
+
+    // opening /dev/swd halts the core
+    fd = open("/dev/swd", O_RDWR);
+    if(fd < 0){
+        printf("Err with open dev\n");
+        return -1;
+    }
+
+    params.arg[0] = (unsigned long)meminfo_buf;
+    ioctl(fd, SWDDEV_IOC_MEMINFO_GET, &params);
+    cm = (struct user_core_mem*)meminfo_buf;
+    base = cm->sram.base + DATA_OFF;
+
+    for (i = 0 ; i < NR_WORDS ; i++) {
+        words[i] = rand();
+        sum += words[i];
+    }
+
+    lseek(fd, base, SEEK_SET);
+    if (write(fd, words, sizeof(words)) != sizeof(words)) {
+        printf("Err with write\n");
+        goto error;
+    }
+
+    // the second call finds the blob loaded
+    for (i = 0 ; i < 2 ; i++) {
+        memset(&e, 0, sizeof(e));
+        e.code = (uintptr_t)sum_code;
+        e.code_len = sizeof(sum_code);
+        e.args[0] = base;
+        e.args[1] = NR_WORDS;
+
+        if (ioctl(fd, SWDDEV_IOC_EXEC, &e)) {
+            printf("Err with exec\n");
+            goto error;
+        }
+
+        printf("r0:%08x expected:%08x cycles:%u cached:%u\n", e.ret, sum, e.cycles, e.cached);
+        if (e.ret != sum) {
+            printf("Err, wrong sum\n");
+            goto error;
+        }
+    }
+
+    printf("Run function on core Success\n");
+
+error:
+    close(fd);
+    free(meminfo_buf);
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "../../include/swd_module.h"
+
+int main(int argc, char **argv)
+{
+    int fd = -1;
+    uint32_t buf_size;
+    uint32_t file_size;
+    FILE *fp = NULL;
+    uint8_t *buf;
+    uint8_t *result;
+    struct swd_parameters params;
+    void *meminfo_buf = NULL;
+    struct user_core_mem *cm;
+
+    meminfo_buf = malloc(4096);
+    if (!meminfo_buf)
+        return -1;
+
+    fd = open("/dev/swd", O_RDWR);
+    if(fd < 0){
+        printf("Err with open dev\n");
+        goto swd_open_fail;
+    }
+    fp = fopen(argv[1], "rb");
+    if (!fp) {
+        printf("Err with open %s\n", argv[1]);
+        goto bin_open_fail;
+    }
+
+    params.arg[0] = (unsigned long)meminfo_buf;
+    ioctl(fd, SWDDEV_IOC_MEMINFO_GET, &params);
+    cm = (struct user_core_mem*)meminfo_buf;
+
+    fseek(fp, 0L, SEEK_END);
+    file_size = ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+    if (file_size % cm->flash.program_size)
+        buf_size = cm->flash.program_size * ((file_size / cm->flash.program_size) + 1);
+    else
+        buf_size = file_size;
+
+    buf = malloc(buf_size);
+    result = malloc(buf_size);
+    if (!buf || !result) {
+        printf("Err with allocating buffer\n");
+        goto buf_alloc_fail;
+    }
+
+    // erased flash reads 0xff, the padding compresses well
+    memset(buf, 0xff, buf_size);
+    fread(buf, 1, file_size, fp);
+
+    printf("Erasing flash by page\n");
+    params.arg[0] = 0;
+    params.arg[1] = buf_size;
+    ioctl(fd, SWDDEV_IOC_ERSFLSH_PG, &params);
+
+    printf("Pragramming flash compressed\n");
+    params.arg[0] = (unsigned long)buf;
+    params.arg[1] = 0;
+    params.arg[2] = buf_size;
+    if (ioctl(fd, SWDDEV_IOC_DWNLDFLSH_Z, &params)) {
+        printf("Err with compressed download\n");
+        goto download_fail;
+    }
+    printf("Programmed %u bytes, %lu bytes/s\n", buf_size, params.ret);
+
+    lseek(fd, cm->flash.base, SEEK_SET);
+    read(fd, result, buf_size);
+    if (!memcmp(buf, result, buf_size))
+        printf("Verify programmed data Success\n");
+    else
+        printf("Err, Verify programmed data failed\n");
+
+    ioctl(fd, SWDDEV_IOC_UNHLTCORE);
+
+download_fail:
+buf_alloc_fail:
+    free(buf);
+    free(result);
+    free(meminfo_buf);
+    fclose(fp);
+
+bin_open_fail:
+    close(fd);
+
+swd_open_fail:
+    return 0;
+}
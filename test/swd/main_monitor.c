@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "../../include/swd_module.h"
+
+#define DHCSR           0xE000EDF0
+#define DHCSR_HALT      0xA05F0003  // DBGKEY | C_HALT | C_DEBUGEN
+#define TIMEOUT_MS      1000
+
+#define DP_WRITE(reg)   (reg)
+#define AP_WRITE(reg)   (SWD_DAP_APNDP | (reg))
+
+// wait for the next change of the core state
+static int wait_event(int fd, const char *what)
+{
+    int ret;
+    struct pollfd pfd = {.fd = fd, .events = POLLPRI};
+
+    ret = poll(&pfd, 1, TIMEOUT_MS);
+    if ((ret != 1) || !(pfd.revents & POLLPRI)) {
+        printf("Err, no event for %s\n", what);
+        return -1;
+    }
+
+    printf("core %s, event in time\n", what);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int fd = -1;
+    struct pollfd pfd;
+    struct swd_dap_transfer t;
+
+    // the halt is done by the core debug registers, not the driver
+    struct swd_dap_xfer xfers[] = {
+        {.request = DP_WRITE(0x8), .data = 0x0},
+        {.request = AP_WRITE(0x0), .data = 0x23000012},
+        {.request = AP_WRITE(0x4), .data = DHCSR},
+        {.request = AP_WRITE(0xC), .data = DHCSR_HALT},
+    };
+
+    // opening /dev/swd halts the core
+    fd = open("/dev/swd", O_RDWR);
+    if(fd < 0){
+        printf("Err with open dev\n");
+        return -1;
+    }
+
+    // the first poll() starts the monitor
+    pfd.fd = fd;
+    pfd.events = POLLPRI;
+    poll(&pfd, 1, 0);
+
+    if (ioctl(fd, SWDDEV_IOC_UNHLTCORE)) {
+        printf("Err with unhalt\n");
+        goto error;
+    }
+
+    if (wait_event(fd, "running"))
+        goto error;
+
+    memset(&t, 0, sizeof(t));
+    t.xfers = (uintptr_t)xfers;
+    t.nr_xfers = sizeof(xfers) / sizeof(xfers[0]);
+
+    if (ioctl(fd, SWDDEV_IOC_DAP_XFER, &t) || (t.done != t.nr_xfers)) {
+        printf("Err with dap transfer\n");
+        goto error;
+    }
+
+    if (wait_event(fd, "halted"))
+        goto error;
+
+    printf("Halt monitor Success\n");
+
+error:
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PCSR_DIR    "/sys/kernel/debug/swd/pcsr/"
+#define PROFILE_S   1
+#define NR_TOP      10
+
+static int write_file(const char *path, const char *s, size_t len)
+{
+    int fd;
+    ssize_t ret;
+
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+
+    ret = write(fd, s, len);
+    close(fd);
+
+    return (ret == len) ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    char line[64];
+    FILE *hist;
+
+    // the core should be running, i.e. the blink program
+    if (write_file(PCSR_DIR "hist", "0", 1) || write_file(PCSR_DIR "enable", "1", 1)) {
+        printf("Err with enable, debugfs mounted?\n");
+        return -1;
+    }
+
+    sleep(PROFILE_S);
+
+    write_file(PCSR_DIR "enable", "0", 1);
+
+    hist = fopen(PCSR_DIR "hist", "r");
+    if (!hist) {
+        printf("Err with open hist\n");
+        return -1;
+    }
+
+    // header, then the hottest pcs
+    for (i = 0 ; (i <= NR_TOP) && fgets(line, sizeof(line), hist) ; i++)
+        fputs(line, stdout);
+
+    fclose(hist);
+
+    return 0;
+}
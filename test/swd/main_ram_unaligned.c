@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "../../include/swd_module.h"
+
+#define AREA_SIZE   64
+
+// patch [off, off + len) of the area, the bytes around must stay
+static int patch_and_check(int fd, uint32_t base, uint8_t *area, uint32_t off, uint32_t len)
+{
+    int i;
+    uint8_t patch[AREA_SIZE];
+    uint8_t result[AREA_SIZE];
+
+    for (i = 0 ; i < len ; i++)
+        patch[i] = (uint8_t)rand();
+
+    lseek(fd, base + off, SEEK_SET);
+    if (write(fd, patch, len) != len) {
+        printf("Err with write off:%u len:%u\n", off, len);
+        return -1;
+    }
+    memcpy(area + off, patch, len);
+
+    // read the patch alone, then the whole area
+    lseek(fd, base + off, SEEK_SET);
+    if ((read(fd, result, len) != len) || memcmp(result, patch, len)) {
+        printf("Err, read back off:%u len:%u\n", off, len);
+        return -1;
+    }
+
+    lseek(fd, base, SEEK_SET);
+    if ((read(fd, result, AREA_SIZE) != AREA_SIZE) || memcmp(result, area, AREA_SIZE)) {
+        for (i = 0 ; i < AREA_SIZE ; i++) {
+            if (result[i] != area[i])
+                printf("area[%d]:%02x -- result[%d]:%02x\n", i, area[i], i, result[i]);
+        }
+        printf("Err, bytes around off:%u len:%u changed\n", off, len);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int fd = -1;
+    int err = 0;
+    uint32_t base;
+    uint8_t area[AREA_SIZE];
+    struct swd_parameters params;
+    void *meminfo_buf = NULL;
+    struct user_core_mem *cm;
+    // unaligned heads, short tails, both, and a burst between them
+    uint32_t cases[][2] = {{1, 1}, {2, 2}, {3, 1}, {1, 3}, {3, 3}, {5, 2}, {6, 7}, {9, 30}, {0, 3}, {4, 5}};
+
+    meminfo_buf = malloc(4096);
+    if (!meminfo_buf)
+        return -1;
+
+    srand((unsigned long)time(NULL));
+
+    fd = open("/dev/swd", O_RDWR);
+    if(fd < 0){
+        printf("Err with open dev\n");
+        return -1;
+    }
+
+    params.arg[0] = (unsigned long)meminfo_buf;
+    ioctl(fd, SWDDEV_IOC_MEMINFO_GET, &params);
+    cm = (struct user_core_mem*)meminfo_buf;
+    base = cm->sram.base;
+
+    // known content first
+    for (i = 0 ; i < AREA_SIZE ; i++)
+        area[i] = (uint8_t)rand();
+
+    lseek(fd, base, SEEK_SET);
+    if (write(fd, area, AREA_SIZE) != AREA_SIZE) {
+        printf("Err with write\n");
+        goto error;
+    }
+
+    for (i = 0 ; i < sizeof(cases) / sizeof(cases[0]) ; i++)
+        err |= patch_and_check(fd, base, area, cases[i][0], cases[i][1]);
+
+    // every sub-word access: each lane offset with 1 to 3 bytes,
+    // two units where it is byte + halfword or halfword + byte
+    for (i = 0 ; i < 4 * 3 ; i++)
+        err |= patch_and_check(fd, base, area, 48 + (i / 3), (i % 3) + 1);
+
+    if (err) {
+        printf("Verify unaligned access Failed\n");
+        goto error;
+    }
+
+    printf("Verify unaligned access Success\n");
+
+    close(fd);
+    free(meminfo_buf);
+
+    return 0;
+
+error:
+    close(fd);
+    free(meminfo_buf);
+
+    return -1;
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "../../include/swd_module.h"
+
+int main(int argc, char **argv)
+{
+    int i;
+    int ret;
+    int fd = -1;
+    struct swd_core_regs regs;
+
+    // opening /dev/swd halts the core
+    fd = open("/dev/swd", O_RDWR);
+    if(fd < 0){
+        printf("Err with open dev\n");
+        return -1;
+    }
+
+    ret = ioctl(fd, SWDDEV_IOC_REGS_GET, &regs);
+    if (ret) {
+        perror("SWDDEV_IOC_REGS_GET");
+        printf("Err with register snapshot ret:%d\n", ret);
+        goto error;
+    }
+
+    for (i = 0 ; i < 13 ; i++)
+        printf("r%-2d  : %08x\n", i, regs.r[i]);
+    printf("sp   : %08x\n", regs.r[13]);
+    printf("lr   : %08x\n", regs.r[14]);
+    printf("pc   : %08x\n", regs.r[15]);
+    printf("xpsr : %08x\n", regs.xpsr);
+    printf("msp  : %08x\n", regs.msp);
+    printf("psp  : %08x\n", regs.psp);
+    printf("control:%02x faultmask:%02x basepri:%02x primask:%02x\n",
+            regs.special >> 24, (regs.special >> 16) & 0xff,
+            (regs.special >> 8) & 0xff, regs.special & 0xff);
+    printf("dhcsr:%08x dfsr:%08x cfsr:%08x hfsr:%08x\n",
+            regs.dhcsr, regs.dfsr, regs.cfsr, regs.hfsr);
+
+    // the stack pointer banked by CONTROL.SPSEL
+    if (regs.r[13] != (((regs.special >> 24) & 0x2) ? regs.psp : regs.msp)) {
+        printf("Err, sp does not match msp/psp\n");
+        ret = -1;
+        goto error;
+    }
+
+    printf("Register snapshot Success\n");
+
+error:
+    close(fd);
+
+    return ret ? -1 : 0;
+}
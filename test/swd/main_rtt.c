@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TIMEOUT_MS 1000
+#define NR_POLLS 5
+
+int main(int argc, char **argv)
+{
+    int i;
+    int fd = -1;
+    ssize_t len;
+    char buf[256];
+    struct pollfd pfd;
+
+    // needs a firmware with SEGGER RTT, the control block is searched in sram
+    fd = open("/dev/swd_rtt0", O_RDWR | O_NONBLOCK);
+    if(fd < 0){
+        printf("Err with open dev fd:%d\n", fd);
+        return -1;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (i = 0 ; i < NR_POLLS ; i++) {
+        if (poll(&pfd, 1, TIMEOUT_MS) <= 0)
+            continue;
+
+        len = read(fd, buf, sizeof(buf));
+        if (len > 0)
+            fwrite(buf, 1, len, stdout);
+    }
+
+    len = write(fd, "ping\n", 5);
+    printf("\nwrote %zd bytes to down buffer 0\n", len);
+
+    close(fd);
+
+    return 0;
+}
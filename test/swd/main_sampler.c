@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "../../include/swd_module.h"
+
+#define RAM_BASE 0x20000000
+#define NR_RECORDS 16
+
+int main(int argc, char **argv)
+{
+    int i, j;
+    int fd = -1;
+    ssize_t len;
+    uint32_t rec_size;
+    uint32_t buf[NR_RECORDS * (sizeof(struct swd_sampler_record) / 4 + 3)];
+    struct swd_sampler_cfg cfg = {0};
+    struct swd_sampler_record *rec;
+
+    fd = open("/dev/swd_sampler", O_RDWR);
+    if(fd < 0){
+        printf("Err with open dev fd:%d\n", fd);
+        return -1;
+    }
+
+    // sample a word, a halfword and a byte every 1ms
+    cfg.period_us = 1000;
+    cfg.nr_records = 1024;
+    cfg.nr_vars = 3;
+    cfg.vars[0].addr = RAM_BASE;
+    cfg.vars[0].width = 4;
+    cfg.vars[1].addr = RAM_BASE + 0x6;
+    cfg.vars[1].width = 2;
+    cfg.vars[2].addr = RAM_BASE + 0x100;
+    cfg.vars[2].width = 1;
+    if (ioctl(fd, SWDDEV_IOC_SAMPLER_CFG, &cfg)) {
+        printf("Err with sampler config\n");
+        goto sampler_fail;
+    }
+
+    ioctl(fd, SWDDEV_IOC_SAMPLER_START);
+
+    rec_size = sizeof(struct swd_sampler_record) + cfg.nr_vars * sizeof(uint32_t);
+    for (i = 0 ; i < NR_RECORDS ; ) {
+        len = read(fd, buf, sizeof(buf));
+        if (len <= 0)
+            break;
+
+        for (j = 0 ; j < len / rec_size ; j++, i++) {
+            rec = (struct swd_sampler_record*)((char*)buf + j * rec_size);
+            printf("%u %llu %08x %04x %02x\n", rec->seq,
+                (unsigned long long)rec->timestamp_ns,
+                rec->values[0], rec->values[1], rec->values[2]);
+        }
+    }
+
+    ioctl(fd, SWDDEV_IOC_SAMPLER_STOP);
+
+sampler_fail:
+    close(fd);
+
+    return 0;
+}
@@ -4,6 +4,14 @@ echo "============== Test Alive =============="
 ./main_test_alive
 echo ""
 
+echo "============== Core register snapshot =============="
+./main_regs
+echo ""
+
+echo "============== DAP transfer batch =============="
+./main_dap_transfer
+echo ""
+
 echo "============== RAM Download =============="
 ./main_ram_write
 echo ""
@@ -12,6 +20,14 @@ echo "============== RAM read(read default) =============="
 ./main_ram_read > ram.txt
 echo "Dumped data in ram to file ram.txt\n"
 
+echo "============== RAM unaligned access =============="
+./main_ram_unaligned
+echo ""
+
+echo "============== Run function on core =============="
+./main_exec
+echo ""
+
 echo "============== Flash Download =============="
 ./main_flash_write
 echo ""
@@ -24,3 +40,23 @@ echo "============== Download program to flash =============="
 ./main_flash_program ../blink_${1}.bin
 echo ""
 
+echo "============== Download compressed program to flash =============="
+./main_flash_program_z ../blink_${1}.bin
+echo ""
+
+echo "============== Sample ram periodically =============="
+./main_sampler
+echo ""
+
+echo "============== Read RTT channel 0 =============="
+./main_rtt
+echo ""
+
+echo "============== Profile the running core by PCSR =============="
+./main_profile
+echo ""
+
+echo "============== Notify the core state by poll =============="
+./main_monitor
+echo ""
+
@@ -0,0 +1,1073 @@
+// GDB remote serial protocol server on /dev/swd
+//
+// $ swd_gdbserver [port]     (default 3333, localhost only)
+// (gdb) target extended-remote localhost:3333
+//
+// Memory reads of sram/flash are served from a read-ahead window filled by
+// one read() of /dev/swd, sram writes are gathered until something else
+// is asked, flash writes are buffered by sector and programmed once.
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../../include/swd_module.h"
+
+#define GDB_PORT        3333
+#define PACKET_SIZE     0x4000      // payload bytes announced to gdb
+#define CACHE_SIZE      0x1000      // read-ahead window
+#define WBUF_SIZE       0x10000     // sram writes gathered
+#define POLL_MS         10          // halt check while running
+
+#define DHCSR           0xE000EDF0
+#define DCRSR           0xE000EDF4
+#define DCRDR           0xE000EDF8
+#define DFSR            0xE000ED30
+#define DBGKEY          (0xA05F << 16)
+#define C_DEBUGEN       (1 << 0)
+#define C_HALT          (1 << 1)
+#define C_STEP          (1 << 2)
+#define C_MASKINTS      (1 << 3)
+#define S_REGRDY        (1 << 16)
+#define S_HALT          (1 << 17)
+#define DCRSR_WNR       (1 << 16)
+
+#define FP_CTRL         0xE0002000
+#define FP_COMP0        0xE0002008
+#define FP_CTRL_KEY     (1 << 1)
+#define FP_CTRL_ENABLE  (1 << 0)
+#define FP_MAX          8
+
+#define NR_REGS         19          // r0-r15, xpsr, msp, psp
+
+struct mem_region {
+    uint32_t base;
+    uint32_t size;
+};
+
+static int swd_fd = -1;
+static int gdb_fd = -1;
+static int no_ack;
+
+static struct mem_region sram;
+static struct mem_region flash;
+static struct user_core_mem *cm;
+
+static struct {
+    uint32_t addr;
+    uint32_t len;
+    uint8_t buf[CACHE_SIZE];
+} cache;
+
+static struct {
+    uint32_t addr;
+    uint32_t len;
+    uint8_t buf[WBUF_SIZE];
+} wbuf;
+
+static struct {
+    int valid;
+    uint32_t start;     // offset of the sector in flash
+    uint32_t size;
+    uint32_t lo, hi;    // written part of the sector
+    uint8_t *buf;
+} sector;
+
+#define SWBP_MAX        32
+#define BKPT_INSN       0xbe00
+
+static struct {
+    uint32_t addr;
+    uint16_t insn;
+} swbp[SWBP_MAX];
+static int swbp_nr;
+
+static uint32_t fp_addr[FP_MAX];
+static int fp_used[FP_MAX];
+static int fp_nr;
+
+static char pkt[PACKET_SIZE * 2 + 64];
+static char out[PACKET_SIZE * 2 + 64];
+
+/* ---------------------------------------------------------------- target */
+
+static int in_region(struct mem_region *r, uint32_t addr, uint32_t len)
+{
+    return (addr >= r->base) && (addr - r->base + len <= r->size);
+}
+
+static int swd_pread(void *to, uint32_t addr, uint32_t len)
+{
+    if (lseek(swd_fd, addr, SEEK_SET) < 0)
+        return -1;
+
+    return (read(swd_fd, to, len) == len) ? 0 : -1;
+}
+
+static int swd_pwrite(const void *from, uint32_t addr, uint32_t len)
+{
+    if (lseek(swd_fd, addr, SEEK_SET) < 0)
+        return -1;
+
+    return (write(swd_fd, from, len) == len) ? 0 : -1;
+}
+
+static int reg32_read(uint32_t addr, uint32_t *val)
+{
+    return swd_pread(val, addr, sizeof(uint32_t));
+}
+
+static int reg32_write(uint32_t addr, uint32_t val)
+{
+    return swd_pwrite(&val, addr, sizeof(uint32_t));
+}
+
+static void cache_drop(void)
+{
+    cache.len = 0;
+}
+
+static int wbuf_flush(void)
+{
+    int ret = 0;
+
+    if (wbuf.len)
+        ret = swd_pwrite(wbuf.buf, wbuf.addr, wbuf.len);
+    wbuf.len = 0;
+
+    return ret;
+}
+
+// sram/flash reads go through the window, the rest (peripherals, debug
+// registers) as asked since reading them may have side effects
+static int mem_read(uint8_t *to, uint32_t addr, uint32_t len)
+{
+    uint32_t n;
+    uint32_t base;
+    struct mem_region *r;
+
+    if (wbuf_flush())
+        return -1;
+
+    if (in_region(&sram, addr, len))
+        r = &sram;
+    else if (in_region(&flash, addr, len))
+        r = &flash;
+    else
+        return swd_pread(to, addr, len);
+
+    while (len) {
+        if (!cache.len || (addr < cache.addr) || (addr >= cache.addr + cache.len)) {
+            base = addr & ~(CACHE_SIZE - 1);
+            if (base < r->base)
+                base = r->base;
+            n = r->base + r->size - base;
+            cache.addr = base;
+            cache.len = (n < CACHE_SIZE) ? n : CACHE_SIZE;
+            if (swd_pread(cache.buf, cache.addr, cache.len)) {
+                cache_drop();
+                return -1;
+            }
+        }
+
+        n = cache.addr + cache.len - addr;
+        if (n > len)
+            n = len;
+        memcpy(to, cache.buf + (addr - cache.addr), n);
+        to += n;
+        addr += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int mem_write(const uint8_t *from, uint32_t addr, uint32_t len)
+{
+    cache_drop();
+
+    // flash only by vFlashWrite
+    if (in_region(&flash, addr, len))
+        return -1;
+
+    if (!in_region(&sram, addr, len)) {
+        if (wbuf_flush())
+            return -1;
+        return swd_pwrite(from, addr, len);
+    }
+
+    // gdb load sends a section as consecutive packets
+    if (wbuf.len && ((wbuf.addr + wbuf.len != addr) || (wbuf.len + len > WBUF_SIZE))) {
+        if (wbuf_flush())
+            return -1;
+    }
+
+    if (len > WBUF_SIZE)
+        return swd_pwrite(from, addr, len);
+
+    if (!wbuf.len)
+        wbuf.addr = addr;
+    memcpy(wbuf.buf + wbuf.len, from, len);
+    wbuf.len += len;
+
+    return 0;
+}
+
+static int core_halted(void)
+{
+    uint32_t dhcsr;
+
+    if (reg32_read(DHCSR, &dhcsr))
+        return -1;
+
+    return !!(dhcsr & S_HALT);
+}
+
+static int core_halt(void)
+{
+    return reg32_write(DHCSR, DBGKEY | C_DEBUGEN | C_HALT);
+}
+
+// debug stays enabled so the breakpoints halt the core
+static int core_resume(int step)
+{
+    cache_drop();
+    if (wbuf_flush())
+        return -1;
+
+    // the halt reasons are cleared by writing 1
+    reg32_write(DFSR, 0x1F);
+
+    // C_MASKINTS may only change while halted, a step runs without interrupts
+    if (step) {
+        if (reg32_write(DHCSR, DBGKEY | C_DEBUGEN | C_HALT | C_MASKINTS))
+            return -1;
+        return reg32_write(DHCSR, DBGKEY | C_DEBUGEN | C_MASKINTS | C_STEP);
+    }
+
+    if (reg32_write(DHCSR, DBGKEY | C_DEBUGEN | C_HALT))
+        return -1;
+    return reg32_write(DHCSR, DBGKEY | C_DEBUGEN);
+}
+
+static int reg_write(int n, uint32_t val)
+{
+    int retry = 100;
+    uint32_t dhcsr;
+
+    if (reg32_write(DCRDR, val) || reg32_write(DCRSR, n | DCRSR_WNR))
+        return -1;
+
+    do {
+        if (reg32_read(DHCSR, &dhcsr))
+            return -1;
+    } while (!(dhcsr & S_REGRDY) && retry--);
+
+    return (dhcsr & S_REGRDY) ? 0 : -1;
+}
+
+static int regs_read(uint32_t *regs)
+{
+    struct swd_core_regs r;
+
+    if (wbuf_flush() || ioctl(swd_fd, SWDDEV_IOC_REGS_GET, &r))
+        return -1;
+
+    memcpy(regs, r.r, sizeof(r.r));
+    regs[16] = r.xpsr;
+    regs[17] = r.msp;
+    regs[18] = r.psp;
+
+    return 0;
+}
+
+/* ------------------------------------------------------------ flash/FPB */
+
+static int flash_find_sector(uint32_t offset, uint32_t *start, uint32_t *size)
+{
+    uint32_t i;
+
+    if (!cm->flash.attr) {
+        *size = cm->mem_segs[cm->flash.offset].size;
+        *start = offset & ~(*size - 1);
+        return (offset < cm->flash.len) ? 0 : -1;
+    }
+
+    for (i = cm->flash.offset ; i < cm->flash.offset + cm->flash.len ; i++) {
+        if ((offset >= cm->mem_segs[i].start) && (offset < cm->mem_segs[i].start + cm->mem_segs[i].size)) {
+            *start = cm->mem_segs[i].start;
+            *size = cm->mem_segs[i].size;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// the written part of the sector goes in one download, padded to words
+static int sector_flush(void)
+{
+    uint32_t lo, hi;
+    struct swd_parameters params;
+
+    if (!sector.valid || (sector.lo == sector.hi))
+        return 0;
+
+    lo = sector.lo & ~0x3;
+    hi = (sector.hi + 3) & ~0x3;
+
+    params.arg[0] = (unsigned long)(sector.buf + lo);
+    params.arg[1] = sector.start + lo;
+    params.arg[2] = hi - lo;
+    sector.lo = sector.hi = 0;
+    memset(sector.buf, 0xff, sector.size);
+
+    return ioctl(swd_fd, SWDDEV_IOC_DWNLDFLSH, &params) ? -1 : 0;
+}
+
+static int flash_write(const uint8_t *from, uint32_t addr, uint32_t len)
+{
+    uint32_t n;
+    uint32_t start, size;
+    uint32_t offset = addr - flash.base;
+
+    cache_drop();
+
+    while (len) {
+        if (!sector.valid || (offset < sector.start) || (offset >= sector.start + sector.size)) {
+            if (sector_flush() || flash_find_sector(offset, &start, &size))
+                return -1;
+
+            if (!sector.valid || (size > sector.size)) {
+                free(sector.buf);
+                sector.buf = malloc(size);
+                if (!sector.buf)
+                    return -1;
+            }
+            memset(sector.buf, 0xff, size);
+            sector.valid = 1;
+            sector.start = start;
+            sector.size = size;
+            sector.lo = sector.hi = 0;
+        }
+
+        n = sector.start + sector.size - offset;
+        if (n > len)
+            n = len;
+
+        // a hole would be padded with 0xff, which is what erased flash holds
+        if (sector.lo == sector.hi)
+            sector.lo = offset - sector.start;
+        memcpy(sector.buf + offset - sector.start, from, n);
+        if (offset - sector.start < sector.lo)
+            sector.lo = offset - sector.start;
+        if (offset - sector.start + n > sector.hi)
+            sector.hi = offset - sector.start + n;
+
+        from += n;
+        offset += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int flash_erase(uint32_t addr, uint32_t len)
+{
+    struct swd_parameters params;
+
+    cache_drop();
+    if (sector_flush())
+        return -1;
+
+    params.arg[0] = addr - flash.base;
+    params.arg[1] = len;
+
+    return ioctl(swd_fd, SWDDEV_IOC_ERSFLSH_PG, &params) ? -1 : 0;
+}
+
+static int fpb_init(void)
+{
+    uint32_t ctrl;
+
+    if (reg32_read(FP_CTRL, &ctrl))
+        return -1;
+
+    fp_nr = ((ctrl >> 4) & 0xF) | ((ctrl >> 8) & 0x70);
+    if (fp_nr > FP_MAX)
+        fp_nr = FP_MAX;
+
+    return reg32_write(FP_CTRL, FP_CTRL_KEY | FP_CTRL_ENABLE);
+}
+
+// FPB v1 comparators match code below 0x20000000, by halfword
+static int fpb_set(uint32_t addr, int set)
+{
+    int i;
+    uint32_t comp;
+
+    if (addr >= 0x20000000)
+        return -1;
+
+    for (i = 0 ; i < fp_nr ; i++) {
+        if (set ? !fp_used[i] : (fp_used[i] && (fp_addr[i] == addr)))
+            break;
+    }
+    if (i == fp_nr)
+        return set ? -1 : 0;
+
+    comp = (addr & 0x1FFFFFFC) | ((addr & 0x2) ? (2u << 30) : (1u << 30)) | 0x1;
+    if (reg32_write(FP_COMP0 + i * 4, set ? comp : 0))
+        return -1;
+
+    fp_used[i] = set;
+    fp_addr[i] = addr;
+
+    return 0;
+}
+
+// code in sram takes a bkpt instruction instead
+static int swbp_set(uint32_t addr, int set)
+{
+    int i;
+    uint16_t insn = BKPT_INSN;
+
+    for (i = 0 ; i < swbp_nr ; i++) {
+        if (swbp[i].addr == addr)
+            break;
+    }
+
+    if (!set) {
+        if (i == swbp_nr)
+            return 0;
+        if (mem_write((uint8_t*)&swbp[i].insn, addr, sizeof(uint16_t)))
+            return -1;
+        swbp[i] = swbp[--swbp_nr];
+        return 0;
+    }
+
+    if ((i < swbp_nr) || (swbp_nr == SWBP_MAX))
+        return (i < swbp_nr) ? 0 : -1;
+
+    if (mem_read((uint8_t*)&swbp[i].insn, addr, sizeof(uint16_t)) || \
+        mem_write((uint8_t*)&insn, addr, sizeof(uint16_t)))
+        return -1;
+    swbp[i].addr = addr;
+    swbp_nr++;
+
+    return 0;
+}
+
+static void fpb_clear_all(void)
+{
+    int i;
+
+    for (i = 0 ; i < fp_nr ; i++) {
+        if (fp_used[i])
+            fpb_set(fp_addr[i], 0);
+    }
+
+    while (swbp_nr)
+        swbp_set(swbp[0].addr, 0);
+}
+
+/* --------------------------------------------------------------- packets */
+
+static const char hexchars[] = "0123456789abcdef";
+
+static int hex(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    return -1;
+}
+
+static char *put_hex8(char *p, uint8_t v)
+{
+    *p++ = hexchars[v >> 4];
+    *p++ = hexchars[v & 0xF];
+    return p;
+}
+
+// registers go little endian
+static char *put_reg(char *p, uint32_t v)
+{
+    int i;
+
+    for (i = 0 ; i < 4 ; i++)
+        p = put_hex8(p, (v >> (i * 8)) & 0xFF);
+    return p;
+}
+
+static uint32_t get_reg(const char *p)
+{
+    int i;
+    uint32_t v = 0;
+
+    for (i = 0 ; i < 4 ; i++)
+        v |= (uint32_t)((hex(p[i * 2]) << 4) | hex(p[i * 2 + 1])) << (i * 8);
+    return v;
+}
+
+static int get_byte(void)
+{
+    uint8_t c;
+
+    if (recv(gdb_fd, &c, 1, 0) != 1)
+        return -1;
+    return c;
+}
+
+static int send_all(const char *s, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = send(gdb_fd, s, len, 0);
+        if (n <= 0)
+            return -1;
+        s += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int put_packet(const char *data, size_t len)
+{
+    int c;
+    size_t i;
+    uint8_t sum = 0;
+    char tail[3];
+
+    for (i = 0 ; i < len ; i++)
+        sum += (uint8_t)data[i];
+    tail[0] = '#';
+    put_hex8(tail + 1, sum);
+
+    do {
+        if (send_all("$", 1) || send_all(data, len) || send_all(tail, 3))
+            return -1;
+        if (no_ack)
+            return 0;
+        c = get_byte();
+    } while (c == '-');
+
+    return (c == '+') ? 0 : -1;
+}
+
+static int put_str(const char *s)
+{
+    return put_packet(s, strlen(s));
+}
+
+// returns the payload length, binary escapes (X, vFlashWrite) are undone
+static int get_packet(void)
+{
+    int c;
+    int len;
+    uint8_t sum;
+    char cs[2];
+
+    for (;;) {
+        do {
+            c = get_byte();
+            if (c < 0)
+                return -1;
+        } while (c != '$');
+
+        len = 0;
+        sum = 0;
+        while ((c = get_byte()) != '#') {
+            if ((c < 0) || (len >= sizeof(pkt) - 1))
+                return -1;
+            sum += c;
+            if (c == '}') {
+                c = get_byte();
+                if (c < 0)
+                    return -1;
+                sum += c;
+                c ^= 0x20;
+            }
+            pkt[len++] = c;
+        }
+        pkt[len] = 0;
+
+        cs[0] = get_byte();
+        cs[1] = get_byte();
+        if (no_ack)
+            return len;
+
+        if (((hex(cs[0]) << 4) | hex(cs[1])) == sum) {
+            send_all("+", 1);
+            return len;
+        }
+        send_all("-", 1);
+    }
+}
+
+static void put_error(void)
+{
+    put_str("E01");
+}
+
+static void put_ok(int ret)
+{
+    if (ret)
+        put_error();
+    else
+        put_str("OK");
+}
+
+/* -------------------------------------------------------------- commands */
+
+static void cmd_read_regs(void)
+{
+    int i;
+    char *p = out;
+    uint32_t regs[NR_REGS];
+
+    if (regs_read(regs)) {
+        put_error();
+        return;
+    }
+
+    for (i = 0 ; i < NR_REGS ; i++)
+        p = put_reg(p, regs[i]);
+    put_packet(out, p - out);
+}
+
+static void cmd_write_regs(const char *p, int len)
+{
+    int i;
+    int ret = 0;
+
+    if (len < NR_REGS * 8) {
+        put_error();
+        return;
+    }
+
+    for (i = 0 ; i < NR_REGS ; i++)
+        ret |= reg_write(i, get_reg(p + i * 8));
+    put_ok(ret);
+}
+
+static void cmd_read_reg(const char *p)
+{
+    uint32_t regs[NR_REGS];
+    unsigned long n = strtoul(p, NULL, 16);
+
+    if ((n >= NR_REGS) || regs_read(regs)) {
+        put_error();
+        return;
+    }
+
+    put_packet(out, put_reg(out, regs[n]) - out);
+}
+
+static void cmd_write_reg(const char *p)
+{
+    char *end;
+    unsigned long n = strtoul(p, &end, 16);
+
+    if ((n >= NR_REGS) || (*end != '=')) {
+        put_error();
+        return;
+    }
+
+    put_ok(reg_write(n, get_reg(end + 1)));
+}
+
+static void cmd_read_mem(const char *p)
+{
+    uint32_t i;
+    char *end;
+    char *o = out;
+    static uint8_t buf[PACKET_SIZE];
+    uint32_t addr = strtoul(p, &end, 16);
+    uint32_t len = strtoul(end + 1, NULL, 16);
+
+    if (len > PACKET_SIZE / 2)
+        len = PACKET_SIZE / 2;
+
+    if (mem_read(buf, addr, len)) {
+        put_error();
+        return;
+    }
+
+    for (i = 0 ; i < len ; i++)
+        o = put_hex8(o, buf[i]);
+    put_packet(out, o - out);
+}
+
+// M addr,len:hex  X addr,len:binary
+static void cmd_write_mem(const char *p, int len, int binary)
+{
+    uint32_t i;
+    char *end;
+    static uint8_t buf[PACKET_SIZE];
+    uint32_t addr = strtoul(p, &end, 16);
+    uint32_t n = strtoul(end + 1, &end, 16);
+    const char *data = end + 1;
+
+    if ((*end != ':') || (n > PACKET_SIZE)) {
+        put_error();
+        return;
+    }
+
+    if (binary) {
+        if (data + n > pkt + len) {
+            put_error();
+            return;
+        }
+        memcpy(buf, data, n);
+    } else {
+        for (i = 0 ; i < n ; i++)
+            buf[i] = (hex(data[i * 2]) << 4) | hex(data[i * 2 + 1]);
+    }
+
+    put_ok(n ? mem_write(buf, addr, n) : 0);
+}
+
+static int xml_memory_map(char *xml, size_t size)
+{
+    uint32_t i;
+    int n;
+
+    n = snprintf(xml, size, "<?xml version=\"1.0\"?>\n"
+                 "<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" \"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n"
+                 "<memory-map>\n"
+                 "<memory type=\"ram\" start=\"0x%08x\" length=\"0x%x\"/>\n", sram.base, sram.size);
+
+    if (!cm->flash.attr) {
+        n += snprintf(xml + n, size - n,
+                 "<memory type=\"flash\" start=\"0x%08x\" length=\"0x%x\"><property name=\"blocksize\">0x%x</property></memory>\n",
+                 flash.base, flash.size, cm->mem_segs[cm->flash.offset].size);
+    } else {
+        for (i = cm->flash.offset ; i < cm->flash.offset + cm->flash.len ; i++)
+            n += snprintf(xml + n, size - n,
+                 "<memory type=\"flash\" start=\"0x%08x\" length=\"0x%x\"><property name=\"blocksize\">0x%x</property></memory>\n",
+                 flash.base + cm->mem_segs[i].start, cm->mem_segs[i].size, cm->mem_segs[i].size);
+    }
+
+    n += snprintf(xml + n, size - n, "</memory-map>\n");
+
+    return n;
+}
+
+static const char target_xml[] =
+    "<?xml version=\"1.0\"?>\n"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+    "<target>\n"
+    "<architecture>arm</architecture>\n"
+    "<feature name=\"org.gnu.gdb.arm.m-profile\">\n"
+    "<reg name=\"r0\" bitsize=\"32\" regnum=\"0\"/>\n"
+    "<reg name=\"r1\" bitsize=\"32\"/>\n"
+    "<reg name=\"r2\" bitsize=\"32\"/>\n"
+    "<reg name=\"r3\" bitsize=\"32\"/>\n"
+    "<reg name=\"r4\" bitsize=\"32\"/>\n"
+    "<reg name=\"r5\" bitsize=\"32\"/>\n"
+    "<reg name=\"r6\" bitsize=\"32\"/>\n"
+    "<reg name=\"r7\" bitsize=\"32\"/>\n"
+    "<reg name=\"r8\" bitsize=\"32\"/>\n"
+    "<reg name=\"r9\" bitsize=\"32\"/>\n"
+    "<reg name=\"r10\" bitsize=\"32\"/>\n"
+    "<reg name=\"r11\" bitsize=\"32\"/>\n"
+    "<reg name=\"r12\" bitsize=\"32\"/>\n"
+    "<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>\n"
+    "<reg name=\"lr\" bitsize=\"32\"/>\n"
+    "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>\n"
+    "<reg name=\"xpsr\" bitsize=\"32\" regnum=\"16\"/>\n"
+    "</feature>\n"
+    "<feature name=\"org.gnu.gdb.arm.m-system\">\n"
+    "<reg name=\"msp\" bitsize=\"32\" regnum=\"17\" type=\"data_ptr\"/>\n"
+    "<reg name=\"psp\" bitsize=\"32\" regnum=\"18\" type=\"data_ptr\"/>\n"
+    "</feature>\n"
+    "</target>\n";
+
+// qXfer:<object>:read:<annex>:offset,length
+static void cmd_xfer(const char *p)
+{
+    char *end;
+    const char *doc;
+    static char map[8192];
+    size_t size;
+    unsigned long off, len;
+
+    if (!strncmp(p, "memory-map:read::", 17)) {
+        size = xml_memory_map(map, sizeof(map));
+        doc = map;
+        p += 17;
+    } else if (!strncmp(p, "features:read:target.xml:", 25)) {
+        doc = target_xml;
+        size = sizeof(target_xml) - 1;
+        p += 25;
+    } else {
+        put_str("");
+        return;
+    }
+
+    off = strtoul(p, &end, 16);
+    len = strtoul(end + 1, NULL, 16);
+    if (off >= size) {
+        put_str("l");
+        return;
+    }
+    if (len > size - off)
+        len = size - off;
+    if (len > PACKET_SIZE - 1)
+        len = PACKET_SIZE - 1;
+
+    out[0] = (off + len < size) ? 'm' : 'l';
+    memcpy(out + 1, doc + off, len);
+    put_packet(out, len + 1);
+}
+
+static void cmd_query(const char *p)
+{
+    char s[128];
+
+    if (!strncmp(p, "qSupported", 10)) {
+        snprintf(s, sizeof(s), "PacketSize=%x;qXfer:memory-map:read+;qXfer:features:read+;QStartNoAckMode+", PACKET_SIZE);
+        put_str(s);
+    } else if (!strncmp(p, "qXfer:", 6)) {
+        cmd_xfer(p + 6);
+    } else if (!strcmp(p, "QStartNoAckMode")) {
+        put_str("OK");
+        no_ack = 1;
+    } else if (!strcmp(p, "qAttached")) {
+        put_str("1");
+    } else if (!strcmp(p, "qC")) {
+        put_str("QC1");
+    } else if (!strcmp(p, "qfThreadInfo")) {
+        put_str("m1");
+    } else if (!strcmp(p, "qsThreadInfo")) {
+        put_str("l");
+    } else {
+        put_str("");
+    }
+}
+
+static void cmd_flash(const char *p, int len)
+{
+    char *end;
+    uint32_t addr;
+    uint32_t n;
+
+    if (!strncmp(p, "vFlashErase:", 12)) {
+        addr = strtoul(p + 12, &end, 16);
+        n = strtoul(end + 1, NULL, 16);
+        put_ok(in_region(&flash, addr, n) ? flash_erase(addr, n) : -1);
+    } else if (!strncmp(p, "vFlashWrite:", 12)) {
+        addr = strtoul(p + 12, &end, 16);
+        n = pkt + len - (end + 1);
+        put_ok(in_region(&flash, addr, n) ? flash_write((uint8_t*)end + 1, addr, n) : -1);
+    } else if (!strcmp(p, "vFlashDone")) {
+        put_ok(sector_flush());
+    } else {
+        put_str("");
+    }
+}
+
+// Z1 and Z0 in flash take an FPB comparator, Z0 in sram a bkpt instruction
+static void cmd_breakpoint(const char *p, int set)
+{
+    uint32_t addr;
+
+    if ((p[0] != '0') && (p[0] != '1')) {
+        put_str("");
+        return;
+    }
+
+    addr = strtoul(p + 2, NULL, 16);
+    if ((p[0] == '0') && in_region(&sram, addr, sizeof(uint16_t)))
+        put_ok(swbp_set(addr, set));
+    else
+        put_ok(fpb_set(addr, set));
+}
+
+// runs until halted or gdb sends ^C
+static void cmd_continue(int step)
+{
+    int halted;
+    uint8_t c;
+    struct pollfd pfd = {.fd = gdb_fd, .events = POLLIN};
+
+    if (core_resume(step)) {
+        put_error();
+        return;
+    }
+
+    for (;;) {
+        halted = core_halted();
+        if (halted < 0) {
+            put_str("S0b");
+            return;
+        }
+        if (halted)
+            break;
+
+        if ((poll(&pfd, 1, POLL_MS) > 0) && (recv(gdb_fd, &c, 1, MSG_PEEK) == 1) && (c == 0x03)) {
+            recv(gdb_fd, &c, 1, 0);
+            core_halt();
+        }
+    }
+
+    cache_drop();
+    put_str("S05");
+}
+
+static void serve(void)
+{
+    int len;
+
+    no_ack = 0;
+    cache_drop();
+
+    while ((len = get_packet()) >= 0) {
+        switch (pkt[0]) {
+        case '?':
+            core_halt();
+            put_str("S05");
+            break;
+        case 'g':
+            cmd_read_regs();
+            break;
+        case 'G':
+            cmd_write_regs(pkt + 1, len - 1);
+            break;
+        case 'p':
+            cmd_read_reg(pkt + 1);
+            break;
+        case 'P':
+            cmd_write_reg(pkt + 1);
+            break;
+        case 'm':
+            cmd_read_mem(pkt + 1);
+            break;
+        case 'M':
+            cmd_write_mem(pkt + 1, len, 0);
+            break;
+        case 'X':
+            cmd_write_mem(pkt + 1, len, 1);
+            break;
+        case 'c':
+            cmd_continue(0);
+            break;
+        case 's':
+            cmd_continue(1);
+            break;
+        case 'Z':
+            cmd_breakpoint(pkt + 1, 1);
+            break;
+        case 'z':
+            cmd_breakpoint(pkt + 1, 0);
+            break;
+        case 'q':
+        case 'Q':
+            cmd_query(pkt);
+            break;
+        case 'v':
+            cmd_flash(pkt, len);
+            break;
+        case 'H':
+            put_str("OK");
+            break;
+        case 'D':
+            put_str("OK");
+            return;
+        case 'k':
+            return;
+        default:
+            put_str("");
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int one = 1;
+    int lfd;
+    struct sockaddr_in sa;
+    struct swd_parameters params;
+    int port = (argc > 1) ? atoi(argv[1]) : GDB_PORT;
+
+    cm = malloc(4096);
+    if (!cm)
+        return -1;
+
+    // opening /dev/swd halts the core
+    swd_fd = open("/dev/swd", O_RDWR);
+    if (swd_fd < 0) {
+        printf("Err with open dev\n");
+        return -1;
+    }
+
+    params.arg[0] = (unsigned long)cm;
+    if (ioctl(swd_fd, SWDDEV_IOC_MEMINFO_GET, &params)) {
+        printf("Err with meminfo\n");
+        return -1;
+    }
+
+    sram.base = cm->sram.base;
+    sram.size = cm->sram.len;
+    flash.base = cm->flash.base;
+    if (!cm->flash.attr) {
+        flash.size = cm->flash.len;
+    } else {
+        struct user_mem_seg *last = &cm->mem_segs[cm->flash.offset + cm->flash.len - 1];
+        flash.size = last->start + last->size;
+    }
+
+    if (fpb_init())
+        printf("Err with FPB, no breakpoints\n");
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((lfd < 0) || bind(lfd, (struct sockaddr*)&sa, sizeof(sa)) || listen(lfd, 1)) {
+        printf("Err with listen on %d: %s\n", port, strerror(errno));
+        return -1;
+    }
+
+    printf("flash %08x+%x sram %08x+%x, listening on localhost:%d\n",
+           flash.base, flash.size, sram.base, sram.size, port);
+
+    for (;;) {
+        gdb_fd = accept(lfd, NULL, NULL);
+        if (gdb_fd < 0)
+            continue;
+        setsockopt(gdb_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        serve();
+
+        // leave the core running without breakpoints
+        sector_flush();
+        wbuf_flush();
+        fpb_clear_all();
+        core_resume(0);
+        close(gdb_fd);
+        printf("gdb detached\n");
+    }
+
+    return 0;
+}
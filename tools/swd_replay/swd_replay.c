@@ -0,0 +1,408 @@
+// Replay a swd bus capture through a simulated target
+//
+// # echo 1 > /sys/kernel/debug/swd/capture/enable
+// # cat /sys/kernel/debug/swd/capture/data > capture.bin
+// $ swd_replay [-r] [-v] capture.bin
+//
+// Each transaction of the capture is fed to a model of the SW-DP and the
+// MEM-AP 0 (SELECT, CTRL/STAT, CSW/TAR with auto increment, posted AP reads
+// and RDBUFF, a sparse memory). The model predicts what each read returns,
+// a value it has not seen yet is learned from the capture. Reads which
+// differ were changed by the target itself (registers, a running core) or
+// show a bus problem. The counts and the timing of the capture are shown,
+// -r paces the replay by the captured delays to reproduce the timing.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../include/swd_module.h"
+
+#define ACK_OK          1
+#define ACK_WAIT        2
+#define ACK_FAULT       4
+#define ACK_NOACK       7
+
+#define MEM_BITS        18          // words the model remembers, power of 2
+#define MEM_SIZE        (1 << MEM_BITS)
+#define CTRLSTAT_ACKS   0xF0000000  // power up requests and acks, the rest is sticky state
+
+#define DP_ABORT        0x0
+#define DP_CTRLSTAT     0x4
+#define DP_SELECT       0x8
+#define DP_RDBUFF       0xC
+#define AP_CSW          0x00
+#define AP_TAR          0x04
+#define AP_DRW          0x0C
+#define AP_BD0          0x10
+#define AP_IDR          0xFC
+
+struct mem_word {
+    uint32_t addr;
+    uint32_t val;
+    uint8_t used;
+};
+
+// what an AP read returns with the next AP read or RDBUFF
+struct pending {
+    int valid;
+    int known;
+    uint32_t key;       // address, or AP register | 1 for the registers
+    uint32_t val;
+};
+
+static struct {
+    uint32_t idcode;
+    int idcode_known;
+    uint32_t ctrlstat;
+    uint32_t select;
+    uint32_t csw;
+    uint32_t tar;
+    struct pending pend;
+    struct mem_word *mem;   // memory and the AP registers not modelled
+} sim;
+
+static struct {
+    uint64_t nr;
+    uint64_t type[4];   // APnDP | RnW << 1
+    uint64_t ack[8];
+    uint64_t retries;
+    uint64_t parity;
+    uint64_t dropped;
+    uint64_t matched;
+    uint64_t learned;
+    uint64_t differ;
+    uint64_t span_ns;
+    uint64_t busy_ns;
+    uint64_t dur_ns[4];
+    uint32_t dur_max[4];
+    uint64_t late_max_ns;
+} st;
+
+static int verbose;
+
+static const char *type_name[4] = {"DP write", "AP write", "DP read", "AP read"};
+
+static struct mem_word *mem_find(uint32_t key)
+{
+    uint32_t i;
+    uint32_t h = (key * 2654435761u) >> (32 - MEM_BITS);
+
+    for (i = 0 ; i < MEM_SIZE ; i++) {
+        struct mem_word *w = &sim.mem[(h + i) & (MEM_SIZE - 1)];
+
+        if (!w->used || (w->addr == key))
+            return w;
+    }
+
+    return NULL;
+}
+
+static void mem_set(uint32_t key, uint32_t val)
+{
+    struct mem_word *w = mem_find(key);
+
+    if (!w)
+        return;
+    w->used = 1;
+    w->addr = key;
+    w->val = val;
+}
+
+static int mem_get(uint32_t key, uint32_t *val)
+{
+    struct mem_word *w = mem_find(key);
+
+    if (!w || !w->used)
+        return 0;
+    *val = w->val;
+
+    return 1;
+}
+
+// compare what the model expects with what the target returned
+static const char *check(int known, uint32_t expect, uint32_t got, uint32_t mask)
+{
+    if (!known) {
+        st.learned++;
+        return "learned";
+    }
+
+    if ((expect & mask) == (got & mask)) {
+        st.matched++;
+        return "match";
+    }
+
+    st.differ++;
+    return "DIFF";
+}
+
+static const char *pend_check(uint32_t got)
+{
+    const char *r;
+
+    if (!sim.pend.valid)
+        return "";
+
+    r = check(sim.pend.known, sim.pend.val, got, 0xFFFFFFFF);
+    mem_set(sim.pend.key, got);
+    sim.pend.valid = 0;
+
+    return r;
+}
+
+static uint32_t ap_addr(uint8_t reg)
+{
+    return (sim.select & 0xF0) | reg;
+}
+
+// the memory word an access of DRW or a banked register goes to
+static uint32_t ap_mem_addr(uint32_t addr)
+{
+    if (addr == AP_DRW)
+        return sim.tar & ~0x3;
+
+    return (sim.tar & ~0xF) | (addr & 0xC);
+}
+
+static void ap_increment(void)
+{
+    switch ((sim.csw >> 4) & 0x3) {
+    case 1:
+        sim.tar += 1 << (sim.csw & 0x7);
+        break;
+    case 2:
+        sim.tar += 4;
+        break;
+    }
+}
+
+static const char *sim_dp(int rnw, uint8_t reg, uint32_t data)
+{
+    const char *r = "";
+
+    if (!rnw) {
+        if (reg == DP_CTRLSTAT)
+            sim.ctrlstat = data;
+        else if (reg == DP_SELECT)
+            sim.select = data;
+        return r;
+    }
+
+    switch (reg) {
+    case 0x0:
+        r = check(sim.idcode_known, sim.idcode, data, 0xFFFFFFFF);
+        sim.idcode = data;
+        sim.idcode_known = 1;
+        break;
+    case DP_CTRLSTAT:
+        // the acks follow the power up requests
+        r = check(1, (sim.ctrlstat & 0x50000000) << 1 | (sim.ctrlstat & 0x50000000), data, CTRLSTAT_ACKS);
+        break;
+    case DP_RDBUFF:
+        r = pend_check(data);
+        break;
+    }
+
+    return r;
+}
+
+static const char *sim_ap(int rnw, uint8_t reg, uint32_t data)
+{
+    const char *r = "";
+    uint32_t addr = ap_addr(reg);
+    uint32_t key;
+    uint32_t val = 0;
+    int known;
+
+    // only the MEM-AP 0 is modelled, other APs are remembered by register
+    if (sim.select >> 24)
+        addr = 0;
+
+    if (!rnw) {
+        if (addr == AP_CSW) {
+            sim.csw = data;
+        } else if (addr == AP_TAR) {
+            sim.tar = data;
+        } else if ((addr == AP_DRW) || ((addr & 0xF0) == AP_BD0)) {
+            // a word is kept whole, a smaller access makes it unknown
+            if ((sim.csw & 0x7) == 2)
+                mem_set(ap_mem_addr(addr), data);
+            else if (mem_find(ap_mem_addr(addr)))
+                mem_find(ap_mem_addr(addr))->used = 0;
+            if (addr == AP_DRW)
+                ap_increment();
+        } else {
+            mem_set((sim.select & 0xFF0000F0) | reg | 1, data);
+        }
+        return r;
+    }
+
+    // the data of an AP read is the one of the read before
+    r = pend_check(data);
+
+    if (addr == AP_CSW) {
+        key = AP_CSW | 1;
+        val = sim.csw;
+        known = 1;
+    } else if (addr == AP_TAR) {
+        key = AP_TAR | 1;
+        val = sim.tar;
+        known = 1;
+    } else if ((addr == AP_DRW) || ((addr & 0xF0) == AP_BD0)) {
+        key = ap_mem_addr(addr);
+        known = ((sim.csw & 0x7) == 2) && mem_get(key, &val);
+        if (addr == AP_DRW)
+            ap_increment();
+    } else {
+        key = (sim.select & 0xFF0000F0) | reg | 1;
+        known = mem_get(key, &val);
+    }
+
+    sim.pend.valid = 1;
+    sim.pend.known = known;
+    sim.pend.key = key;
+    sim.pend.val = val;
+
+    return r;
+}
+
+// sleep until the captured time of this transaction
+static void pace(struct timespec *start, uint64_t at_ns)
+{
+    struct timespec t;
+    uint64_t now_ns;
+
+    t.tv_sec = start->tv_sec + (start->tv_nsec + at_ns) / 1000000000ull;
+    t.tv_nsec = (start->tv_nsec + at_ns) % 1000000000ull;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    now_ns = (uint64_t)(t.tv_sec - start->tv_sec) * 1000000000ull + t.tv_nsec - start->tv_nsec;
+    if (now_ns - at_ns > st.late_max_ns)
+        st.late_max_ns = now_ns - at_ns;
+}
+
+static void replay(const struct swd_cap_rec *rec, struct timespec *start)
+{
+    int type = rec->request & (SWD_DAP_APNDP | SWD_DAP_RNW);
+    int rnw = !!(rec->request & SWD_DAP_RNW);
+    uint8_t reg = rec->request & SWD_DAP_A32;
+    const char *r = "";
+
+    // the first delta is the time from the enable, not a gap of the bus
+    if (st.nr)
+        st.span_ns += rec->delta_ns;
+    st.nr++;
+
+    if (start)
+        pace(start, st.span_ns);
+
+    st.type[type]++;
+    st.ack[rec->ack & 0x7]++;
+    st.retries += (rec->ack == ACK_WAIT);
+    st.busy_ns += rec->duration_ns;
+    st.dur_ns[type] += rec->duration_ns;
+    if (rec->duration_ns > st.dur_max[type])
+        st.dur_max[type] = rec->duration_ns;
+    if (rec->flags & SWD_CAP_PARITY_ERR)
+        st.parity++;
+    if (rec->flags & SWD_CAP_DROPPED)
+        st.dropped++;
+
+    // a WAIT or FAULT did nothing, a parity error is not trusted
+    if ((rec->ack == ACK_OK) && !(rec->flags & SWD_CAP_PARITY_ERR)) {
+        if (rec->request & SWD_DAP_APNDP)
+            r = sim_ap(rnw, reg, rec->data);
+        else
+            r = sim_dp(rnw, reg, rec->data);
+    }
+
+    if (verbose)
+        printf("%12.3f us %-8s %X ack:%u retry:%-3u %s%s%08x %s\n",
+               st.span_ns / 1000.0, type_name[type], reg, rec->ack, rec->retry,
+               (rec->flags & SWD_CAP_DROPPED) ? "(after a gap) " : "",
+               (rec->flags & SWD_CAP_PARITY_ERR) ? "parity " : "",
+               rec->data, r);
+}
+
+static void report(void)
+{
+    int i;
+
+    printf("transactions: %llu, span %.3f ms, bus busy %.3f ms\n",
+           (unsigned long long)st.nr, st.span_ns / 1e6, st.busy_ns / 1e6);
+
+    for (i = 0 ; i < 4 ; i++) {
+        if (!st.type[i])
+            continue;
+        printf("  %-8s %10llu  mean %8.3f us  max %8.3f us\n", type_name[i],
+               (unsigned long long)st.type[i], st.dur_ns[i] / 1000.0 / st.type[i], st.dur_max[i] / 1000.0);
+    }
+
+    printf("acks: ok %llu, wait %llu, fault %llu, no ack %llu\n",
+           (unsigned long long)st.ack[ACK_OK], (unsigned long long)st.ack[ACK_WAIT],
+           (unsigned long long)st.ack[ACK_FAULT], (unsigned long long)st.ack[ACK_NOACK]);
+    printf("retries: %llu, parity errors: %llu, gaps: %llu\n",
+           (unsigned long long)st.retries, (unsigned long long)st.parity, (unsigned long long)st.dropped);
+    printf("reads: %llu as the model expected, %llu learned, %llu differing\n",
+           (unsigned long long)st.matched, (unsigned long long)st.learned, (unsigned long long)st.differ);
+    if (st.late_max_ns)
+        printf("replay timing: latest by %.3f us\n", st.late_max_ns / 1000.0);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    int realtime = 0;
+    FILE *f;
+    struct swd_cap_rec rec;
+    struct timespec start;
+
+    while ((opt = getopt(argc, argv, "rv")) != -1) {
+        switch (opt) {
+        case 'r':
+            realtime = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            printf("usage: %s [-r] [-v] capture.bin\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind >= argc) {
+        printf("usage: %s [-r] [-v] capture.bin\n", argv[0]);
+        return -1;
+    }
+
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+        printf("Err with open %s\n", argv[optind]);
+        return -1;
+    }
+
+    sim.mem = calloc(MEM_SIZE, sizeof(struct mem_word));
+    if (!sim.mem) {
+        fclose(f);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (fread(&rec, sizeof(rec), 1, f) == 1)
+        replay(&rec, realtime ? &start : NULL);
+
+    report();
+
+    free(sim.mem);
+    fclose(f);
+
+    return 0;
+}